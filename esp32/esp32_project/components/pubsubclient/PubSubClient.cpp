@@ -8,12 +8,55 @@
 #include "PubSubClient.h"
 #include "Arduino.h"
 
+// MQTT 5 Variable Byte Integer, as used for property lengths
+static uint16_t writeVarInt(uint32_t value, uint8_t* buf, uint16_t pos) {
+    do {
+        uint8_t digit = value & 127;
+        value >>= 7;
+        if (value > 0) {
+            digit |= 0x80;
+        }
+        buf[pos++] = digit;
+    } while (value > 0);
+    return pos;
+}
+
+static uint8_t varIntSize(uint32_t value) {
+    uint8_t size = 1;
+    while (value >= 128) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+// Returns the number of bytes read, 0 if the encoding is invalid or runs past end
+static uint8_t readVarInt(const uint8_t* buf, uint32_t available, uint32_t* value) {
+    *value = 0;
+    for (uint8_t i = 0; i < 4 && i < available; i++) {
+        *value |= (uint32_t)(buf[i] & 127) << (7 * i);
+        if ((buf[i] & 128) == 0) {
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
 PubSubClient::PubSubClient() {
     this->_state = MQTT_DISCONNECTED;
     this->_client = NULL;
     this->stream = NULL;
     setCallback(NULL);
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -24,6 +67,15 @@ PubSubClient::PubSubClient(Client& client) {
     setClient(client);
     this->stream = NULL;
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -35,6 +87,15 @@ PubSubClient::PubSubClient(IPAddress addr, uint16_t port, Client& client) {
     setClient(client);
     this->stream = NULL;
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -45,6 +106,15 @@ PubSubClient::PubSubClient(IPAddress addr, uint16_t port, Client& client, Stream
     setClient(client);
     setStream(stream);
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -56,6 +126,15 @@ PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATUR
     setClient(client);
     this->stream = NULL;
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -67,6 +146,15 @@ PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATUR
     setClient(client);
     setStream(stream);
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -78,6 +166,15 @@ PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, Client& client) {
     setClient(client);
     this->stream = NULL;
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -88,6 +185,15 @@ PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, Client& client, Stream& s
     setClient(client);
     setStream(stream);
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -99,6 +205,15 @@ PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE,
     setClient(client);
     this->stream = NULL;
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -110,6 +225,15 @@ PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE,
     setClient(client);
     setStream(stream);
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -121,6 +245,15 @@ PubSubClient::PubSubClient(const char* domain, uint16_t port, Client& client) {
     setClient(client);
     this->stream = NULL;
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -131,6 +264,15 @@ PubSubClient::PubSubClient(const char* domain, uint16_t port, Client& client, St
     setClient(client);
     setStream(stream);
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -142,6 +284,15 @@ PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGN
     setClient(client);
     this->stream = NULL;
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -153,6 +304,15 @@ PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGN
     setClient(client);
     setStream(stream);
     this->bufferSize = 0;
+    this->inflightCount = 0;
+    this->pubackCallback = NULL;
+    this->protocolVersion = MQTT_VERSION;
+    this->serverTopicAliasMax = 0;
+    this->serverReceiveMax = MQTT_MAX_INFLIGHT;
+    this->serverMaxQos = 1;
+    this->serverMaxPacketSize = 0xFFFFFFFF;
+    this->sessionKeepAlive = MQTT_KEEPALIVE;
+    this->topicAliasCount = 0;
     setBufferSize(MQTT_MAX_PACKET_SIZE);
     setKeepAlive(MQTT_KEEPALIVE);
     setSocketTimeout(MQTT_SOCKET_TIMEOUT);
@@ -206,8 +366,16 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
             uint8_t d[7] = {0x00,0x04,'M','Q','T','T',MQTT_VERSION};
 #define MQTT_HEADER_VERSION_LENGTH 7
 #endif
-            for (j = 0;j<MQTT_HEADER_VERSION_LENGTH;j++) {
-                this->buffer[length++] = d[j];
+            uint8_t d5[7] = {0x00,0x04,'M','Q','T','T',MQTT_VERSION_5};
+            boolean v5 = this->protocolVersion == MQTT_VERSION_5;
+            if (v5) {
+                for (j = 0;j<7;j++) {
+                    this->buffer[length++] = d5[j];
+                }
+            } else {
+                for (j = 0;j<MQTT_HEADER_VERSION_LENGTH;j++) {
+                    this->buffer[length++] = d[j];
+                }
             }
 
             uint8_t v;
@@ -231,10 +399,16 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
 
             this->buffer[length++] = ((this->keepAlive) >> 8);
             this->buffer[length++] = ((this->keepAlive) & 0xFF);
+            if (v5) {
+                this->buffer[length++] = 0; // No connect properties
+            }
 
             CHECK_STRING_LENGTH(length,id)
             length = writeString(id,this->buffer,length);
             if (willTopic) {
+                if (v5) {
+                    this->buffer[length++] = 0; // No will properties
+                }
                 CHECK_STRING_LENGTH(length,willTopic)
                 length = writeString(willTopic,this->buffer,length);
                 CHECK_STRING_LENGTH(length,willMessage)
@@ -265,14 +439,30 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
             uint8_t llen;
             uint32_t len = readPacket(&llen);
 
-            if (len == 4) {
-                if (buffer[3] == 0) {
+            // CONNACK: flags and return code, then properties on MQTT 5
+            if ((buffer[0]&0xF0) == MQTTCONNACK && (len == 4 || (v5 && len > 4))) {
+                uint8_t code = buffer[llen+2];
+                if (code == 0) {
                     lastInActivity = millis();
                     pingOutstanding = false;
                     _state = MQTT_CONNECTED;
+                    // Clean session: the broker has forgotten earlier packet ids
+                    inflightCount = 0;
+                    // Aliases only live as long as the connection
+                    serverTopicAliasMax = 0;
+                    serverReceiveMax = MQTT_MAX_INFLIGHT;
+                    serverMaxQos = 1;
+                    serverMaxPacketSize = 0xFFFFFFFF;
+                    sessionKeepAlive = keepAlive;
+                    for (uint8_t i = 0; i < topicAliasCount; i++) {
+                        topicAliases[i].announced = false;
+                    }
+                    if (v5) {
+                        readConnackProperties(llen+3, len);
+                    }
                     return true;
                 } else {
-                    _state = buffer[3];
+                    _state = code;
                 }
             }
             _client->stop();
@@ -284,6 +474,68 @@ boolean PubSubClient::connect(const char *id, const char *user, const char *pass
     return true;
 }
 
+void PubSubClient::readConnackProperties(uint16_t pos, uint16_t end) {
+    uint32_t propertiesLength;
+    uint8_t n = readVarInt(this->buffer+pos, end-pos, &propertiesLength);
+    if (n == 0 || propertiesLength > (uint32_t)(end-pos-n)) {
+        return;
+    }
+    pos += n;
+    end = pos + propertiesLength;
+    while (pos < end) {
+        uint8_t id = this->buffer[pos++];
+        uint32_t size;
+        switch (id) {
+            case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:
+                size = 1;
+                break;
+            case 0x13: case 0x21: case 0x22:
+                size = 2;
+                break;
+            case 0x11: case 0x27:
+                size = 4;
+                break;
+            case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F:
+                // UTF-8 string or binary data
+                if (end-pos < 2) return;
+                size = 2 + ((this->buffer[pos]<<8) | this->buffer[pos+1]);
+                break;
+            case 0x26:
+                // User property: a pair of strings
+                if (end-pos < 2) return;
+                size = 2 + ((this->buffer[pos]<<8) | this->buffer[pos+1]);
+                if ((uint32_t)(end-pos) < size+2) return;
+                size += 2 + ((this->buffer[pos+size]<<8) | this->buffer[pos+size+1]);
+                break;
+            default:
+                // Not a CONNACK property
+                return;
+        }
+        if ((uint32_t)(end-pos) < size) {
+            return;
+        }
+        if (id == 0x13) {
+            sessionKeepAlive = (this->buffer[pos]<<8) | this->buffer[pos+1];
+        } else if (id == 0x24) {
+            serverMaxQos = this->buffer[pos];
+        } else if (id == 0x27) {
+            uint32_t maxPacketSize = ((uint32_t)this->buffer[pos]<<24) | ((uint32_t)this->buffer[pos+1]<<16) |
+                                     ((uint32_t)this->buffer[pos+2]<<8) | this->buffer[pos+3];
+            if (maxPacketSize > 0) {
+                serverMaxPacketSize = maxPacketSize;
+            }
+        } else if (id == 0x22) {
+            serverTopicAliasMax = (this->buffer[pos]<<8) | this->buffer[pos+1];
+        } else if (id == 0x21) {
+            uint16_t receiveMax = (this->buffer[pos]<<8) | this->buffer[pos+1];
+            if (receiveMax > 0 && receiveMax < serverReceiveMax) {
+                serverReceiveMax = receiveMax;
+            }
+        }
+        pos += size;
+    }
+}
+
 // reads a byte into result
 boolean PubSubClient::readByte(uint8_t * result) {
    uint32_t previousMillis = millis();
@@ -370,7 +622,20 @@ uint32_t PubSubClient::readPacket(uint8_t* lengthLength) {
 boolean PubSubClient::loop() {
     if (connected()) {
         unsigned long t = millis();
-        if ((t - lastInActivity > this->keepAlive*1000UL) || (t - lastOutActivity > this->keepAlive*1000UL)) {
+        if (serverMaxQos == 0 && inflightCount > 0) {
+            // Sent at QoS 0, so no PUBACK is coming
+            uint8_t count = inflightCount;
+            inflightCount = 0;
+            for (uint8_t i = 0; i < count; i++) {
+                if (pubackCallback) {
+                    pubackCallback(inflight[i], 0);
+                }
+            }
+        }
+        // A Server Keep Alive of 0 turns keep alive off
+        if (this->sessionKeepAlive > 0 &&
+            ((t - lastInActivity > this->sessionKeepAlive*1000UL) ||
+             (t - lastOutActivity > this->sessionKeepAlive*1000UL))) {
             if (pingOutstanding) {
                 this->_state = MQTT_CONNECTION_TIMEOUT;
                 _client->stop();
@@ -399,10 +664,23 @@ boolean PubSubClient::loop() {
                         this->buffer[llen+2+tl] = 0; /* end the topic as a 'C' string with \x00 */
                         char *topic = (char*) this->buffer+llen+2;
                         // msgId only present for QOS>0
+                        uint16_t offset = llen+3+tl;
+                        if ((this->buffer[0]&0x06) == MQTTQOS1) {
+                            offset += 2;
+                        }
+                        if (this->protocolVersion == MQTT_VERSION_5) {
+                            // Properties are not passed on
+                            uint32_t propertiesLength;
+                            uint8_t n = readVarInt(this->buffer+offset, len-offset, &propertiesLength);
+                            if (n == 0 || propertiesLength > (uint32_t)(len-offset-n)) {
+                                return true;
+                            }
+                            offset += n + propertiesLength;
+                        }
+                        payload = this->buffer+offset;
                         if ((this->buffer[0]&0x06) == MQTTQOS1) {
                             msgId = (this->buffer[llen+3+tl]<<8)+this->buffer[llen+3+tl+1];
-                            payload = this->buffer+llen+3+tl+2;
-                            callback(topic,payload,len-llen-3-tl-2);
+                            callback(topic,payload,len-offset);
 
                             this->buffer[0] = MQTTPUBACK;
                             this->buffer[1] = 2;
@@ -412,8 +690,24 @@ boolean PubSubClient::loop() {
                             lastOutActivity = t;
 
                         } else {
-                            payload = this->buffer+llen+3+tl;
-                            callback(topic,payload,len-llen-3-tl);
+                            callback(topic,payload,len-offset);
+                        }
+                    }
+                } else if (type == MQTTPUBACK) {
+                    msgId = (this->buffer[llen+1]<<8)+this->buffer[llen+2];
+                    // MQTT 5 adds a reason code unless it is 0 (success)
+                    uint8_t reasonCode = 0;
+                    if (this->protocolVersion == MQTT_VERSION_5 && len > (uint16_t)(llen+3)) {
+                        reasonCode = this->buffer[llen+3];
+                    }
+                    for (uint8_t i = 0; i < inflightCount; i++) {
+                        if (inflight[i] == msgId) {
+                            memmove(inflight+i, inflight+i+1, (inflightCount-i-1)*sizeof(uint16_t));
+                            inflightCount--;
+                            if (pubackCallback) {
+                                pubackCallback(msgId, reasonCode);
+                            }
+                            break;
                         }
                     }
                 } else if (type == MQTTPINGREQ) {
@@ -446,6 +740,11 @@ boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigne
 }
 
 boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
+    if (this->protocolVersion == MQTT_VERSION_5) {
+        // Needs the properties field (and the topic alias, if any)
+        MQTTIoVec iov = { payload, plength };
+        return publishv(topic, &iov, 1, retained);
+    }
     if (connected()) {
         if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2+strnlen(topic, this->bufferSize) + plength) {
             // Too long
@@ -489,6 +788,15 @@ boolean PubSubClient::publish_P(const char* topic, const uint8_t* payload, unsig
     if (!connected()) {
         return false;
     }
+    if (this->protocolVersion == MQTT_VERSION_5) {
+        if (!beginPublish(topic, plength, retained)) {
+            return false;
+        }
+        for (i=0;i<plength;i++) {
+            rc += write((uint8_t)pgm_read_byte_near(payload + i));
+        }
+        return rc == plength;
+    }
 
     tlen = strnlen(topic, this->bufferSize);
 
@@ -524,18 +832,70 @@ boolean PubSubClient::publish_P(const char* topic, const uint8_t* payload, unsig
 }
 
 boolean PubSubClient::beginPublish(const char* topic, unsigned int plength, boolean retained) {
+    return beginPublish(topic, plength, retained, 0, NULL, 0);
+}
+
+boolean PubSubClient::beginPublish(const char* topic, unsigned int plength, boolean retained, uint16_t msgId,
+                                   const uint8_t* properties, size_t propertiesLength) {
     if (connected()) {
+        boolean v5 = this->protocolVersion == MQTT_VERSION_5;
+        TopicAlias* alias = NULL;
+        if (v5) {
+            for (uint8_t i = 0; i < topicAliasCount; i++) {
+                if (topicAliases[i].alias <= serverTopicAliasMax && strcmp(topicAliases[i].topic, topic) == 0) {
+                    alias = &topicAliases[i];
+                    break;
+                }
+            }
+        }
+        const char* name = (alias && alias->announced) ? "" : topic;
+        size_t propsLength = propertiesLength + (alias ? 3 : 0);
+        // Topic and msgId, then the properties length and properties
+        if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strnlen(name, this->bufferSize) + 2 +
+                               (v5 ? varIntSize(propsLength) + propsLength : 0)) {
+            return false;
+        }
+
         // Send the header and variable length field
         uint16_t length = MQTT_MAX_HEADER_SIZE;
-        length = writeString(topic,this->buffer,length);
+        length = writeString(name,this->buffer,length);
         uint8_t header = MQTTPUBLISH;
         if (retained) {
             header |= 1;
         }
+        if (msgId != 0) {
+            header |= MQTTQOS1;
+            this->buffer[length++] = (msgId >> 8);
+            this->buffer[length++] = (msgId & 0xFF);
+        }
+        if (v5) {
+            length = writeVarInt(propsLength, this->buffer, length);
+            if (alias) {
+                this->buffer[length++] = 0x23; // Topic Alias
+                this->buffer[length++] = (alias->alias >> 8);
+                this->buffer[length++] = (alias->alias & 0xFF);
+            }
+            if (propertiesLength > 0) {
+                memcpy(this->buffer+length, properties, propertiesLength);
+                length += propertiesLength;
+            }
+        }
+        uint32_t remaining = plength+length-MQTT_MAX_HEADER_SIZE;
+        if (v5 && 1 + varIntSize(remaining) + remaining > serverMaxPacketSize) {
+            // Larger than the broker's Maximum Packet Size; it would disconnect
+            return false;
+        }
         size_t hlen = buildHeader(header, this->buffer, plength+length-MQTT_MAX_HEADER_SIZE);
         uint16_t rc = _client->write(this->buffer+(MQTT_MAX_HEADER_SIZE-hlen),length-(MQTT_MAX_HEADER_SIZE-hlen));
         lastOutActivity = millis();
-        return (rc == (length-(MQTT_MAX_HEADER_SIZE-hlen)));
+        if (rc != (length-(MQTT_MAX_HEADER_SIZE-hlen))) {
+            abortPacket();
+            return false;
+        }
+        if (alias) {
+            alias->announced = true;
+        }
+        return true;
     }
     return false;
 }
@@ -544,6 +904,101 @@ int PubSubClient::endPublish() {
  return 1;
 }
 
+boolean PubSubClient::publishv(const char* topic, const MQTTIoVec* iov, size_t iovcnt, boolean retained) {
+    return publishv(topic, iov, iovcnt, retained, NULL, 0);
+}
+
+boolean PubSubClient::publishv(const char* topic, const MQTTIoVec* iov, size_t iovcnt, boolean retained,
+                               const uint8_t* properties, size_t propertiesLength) {
+    if (this->bufferSize < MQTT_MAX_HEADER_SIZE + 2 + strnlen(topic, this->bufferSize)) {
+        // Topic alone does not fit the buffer
+        return false;
+    }
+    if (propertiesLength > 0 && this->protocolVersion != MQTT_VERSION_5) {
+        return false;
+    }
+    size_t plength = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        plength += iov[i].length;
+    }
+    if (!beginPublish(topic, plength, retained, 0, properties, propertiesLength)) {
+        return false;
+    }
+    return writeSegments(iov, iovcnt) && endPublish();
+}
+
+uint16_t PubSubClient::publishQos1(const char* topic, const MQTTIoVec* iov, size_t iovcnt, boolean retained) {
+    if (inflightCount >= MQTT_MAX_INFLIGHT || inflightCount >= serverReceiveMax ||
+        this->bufferSize < MQTT_MAX_HEADER_SIZE + 4 + strnlen(topic, this->bufferSize)) {
+        return 0;
+    }
+    size_t plength = 0;
+    for (size_t i = 0; i < iovcnt; i++) {
+        plength += iov[i].length;
+    }
+
+    nextMsgId++;
+    if (nextMsgId == 0) {
+        nextMsgId = 1;
+    }
+    uint16_t msgId = nextMsgId;
+    // Clamped to the broker's Maximum QoS; loop() then completes the id
+    uint16_t packetId = serverMaxQos > 0 ? msgId : 0;
+    if (!beginPublish(topic, plength, retained, packetId, NULL, 0) || !writeSegments(iov, iovcnt)) {
+        return 0;
+    }
+    inflight[inflightCount++] = msgId;
+    return msgId;
+}
+
+uint8_t PubSubClient::getInflightCount() {
+    return inflightCount;
+}
+
+boolean PubSubClient::setTopicAlias(const char* topic, uint16_t alias) {
+    if (topic == NULL || alias == 0) {
+        return false;
+    }
+    for (uint8_t i = 0; i < topicAliasCount; i++) {
+        if (topicAliases[i].topic == topic || strcmp(topicAliases[i].topic, topic) == 0) {
+            // The broker maps aliases per connection; wait for the next one
+            topicAliases[i].topic = topic;
+            topicAliases[i].announced = topicAliases[i].announced && topicAliases[i].alias == alias;
+            topicAliases[i].alias = alias;
+            return true;
+        }
+    }
+    if (topicAliasCount >= MQTT_MAX_TOPIC_ALIASES) {
+        return false;
+    }
+    topicAliases[topicAliasCount].topic = topic;
+    topicAliases[topicAliasCount].alias = alias;
+    topicAliases[topicAliasCount].announced = false;
+    topicAliasCount++;
+    return true;
+}
+
+uint16_t PubSubClient::getServerTopicAliasMax() {
+    return serverTopicAliasMax;
+}
+
+boolean PubSubClient::writeSegments(const MQTTIoVec* iov, size_t iovcnt) {
+    for (size_t i = 0; i < iovcnt; i++) {
+        if (iov[i].length > 0 && write(iov[i].data, iov[i].length) != iov[i].length) {
+            abortPacket();
+            return false;
+        }
+    }
+    return true;
+}
+
+void PubSubClient::abortPacket() {
+    // The broker has part of a packet and would read whatever comes next
+    // as the rest of it; the session can't be resynced, only dropped
+    _state = MQTT_CONNECTION_LOST;
+    _client->stop();
+}
+
 size_t PubSubClient::write(uint8_t data) {
     lastOutActivity = millis();
     return _client->write(data);
@@ -614,7 +1069,7 @@ boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
     if (qos > 1) {
         return false;
     }
-    if (this->bufferSize < 9 + topicLength) {
+    if (this->bufferSize < 9 + topicLength + (this->protocolVersion == MQTT_VERSION_5 ? 1 : 0)) {
         // Too long
         return false;
     }
@@ -627,6 +1082,9 @@ boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
         }
         this->buffer[length++] = (nextMsgId >> 8);
         this->buffer[length++] = (nextMsgId & 0xFF);
+        if (this->protocolVersion == MQTT_VERSION_5) {
+            this->buffer[length++] = 0; // No subscribe properties
+        }
         length = writeString((char*)topic, this->buffer,length);
         this->buffer[length++] = qos;
         return write(MQTTSUBSCRIBE|MQTTQOS1,this->buffer,length-MQTT_MAX_HEADER_SIZE);
@@ -639,7 +1097,7 @@ boolean PubSubClient::unsubscribe(const char* topic) {
     if (topic == 0) {
         return false;
     }
-    if (this->bufferSize < 9 + topicLength) {
+    if (this->bufferSize < 9 + topicLength + (this->protocolVersion == MQTT_VERSION_5 ? 1 : 0)) {
         // Too long
         return false;
     }
@@ -651,6 +1109,9 @@ boolean PubSubClient::unsubscribe(const char* topic) {
         }
         this->buffer[length++] = (nextMsgId >> 8);
         this->buffer[length++] = (nextMsgId & 0xFF);
+        if (this->protocolVersion == MQTT_VERSION_5) {
+            this->buffer[length++] = 0; // No unsubscribe properties
+        }
         length = writeString(topic, this->buffer,length);
         return write(MQTTUNSUBSCRIBE|MQTTQOS1,this->buffer,length-MQTT_MAX_HEADER_SIZE);
     }
@@ -723,6 +1184,11 @@ PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
     return *this;
 }
 
+PubSubClient& PubSubClient::setPubAckCallback(MQTT_PUBACK_CALLBACK_SIGNATURE) {
+    this->pubackCallback = pubackCallback;
+    return *this;
+}
+
 PubSubClient& PubSubClient::setClient(Client& client){
     this->_client = &client;
     return *this;
@@ -767,3 +1233,7 @@ PubSubClient& PubSubClient::setSocketTimeout(uint16_t timeout) {
     this->socketTimeout = timeout;
     return *this;
 }
+PubSubClient& PubSubClient::setProtocolVersion(uint8_t version) {
+    this->protocolVersion = version;
+    return *this;
+}
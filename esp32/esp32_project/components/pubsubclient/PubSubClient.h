@@ -14,6 +14,7 @@
 
 #define MQTT_VERSION_3_1      3
 #define MQTT_VERSION_3_1_1    4
+#define MQTT_VERSION_5        5
 
 // MQTT_VERSION : Pick the version
 //#define MQTT_VERSION MQTT_VERSION_3_1
@@ -36,6 +37,17 @@
 #define MQTT_SOCKET_TIMEOUT 15
 #endif
 
+// MQTT_MAX_INFLIGHT : Maximum number of QoS 1 publishes awaiting PUBACK
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 8
+#endif
+
+// MQTT_MAX_TOPIC_ALIASES : Number of outgoing topics that can be given an
+//  MQTT 5 topic alias with setTopicAlias()
+#ifndef MQTT_MAX_TOPIC_ALIASES
+#define MQTT_MAX_TOPIC_ALIASES 8
+#endif
+
 // MQTT_MAX_TRANSFER_SIZE : limit how much data is passed to the network client
 //  in each write call. Needed for the Arduino Wifi Shield. Leave undefined to
 //  pass the entire MQTT packet in each write call.
@@ -79,10 +91,18 @@
 #if defined(ESP8266) || defined(ESP32)
 #include <functional>
 #define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+#define MQTT_PUBACK_CALLBACK_SIGNATURE std::function<void(uint16_t, uint8_t)> pubackCallback
 #else
 #define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+#define MQTT_PUBACK_CALLBACK_SIGNATURE void (*pubackCallback)(uint16_t, uint8_t)
 #endif
 
+// One segment of a scatter/gather publish payload
+struct MQTTIoVec {
+   const uint8_t* data;
+   size_t length;
+};
+
 #define CHECK_STRING_LENGTH(l,s) if (l+2+strnlen(s, this->bufferSize) > this->bufferSize) {_client->stop();return false;}
 
 class PubSubClient : public Print {
@@ -97,6 +117,24 @@ private:
    unsigned long lastInActivity;
    bool pingOutstanding;
    MQTT_CALLBACK_SIGNATURE;
+   MQTT_PUBACK_CALLBACK_SIGNATURE;
+   uint16_t inflight[MQTT_MAX_INFLIGHT];
+   uint8_t inflightCount;
+   uint8_t protocolVersion;
+   // From the MQTT 5 CONNACK; 0 means the broker takes no topic aliases
+   uint16_t serverTopicAliasMax;
+   uint16_t serverReceiveMax;
+   uint8_t serverMaxQos;
+   uint32_t serverMaxPacketSize;
+   // keepAlive, or the Server Keep Alive the broker asked for instead
+   uint16_t sessionKeepAlive;
+   struct TopicAlias {
+      const char* topic;
+      uint16_t alias;
+      boolean announced;  // Topic name already sent with the alias on this connection
+   };
+   TopicAlias topicAliases[MQTT_MAX_TOPIC_ALIASES];
+   uint8_t topicAliasCount;
    uint32_t readPacket(uint8_t*);
    boolean readByte(uint8_t * result);
    boolean readByte(uint8_t * result, uint16_t * index);
@@ -107,6 +145,13 @@ private:
    // Note: the header is built at the end of the first MQTT_MAX_HEADER_SIZE bytes, so will start
    //       (MQTT_MAX_HEADER_SIZE - <returned size>) bytes into the buffer
    size_t buildHeader(uint8_t header, uint8_t* buf, uint16_t length);
+   // msgId 0 starts a QoS 0 publish, anything else a QoS 1 publish with that id
+   // properties are MQTT 5 publish properties, sent after any topic alias
+   boolean beginPublish(const char* topic, unsigned int plength, boolean retained, uint16_t msgId,
+                        const uint8_t* properties, size_t propertiesLength);
+   void readConnackProperties(uint16_t pos, uint16_t end);
+   boolean writeSegments(const MQTTIoVec* iov, size_t iovcnt);
+   void abortPacket();
    IPAddress ip;
    const char* domain;
    uint16_t port;
@@ -134,10 +179,18 @@ public:
    PubSubClient& setServer(uint8_t * ip, uint16_t port);
    PubSubClient& setServer(const char * domain, uint16_t port);
    PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
+   // Called from loop() with the packet id and reason code of each PUBACK
+   // received. The id leaves the window either way; a code of 0x80 or more
+   // (MQTT 5 only) means the broker refused the message.
+   PubSubClient& setPubAckCallback(MQTT_PUBACK_CALLBACK_SIGNATURE);
    PubSubClient& setClient(Client& client);
    PubSubClient& setStream(Stream& stream);
    PubSubClient& setKeepAlive(uint16_t keepAlive);
    PubSubClient& setSocketTimeout(uint16_t timeout);
+   // MQTT_VERSION (the default) or MQTT_VERSION_5, used from the next connect().
+   // MQTT 5 packets carry properties; incoming ones are skipped, and a Stream
+   // set with setStream() receives them ahead of the payload.
+   PubSubClient& setProtocolVersion(uint8_t version);
 
    boolean setBufferSize(uint16_t size);
    uint16_t getBufferSize();
@@ -171,6 +224,31 @@ public:
    // Write size bytes from buffer into the payload (only to be used with beginPublish/endPublish)
    // Returns the number of bytes written
    virtual size_t write(const uint8_t *buffer, size_t size);
+   // Publish a payload made of several segments, each written straight to the
+   // network client. Only the topic passes through the internal buffer, so the
+   // payload may be larger than the buffer and is never copied.
+   // Returns 1 if the whole message was sent, 0 if there was an error
+   boolean publishv(const char* topic, const MQTTIoVec* iov, size_t iovcnt, boolean retained);
+   // MQTT 5 only: as publishv, with encoded publish properties (e.g. content
+   // type or user properties) that must fit the buffer along with the topic
+   boolean publishv(const char* topic, const MQTTIoVec* iov, size_t iovcnt, boolean retained,
+                    const uint8_t* properties, size_t propertiesLength);
+   // QoS 1 variant of publishv. Up to MQTT_MAX_INFLIGHT messages may await
+   // their PUBACK at once; PUBACKs are handled in loop(). The caller keeps
+   // the payload if it wants to resend after a disconnect. If the MQTT 5
+   // broker only takes QoS 0, the message goes out at QoS 0 and the next
+   // loop() reports it acknowledged.
+   // Returns the packet id, or 0 if the window is full or sending failed
+   uint16_t publishQos1(const char* topic, const MQTTIoVec* iov, size_t iovcnt, boolean retained);
+   // Number of QoS 1 publishes still waiting for their PUBACK
+   uint8_t getInflightCount();
+   // MQTT 5: the first publish to `topic` on each connection carries both the
+   // name and `alias`, later ones only the 2-byte alias. Aliases above the
+   // broker's Topic Alias Maximum are not used. `topic` must stay valid.
+   // Returns false if the table is full or alias is 0.
+   boolean setTopicAlias(const char* topic, uint16_t alias);
+   // Topic Alias Maximum from the last CONNACK, 0 before MQTT 5 connects
+   uint16_t getServerTopicAliasMax();
    boolean subscribe(const char* topic);
    boolean subscribe(const char* topic, uint8_t qos);
    boolean unsubscribe(const char* topic);
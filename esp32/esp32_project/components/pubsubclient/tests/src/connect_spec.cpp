@@ -312,6 +312,48 @@ int test_connect_custom_keepalive() {
 }
 
 
+int test_connect_mqtt5() {
+    IT("sends an MQTT 5 connect packet and reads connack properties");
+    ShimClient shimClient;
+
+    shimClient.setAllowConnect(true);
+    byte connect[] = {0x10,0x19,0x0,0x4,0x4d,0x51,0x54,0x54,0x5,0x2,0x0,0xf,0x0,0x0,0xc,0x63,0x6c,0x69,0x65,0x6e,0x74,0x5f,0x74,0x65,0x73,0x74,0x31};
+    // Receive maximum 20, topic alias maximum 10
+    byte connack[] = { 0x20, 0x09, 0x00, 0x00, 0x06, 0x21, 0x00, 0x14, 0x22, 0x00, 0x0a };
+
+    shimClient.expect(connect,27);
+    shimClient.respond(connack,11);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    IS_TRUE(client.getServerTopicAliasMax() == 0);
+
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+    IS_FALSE(shimClient.error());
+    IS_TRUE(client.state() == MQTT_CONNECTED);
+    IS_TRUE(client.getServerTopicAliasMax() == 10);
+
+    END_IT
+}
+
+int test_connect_mqtt5_fails_on_reason_code() {
+    IT("fails to connect if an MQTT 5 connack has a failure reason code");
+    ShimClient shimClient;
+
+    shimClient.setAllowConnect(true);
+    byte connack[] = { 0x20, 0x03, 0x00, 0x87, 0x00 };
+    shimClient.respond(connack,5);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    int rc = client.connect((char*)"client_test1");
+    IS_FALSE(rc);
+    IS_TRUE(client.state() == 0x87);
+
+    END_IT
+}
+
 int main()
 {
     SUITE("Connect");
@@ -332,5 +374,7 @@ int main()
     test_connect_disconnect_connect();
 
     test_connect_custom_keepalive();
+    test_connect_mqtt5();
+    test_connect_mqtt5_fails_on_reason_code();
     FINISH
 }
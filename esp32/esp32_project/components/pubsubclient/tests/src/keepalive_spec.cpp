@@ -172,6 +172,41 @@ int test_keepalive_disconnects_hung() {
     END_IT
 }
 
+int test_keepalive_server_keep_alive() {
+    IT("uses the MQTT 5 broker's Server Keep Alive (takes 5 seconds)");
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    // Server Keep Alive 3 s
+    byte connack[] = { 0x20, 0x06, 0x00, 0x00, 0x03, 0x13, 0x00, 0x03 };
+    shimClient.respond(connack,8);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    client.setKeepAlive(1);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    // Past our own keep alive, but within the broker's: nothing is sent
+    shimClient.expect(NULL,0);
+    sleep(2);
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_FALSE(shimClient.error());
+
+    byte pingreq[] = { 0xC0,0x0 };
+    shimClient.expect(pingreq,2);
+    byte pingresp[] = { 0xD0,0x0 };
+    shimClient.respond(pingresp,2);
+    sleep(2);
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
 int main()
 {
     SUITE("Keep-alive");
@@ -180,6 +215,7 @@ int main()
     test_keepalive_pings_with_inbound_qos0();
     test_keepalive_no_pings_inbound_qos1();
     test_keepalive_disconnects_hung();
+    test_keepalive_server_keep_alive();
 
     FINISH
 }
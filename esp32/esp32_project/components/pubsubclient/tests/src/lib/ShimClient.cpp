@@ -17,6 +17,7 @@ ShimClient::ShimClient() {
     this->_connected = false;
     this->_error = false;
     this->expectAnything = true;
+    this->_writeLimit = -1;
     this->_received = 0;
     this->_expectedPort = 0;
 }
@@ -55,6 +56,12 @@ int ShimClient::connect(const char *host, uint16_t port)  {
     return this->_connected;
 }
 size_t ShimClient::write(uint8_t b)  {
+    if (this->_writeLimit == 0) {
+        return 0;
+    }
+    if (this->_writeLimit > 0) {
+        this->_writeLimit--;
+    }
     this->_received += 1;
     TRACE(std::hex << (unsigned int)b);
     if (!this->expectAnything) {
@@ -72,6 +79,12 @@ size_t ShimClient::write(uint8_t b)  {
     return 1;
 }
 size_t ShimClient::write(const uint8_t *buf, size_t size)  {
+    if (this->_writeLimit >= 0) {
+        if ((long)size > this->_writeLimit) {
+            size = this->_writeLimit;
+        }
+        this->_writeLimit -= size;
+    }
     this->_received += size;
     TRACE( "[" << std::dec << (unsigned int)(size) << "] ");
     uint16_t i=0;
@@ -130,6 +143,9 @@ ShimClient* ShimClient::expect(uint8_t *buf, size_t size) {
 void ShimClient::setConnected(bool b) {
     this->_connected = b;
 }
+void ShimClient::setWriteLimit(long limit) {
+    this->_writeLimit = limit;
+}
 void ShimClient::setAllowConnect(bool b) {
     this->_allowConnect = b;
 }
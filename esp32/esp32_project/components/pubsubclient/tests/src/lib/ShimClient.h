@@ -16,6 +16,7 @@ private:
     bool expectAnything;
     bool _error;
     uint16_t _received;
+    long _writeLimit;
     IPAddress _expectedIP;
     uint16_t _expectedPort;
     const char* _expectedHost;
@@ -46,6 +47,8 @@ public:
   
   virtual void setAllowConnect(bool b);
   virtual void setConnected(bool b);
+  // Accept only this many more bytes, then short-write; -1 for no limit
+  virtual void setWriteLimit(long limit);
 };
 
 #endif
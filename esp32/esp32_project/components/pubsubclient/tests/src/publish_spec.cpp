@@ -11,6 +11,13 @@ void callback(char* topic, byte* payload, unsigned int length) {
   // handle message arrived
 }
 
+uint16_t lastPubAck = 0;
+uint8_t lastReasonCode = 0;
+void pubackCallback(uint16_t msgId, uint8_t reasonCode) {
+  lastPubAck = msgId;
+  lastReasonCode = reasonCode;
+}
+
 int test_publish() {
     IT("publishes a null-terminated string");
     ShimClient shimClient;
@@ -173,8 +180,343 @@ int test_publish_P() {
     END_IT
 }
 
+int test_publishv() {
+    IT("publishes scatter/gather segments");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte head[] = { 0x01,0x02 };
+    byte tail[] = { 0x03,0x0,0x05 };
+    MQTTIoVec iov[] = { { head, 2 }, { NULL, 0 }, { tail, 3 } };
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0xc,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x1,0x2,0x3,0x0,0x5};
+    shimClient.expect(publish,14);
+
+    rc = client.publishv((char*)"topic",iov,3,false);
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publishv_larger_than_buffer() {
+    IT("publishes scatter/gather payload larger than the buffer");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setBufferSize(128);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[200];
+    for (int i = 0; i < 200; i++) {
+        payload[i] = i;
+    }
+    MQTTIoVec iov[] = { { payload, 200 } };
+
+    byte publish[210] = {0x30,0xcf,0x1,0x0,0x5,0x74,0x6f,0x70,0x69,0x63};
+    memcpy(publish + 10, payload, 200);
+    shimClient.expect(publish,210);
+
+    rc = client.publishv((char*)"topic",iov,1,false);
+    IS_TRUE(rc);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+int test_publishv_short_write() {
+    IT("drops the connection when a segment is only partly written");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte payload[20] = { 0 };
+    MQTTIoVec iov[] = { { payload, 20 } };
+
+    // The 9 byte header goes out, then the socket takes only 5 more
+    shimClient.setWriteLimit(14);
+    rc = client.publishv((char*)"topic",iov,1,false);
+    IS_FALSE(rc);
+    IS_FALSE(client.connected());
+    IS_TRUE(client.state() == MQTT_CONNECTION_LOST);
+    IS_FALSE(shimClient.connected());
+
+    END_IT
+}
+
+int test_publish_qos1() {
+    IT("publishes qos1 and clears it on puback");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte payload[] = { 0x01,0x02,0x03,0x0,0x05 };
+    MQTTIoVec iov[] = { { payload, 5 } };
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setPubAckCallback(pubackCallback);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x32,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0,0x2,0x1,0x2,0x3,0x0,0x5};
+    shimClient.expect(publish,16);
+
+    uint16_t msgId = client.publishQos1((char*)"topic",iov,1,false);
+    IS_TRUE(msgId == 2);
+    IS_TRUE(client.getInflightCount() == 1);
+    IS_FALSE(shimClient.error());
+
+    byte puback[] = { 0x40, 0x02, 0x00, 0x02 };
+    shimClient.respond(puback,4);
+    lastPubAck = 0;
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_TRUE(lastPubAck == 2);
+    IS_TRUE(client.getInflightCount() == 0);
+
+    END_IT
+}
+
+int test_publish_qos1_window_full() {
+    IT("qos1 publish fails when the inflight window is full");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte payload[] = { 0x01 };
+    MQTTIoVec iov[] = { { payload, 1 } };
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        IS_TRUE(client.publishQos1((char*)"topic",iov,1,false) != 0);
+    }
+    IS_TRUE(client.publishQos1((char*)"topic",iov,1,false) == 0);
+    IS_TRUE(client.getInflightCount() == MQTT_MAX_INFLIGHT);
+
+    END_IT
+}
+
+
+int test_publish_mqtt5_topic_alias() {
+    IT("publishes an MQTT 5 topic alias after the first message");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte payload[] = { 0x01,0x02 };
+    MQTTIoVec iov[] = { { payload, 2 } };
+
+    byte connack[] = { 0x20, 0x06, 0x00, 0x00, 0x03, 0x22, 0x00, 0x0a };
+    shimClient.respond(connack,8);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    IS_TRUE(client.setTopicAlias("topic",1));
+    IS_TRUE(client.setTopicAlias("other",11));
+    IS_FALSE(client.setTopicAlias("zero",0));
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    // Name and alias, then the alias alone
+    byte first[] = {0x30,0xd,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x3,0x23,0x0,0x1,0x1,0x2};
+    byte second[] = {0x30,0x8,0x0,0x0,0x3,0x23,0x0,0x1,0x1,0x2};
+    // Alias 11 is above the broker's maximum of 10
+    byte other[] = {0x30,0xa,0x0,0x5,0x6f,0x74,0x68,0x65,0x72,0x0,0x1,0x2};
+    shimClient.expect(first,15);
+    shimClient.expect(second,10);
+    shimClient.expect(other,12);
+
+    IS_TRUE(client.publishv((char*)"topic",iov,1,false));
+    IS_TRUE(client.publishv((char*)"topic",iov,1,false));
+    IS_TRUE(client.publishv((char*)"other",iov,1,false));
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_mqtt5_properties() {
+    IT("publishes MQTT 5 properties");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte payload[] = { 0x01,0x02 };
+    MQTTIoVec iov[] = { { payload, 2 } };
+    // Content type "x"
+    byte properties[] = { 0x03,0x0,0x1,0x78 };
 
+    byte connack[] = { 0x20, 0x03, 0x00, 0x00, 0x00 };
+    shimClient.respond(connack,5);
 
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x31,0xe,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x4,0x3,0x0,0x1,0x78,0x1,0x2};
+    shimClient.expect(publish,16);
+    IS_TRUE(client.publishv((char*)"topic",iov,1,true,properties,4));
+
+    // Plain publish still carries an (empty) property length
+    byte plain[] = {0x30,0xa,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0,0x1,0x2};
+    shimClient.expect(plain,12);
+    IS_TRUE(client.publish((char*)"topic",payload,2));
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_properties_need_mqtt5() {
+    IT("refuses properties on MQTT 3.1.1");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte payload[] = { 0x01,0x02 };
+    MQTTIoVec iov[] = { { payload, 2 } };
+    byte properties[] = { 0x03,0x0,0x1,0x78 };
+
+    byte connack[] = { 0x20, 0x02, 0x00, 0x00 };
+    shimClient.respond(connack,4);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    IS_FALSE(client.publishv((char*)"topic",iov,1,false,properties,4));
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
+int test_publish_mqtt5_puback_refused() {
+    IT("reports the reason code of a refused MQTT 5 puback");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte payload[] = { 0x01 };
+    MQTTIoVec iov[] = { { payload, 1 } };
+
+    byte connack[] = { 0x20, 0x03, 0x00, 0x00, 0x00 };
+    shimClient.respond(connack,5);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    client.setPubAckCallback(pubackCallback);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    uint16_t msgId = client.publishQos1((char*)"topic",iov,1,false);
+    IS_TRUE(msgId == 2);
+
+    // Quota exceeded
+    byte puback[] = { 0x40, 0x03, 0x00, 0x02, 0x97 };
+    shimClient.respond(puback,5);
+    lastPubAck = 0;
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_TRUE(lastPubAck == 2);
+    IS_TRUE(lastReasonCode == 0x97);
+    IS_TRUE(client.getInflightCount() == 0);
+
+    // A bare MQTT 5 puback means success
+    msgId = client.publishQos1((char*)"topic",iov,1,false);
+    byte success[] = { 0x40, 0x02, 0x00, 0x03 };
+    shimClient.respond(success,4);
+    rc = client.loop();
+    IS_TRUE(lastPubAck == 3);
+    IS_TRUE(lastReasonCode == 0);
+
+    END_IT
+}
+
+int test_publish_mqtt5_maximum_qos() {
+    IT("sends qos1 publishes at qos0 to an MQTT 5 broker that only takes qos0");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte payload[] = { 0x01 };
+    MQTTIoVec iov[] = { { payload, 1 } };
+
+    // Maximum QoS 0
+    byte connack[] = { 0x20, 0x05, 0x00, 0x00, 0x02, 0x24, 0x00 };
+    shimClient.respond(connack,7);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    client.setPubAckCallback(pubackCallback);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte publish[] = {0x30,0x9,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x0,0x1};
+    shimClient.expect(publish,11);
+    uint16_t msgId = client.publishQos1((char*)"topic",iov,1,false);
+    IS_TRUE(msgId != 0);
+    IS_FALSE(shimClient.error());
+
+    lastPubAck = 0;
+    rc = client.loop();
+    IS_TRUE(rc);
+    IS_TRUE(lastPubAck == msgId);
+    IS_TRUE(client.getInflightCount() == 0);
+
+    END_IT
+}
+
+int test_publish_mqtt5_maximum_packet_size() {
+    IT("refuses publishes over the MQTT 5 broker's maximum packet size");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte payload[10] = { 0 };
+    MQTTIoVec small[] = { { payload, 5 } };
+    MQTTIoVec large[] = { { payload, 10 } };
+
+    // Maximum Packet Size 16
+    byte connack[] = { 0x20, 0x08, 0x00, 0x00, 0x05, 0x27, 0x00, 0x00, 0x00, 0x10 };
+    shimClient.respond(connack,10);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    // 15 bytes on the wire
+    IS_TRUE(client.publishv((char*)"topic",small,1,false));
+    uint16_t sent = shimClient.received();
+
+    // 20 bytes: nothing is sent and the connection stays up
+    IS_FALSE(client.publishv((char*)"topic",large,1,false));
+    IS_TRUE(shimClient.received() == sent);
+    IS_TRUE(client.connected());
+
+    END_IT
+}
 
 int main()
 {
@@ -186,6 +528,17 @@ int main()
     test_publish_not_connected();
     test_publish_too_long();
     test_publish_P();
+    test_publishv();
+    test_publishv_larger_than_buffer();
+    test_publishv_short_write();
+    test_publish_qos1();
+    test_publish_qos1_window_full();
+    test_publish_mqtt5_topic_alias();
+    test_publish_mqtt5_properties();
+    test_publish_properties_need_mqtt5();
+    test_publish_mqtt5_puback_refused();
+    test_publish_mqtt5_maximum_qos();
+    test_publish_mqtt5_maximum_packet_size();
 
     FINISH
 }
@@ -324,6 +324,41 @@ int test_receive_qos1() {
     END_IT
 }
 
+int test_receive_mqtt5_properties() {
+    IT("skips the properties of an MQTT 5 message");
+    reset_callback();
+
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x03, 0x00, 0x00, 0x00 };
+    shimClient.respond(connack,5);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    // QoS 1, message id 0x1234, content type "x"
+    byte publish[] = {0x32,0x15,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x12,0x34,0x4,0x3,0x0,0x1,0x78,0x70,0x61,0x79,0x6c,0x6f,0x61,0x64};
+    shimClient.respond(publish,23);
+
+    byte puback[] = {0x40,0x2,0x12,0x34};
+    shimClient.expect(puback,4);
+
+    rc = client.loop();
+    IS_TRUE(rc);
+
+    IS_TRUE(callback_called);
+    IS_TRUE(strcmp(lastTopic,"topic")==0);
+    IS_TRUE(memcmp(lastPayload,"payload",7)==0);
+    IS_TRUE(lastLength == 7);
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
 int main()
 {
     SUITE("Receive");
@@ -335,6 +370,7 @@ int main()
     test_resize_buffer();
     test_receive_oversized_stream_message();
     test_receive_qos1();
+    test_receive_mqtt5_properties();
 
     FINISH
 }
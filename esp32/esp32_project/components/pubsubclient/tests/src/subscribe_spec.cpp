@@ -164,6 +164,32 @@ int test_unsubscribe_not_connected() {
     END_IT
 }
 
+int test_subscribe_mqtt5() {
+    IT("subscribes with an empty MQTT 5 property length");
+    ShimClient shimClient;
+    shimClient.setAllowConnect(true);
+
+    byte connack[] = { 0x20, 0x03, 0x00, 0x00, 0x00 };
+    shimClient.respond(connack,5);
+
+    PubSubClient client(server, 1883, callback, shimClient);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    int rc = client.connect((char*)"client_test1");
+    IS_TRUE(rc);
+
+    byte subscribe[] = { 0x82,0xb,0x0,0x2,0x0,0x0,0x5,0x74,0x6f,0x70,0x69,0x63,0x1 };
+    shimClient.expect(subscribe,13);
+    byte unsubscribe[] = { 0xa2,0xa,0x0,0x3,0x0,0x0,0x5,0x74,0x6f,0x70,0x69,0x63 };
+    shimClient.expect(unsubscribe,12);
+
+    IS_TRUE(client.subscribe((char*)"topic",1));
+    IS_TRUE(client.unsubscribe((char*)"topic"));
+
+    IS_FALSE(shimClient.error());
+
+    END_IT
+}
+
 int main()
 {
     SUITE("Subscribe");
@@ -174,5 +200,6 @@ int main()
     test_subscribe_too_long();
     test_unsubscribe();
     test_unsubscribe_not_connected();
+    test_subscribe_mqtt5();
     FINISH
 }
@@ -2,35 +2,71 @@
 #define BLUETOOTH_MANAGER_H
 
 #include "../config.h"
-#include <string>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "nimble/nimble_port.h"
 #include "host/ble_hs.h"
 #include "services/gap/ble_svc_gap.h"
 #include "esp_nimble_hci.h"
 #include <ArduinoJson.h>
 #include "../sensors/sensor_data.h"
+#include "CommandDispatcher.h"
 #include "esp_efuse.h"
 #include <Preferences.h>
 
-// Callback type for command handling
-typedef void (*CommandCallback)(const char* command);
-
 class BluetoothManager {
 private:
     // Add this near top of class:
     static constexpr const char* TAG = "BluetoothManager";
+    // Connection parameters last requested for a connection
+    enum ConnMode : uint8_t {
+        CONN_CENTRAL,           // Whatever the central chose
+        CONN_IDLE,
+        CONN_STREAMING,
+    };
+
+    // A connected central and what it asked to be notified of
+    struct Connection {
+        uint16_t handle;        // BLE_HS_CONN_HANDLE_NONE when the slot is free
+        uint16_t mtu;
+        bool sensorNotify;
+        bool packedNotify;
+        bool bulkTransfer;      // History download running
+        ConnMode mode;
+        uint32_t connectedMs;
+    };
+
     // BLE State
     bool deviceConnected;
-    std::string currentData;
+    volatile bool synced;       // Host and controller ready for GAP calls
+    bool hostStarted;
+    // Advertising interval in 0.625 ms units, 0 while advertising is off
+    uint16_t advItvlMin;
+    uint16_t advItvlMax;
+    Connection connections[BLE_MAX_CONNECTIONS];
+    SemaphoreHandle_t lock;     // connections, currentData and lastSample
+    StaticSemaphore_t lockBuffer;
+
+    // Last value sent, returned on reads of the sensor characteristic
+    char currentData[BLE_MTU_SIZE];
+    size_t currentLength;
+    uint8_t lastSample[BLE_PACKED_SAMPLE_SIZE];
+
+    // Live samples waiting for a packed notification, live task only
+    uint8_t batch[BLE_PACKED_BATCH_MAX * BLE_PACKED_SAMPLE_SIZE];
+    size_t batchCount;
+    uint32_t batchStartMs;
     
     // UUID Configuration
     ble_uuid_any_t service_uuid;
     ble_uuid_any_t sensor_char_uuid;
     ble_uuid_any_t control_char_uuid;
+    ble_uuid_any_t packed_char_uuid;
     
     // Characteristic Handles
     uint16_t m_sensor_char_handle;
     uint16_t m_control_char_handle;
+    uint16_t m_packed_char_handle;
     
     // Callbacks
     CommandCallback commandCallback;
@@ -45,34 +81,88 @@ private:
     static int sensor_char_access(uint16_t, uint16_t, ble_gatt_access_ctxt*, void*);
     static int control_char_access(uint16_t, uint16_t, ble_gatt_access_ctxt*, void*);
     static int ble_gap_event_cb(ble_gap_event*, void*);
+    // ble_hs_cfg callbacks take no argument
+    static BluetoothManager* instance;
+    static void onSync();
+    static void onReset(int reason);
+    static void hostTask(void* param);
     
     // Internal Methods
-    void sendNotification(const char* message);
+    void onConnect(uint16_t connHandle);
+    void onDisconnect(uint16_t connHandle);
+    void onSubscribe(uint16_t connHandle, uint16_t attrHandle, bool notify);
+    void onMtu(uint16_t connHandle, uint16_t mtu);
+    Connection* findConnection(uint16_t connHandle);
+    size_t batchCapacity();
+    void sendNotification(const char* value, size_t length);
+    void notifySubscribers(uint16_t attrHandle, const void* value, size_t length);
+    static os_mbuf* notifyMbuf(const void* value, size_t length);
     void handleTankDimensions(const char* command);
     void handleCostConfiguration(const char* command);
 
 public:
+    // Notify path cost. busyUs covers taking the mbufs and handing them to
+    // the host for every subscriber.
+    struct NotifyStats {
+        uint32_t sent;
+        uint32_t dropped;       // mbuf pool empty or the host refused it
+        uint64_t busyUs;
+        uint32_t connParamUpdates;
+    };
+
     BluetoothManager();
     
-    // Core BLE Operations
+    // Core BLE Operations. begin() brings the stack up and registers the
+    // sensor service; other services register before startHost().
     void begin(CommandCallback callback);
+    void startHost();
+    // Advertising only: the stack and open connections stay up
     void startBLE();
     void stopBLE();
+    // Advertises at the given interval (0.625 ms units), restarting if
+    // already on; itvlMin 0 stops. Before the host syncs it is kept for
+    // later. While a central is connected it advertises no faster than
+    // BLE_ADV_ITVL_MIN, and not at all with BLE_MAX_CONNECTIONS connected.
+    void setAdvertising(uint16_t itvlMin, uint16_t itvlMax);
     bool isConnected() const { return deviceConnected; }
     
     // Data Handling
     void updateSensorData(const SensorData& data);
     void sendAlert(const char* message);
+    void sendAlert(const String& message) { sendAlert(message.c_str()); }
     void sendWaterCost(float totalLiters, float costPerLiter);
     void notifyConfig();  // Sends current config via BLE
+
+    // Packed characteristic: BLE_PACKED_SAMPLE_SIZE bytes per sample,
+    // little-endian. u32 timestamp ms, i16 temperature 0.01 C, u16 TDS ppm,
+    // u16 level 0.01 %, u16 power 0.1 W, u16 flow 0.01 L/min, u32 total
+    // water mL, u8 flags (bit 0 pump). An unavailable reading is all ones
+    // (INT16_MIN for temperature). A notification carries one or more
+    // samples back to back, oldest first.
+    static size_t packSample(const SensorData& data, uint8_t* out);
+    // True while a connection is subscribed to the packed characteristic
+    bool isStreaming();
+    // Marks a history download on `connHandle`, which then streams too
+    void setBulkTransfer(uint16_t connHandle, bool active);
+    // Short interval for connections that stream, long interval with slave
+    // latency for idle ones. Streaming applies at once; idle waits until
+    // BLE_CONN_IDLE_AFTER_MS after connect, so call this periodically.
+    void updateConnectionParams();
+    // Batches a live sample; sends once the batch fills the smallest
+    // subscriber MTU or BLE_LIVE_BATCH_MS has passed
+    void addLiveSample(const SensorData& data);
     
     // Getters
     float getTankHeight() const { return tankHeight; }
     float getTankDiameter() const { return tankDiameter; }
     float getTankCapacity() const { return tankCapacity; }
+    NotifyStats getNotifyStats() const { return notifyStats; }
     
     // Command Processing
     void handleCommand(const char* command);
+
+private:
+    NotifyStats notifyStats;
 };
 
 extern BluetoothManager bluetoothManager;
@@ -0,0 +1,74 @@
+#ifndef COMMAND_DISPATCHER_H
+#define COMMAND_DISPATCHER_H
+#pragma once
+#include <ArduinoJson.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "../config.h"
+
+/**
+ * Transport hook for inbound commands. The payload is parsed in place, so
+ * it must be writable and is clobbered. The reply is written to ack;
+ * returns its length, 0 if there is nothing to send.
+ */
+typedef size_t (*CommandCallback)(char* payload, size_t length, char* ack, size_t ackSize);
+
+enum class CommandStatus : uint8_t {
+    OK,
+    BAD_REQUEST,     // Not JSON, or a required field is missing
+    UNKNOWN_ACTION,
+    RATE_LIMITED,
+    FAILED           // Handler ran but the device refused (e.g. pump safety)
+};
+
+// Handlers see strings that point into the caller's payload
+typedef CommandStatus (*CommandHandler)(JsonObjectConst command);
+// Whether a command has to wait out its action's minimum interval
+typedef bool (*CommandLimit)(JsonObjectConst command);
+
+/**
+ * Routes JSON commands such as {"id":"42","action":"pump","status":true}
+ * to a handler registered for their action, from MQTT and BLE alike.
+ *
+ * Payloads are parsed with ArduinoJson's zero-copy mode: strings are
+ * terminated inside the payload buffer instead of being copied into the
+ * document. The reply {"id":"42","status":"ok"} carries the request's id
+ * rather than echoing the command. Each action has a minimum interval;
+ * repeats arriving sooner are answered "rate_limited" without running.
+ * A CommandLimit narrows that to some commands, e.g. only switching the
+ * pump on: every command that runs restarts the interval, but the exempt
+ * ones are never refused.
+ */
+class CommandDispatcher {
+public:
+    CommandDispatcher();
+    // minIntervalMs = 0 disables the rate limit; limit = nullptr applies it
+    // to every command. `action` must outlive us.
+    bool addHandler(const char* action, CommandHandler handler, uint32_t minIntervalMs,
+                    CommandLimit limit = nullptr);
+    // Parses, runs and acknowledges one command; see CommandCallback
+    size_t dispatch(char* payload, size_t length, char* ack, size_t ackSize);
+    CommandStatus getLastStatus() const { return lastStatus; }
+    static const char* statusName(CommandStatus status);
+
+private:
+    struct Entry {
+        const char* action;
+        CommandHandler handler;
+        CommandLimit limit;
+        uint32_t minIntervalMs;
+        uint32_t lastRunMs;
+        bool hasRun;
+    };
+
+    Entry entries[COMMAND_MAX_HANDLERS];
+    size_t entryCount;
+    CommandStatus lastStatus;
+    // MQTT (network task) and BLE (NimBLE host task) dispatch concurrently
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lockBuffer;
+
+    CommandStatus run(JsonObjectConst command);
+};
+
+#endif // COMMAND_DISPATCHER_H
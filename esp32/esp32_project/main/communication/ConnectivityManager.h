@@ -0,0 +1,85 @@
+#ifndef CONNECTIVITY_MANAGER_H
+#define CONNECTIVITY_MANAGER_H
+#pragma once
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "../config.h"
+#include "BluetoothManager.h"
+
+/**
+ * Chooses how the BLE radio behaves for the transport that is up.
+ *
+ * NimBLE is brought up once at boot and stays up next to WiFi under
+ * software coexistence. Switching transport only changes the advertising
+ * interval: fast while BLE is the only way to reach the tank, slow (or
+ * off) while WiFi carries telemetry. Connected phones are never dropped.
+ *
+ * On top of that baseline, boot, a button press or an alert opens a short
+ * window of fast advertising so a phone that is being looked at finds the
+ * tank at once; afterwards the radio backs off again.
+ *
+ * The latency of each switch is measured from the WiFi event that caused
+ * it to the moment the new advertising parameters are in place.
+ */
+class ConnectivityManager {
+public:
+    enum class State : uint8_t {
+        STARTING,
+        WIFI,       // WiFi up, BLE advertises slowly for local access
+        BLE,        // WiFi down, BLE advertises at full rate
+    };
+
+    struct Stats {
+        uint32_t transitions;
+        uint32_t lastUs;
+        uint32_t maxUs;
+        uint64_t totalUs;
+        uint32_t boosts;
+        uint64_t fastUs;        // Time spent advertising fast
+    };
+
+    explicit ConnectivityManager(BluetoothManager& ble);
+    ~ConnectivityManager();
+
+    // Creates the window timer, hooks the button (-1 for none) and opens
+    // the boot window
+    bool begin(int buttonPin);
+    // Advertises fast for BLE_ADV_FAST_WINDOW_MS, extending a running window
+    void boost();
+    bool isBoosted() const { return boosted; }
+    // When the fast window closes (esp_timer_get_time()), 0 if none is timed
+    uint64_t getBoostEndUs() const;
+
+    // Call whenever the WiFi link state is known. `changedAtUs` is when the
+    // link changed (WiFiManager::getLastChangeUs()), for the latency stats.
+    void update(bool wifiUp, uint32_t changedAtUs);
+    State getState() const { return state; }
+    Stats getStats() const { return stats; }
+
+private:
+    static constexpr const char* TAG = "Connectivity";
+
+    void applyAdvertising();
+    void endBoost();
+    static void boostExpired(void* arg);
+    static void buttonIsr(void* arg);
+    static void buttonPressed(void* arg);
+
+    BluetoothManager& ble;
+    State state;
+    Stats stats;
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lockBuffer;
+    esp_timer_handle_t boostTimer;
+    esp_timer_handle_t pressTimer;  // Hands a button press to the esp_timer task
+    int buttonPin;
+    volatile bool boosted;
+    int64_t boostStartUs;
+    TickType_t lastPress;
+};
+
+extern ConnectivityManager connectivityManager;
+
+#endif // CONNECTIVITY_MANAGER_H
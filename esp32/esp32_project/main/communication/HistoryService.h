@@ -0,0 +1,98 @@
+#ifndef HISTORY_SERVICE_H
+#define HISTORY_SERVICE_H
+#pragma once
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "host/ble_hs.h"
+#include "../config.h"
+#include "../storage/DataQueue.h"
+
+/**
+ * GATT service that streams the offline queue to the app.
+ *
+ * The app writes a request to the control characteristic and the records
+ * arrive as notifications on the data characteristic, each holding as many
+ * HISTORY_RECORD_SIZE records (u32 sequence number + packed sample, see
+ * BluetoothManager::packSample) as the MTU allows. All fields are
+ * little-endian.
+ *
+ * Control writes:
+ *   0x01 START  u32 fromSeq, u32 fromMs, u32 toMs, u8 credits
+ *   0x02 CREDIT u8 credits
+ *   0x03 STOP
+ * Control notifications:
+ *   0x81 INFO   u32 headSeq, u32 tailSeq, u32 nowMs (sent on START)
+ *   0x82 END    u32 nextSeq, u32 records
+ *
+ * Flow control is by credit: every data notification uses one, and the
+ * app grants more as it drains them, so a slow phone is never flooded.
+ * fromSeq outside the queue starts at the oldest record; passing the
+ * nextSeq of an interrupted transfer resumes it. Timestamps are device
+ * uptime (there is no wall clock), so fromMs/toMs select within the
+ * current boot using the nowMs of INFO; toMs 0 means no upper bound.
+ *
+ * Reading leaves the queue untouched, records still go to the broker.
+ */
+class HistoryService {
+public:
+    struct Stats {
+        uint32_t transfers;
+        uint32_t records;
+        uint32_t notifications;
+        uint32_t lastTransferMs;    // START to END of the last complete transfer
+    };
+
+    explicit HistoryService(DataQueue& queue);
+
+    // Adds the GATT service and starts the transfer task. Call between
+    // BluetoothManager::begin() and BluetoothManager::startHost().
+    bool begin();
+    Stats getStats() const { return stats; }
+
+private:
+    static constexpr const char* TAG = "HistoryService";
+
+    enum Opcode : uint8_t {
+        OP_START = 0x01,
+        OP_CREDIT = 0x02,
+        OP_STOP = 0x03,
+        OP_INFO = 0x81,
+        OP_END = 0x82,
+    };
+
+    DataQueue& queue;
+    TaskHandle_t taskHandle;
+    ble_gap_event_listener gapListener;
+    uint16_t controlHandle;
+    uint16_t dataHandle;
+
+    // Transfer state, shared between the host task and the transfer task
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+    uint16_t connHandle;        // BLE_HS_CONN_HANDLE_NONE when idle
+    uint16_t subscribedConn;    // Connection with data notifications enabled
+    uint32_t generation;        // Bumped by every START/STOP
+    uint32_t cursor;
+    uint32_t fromMs;
+    uint32_t toMs;
+    uint32_t credits;
+    uint32_t sent;
+    uint32_t startMs;
+    Stats stats;
+
+    static int accessCb(uint16_t connHandle, uint16_t attrHandle,
+                        ble_gatt_access_ctxt* ctxt, void* arg);
+    static int gapEvent(ble_gap_event* event, void* arg);
+    static void transferTask(void* arg);
+
+    // Returns 0 or an ATT error for the write
+    int handleControl(uint16_t conn, const uint8_t* buf, size_t len);
+    // Sends one notification; false when there is nothing to do right now
+    bool sendNext();
+    // Ends transfer `gen` (unless replaced meanwhile) and reports END
+    void finish(uint16_t conn, uint32_t gen, uint32_t nextSeq);
+    void notifyControl(uint16_t conn, const uint8_t* value, size_t length);
+};
+
+extern HistoryService historyService;
+
+#endif // HISTORY_SERVICE_H
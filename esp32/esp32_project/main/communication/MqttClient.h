@@ -1,36 +1,235 @@
 #ifndef MQTT_CLIENT_H
 #define MQTT_CLIENT_H
+#include "sdkconfig.h"
+#include <atomic>
 #include <WiFiClient.h>
 #include <WiFi.h>
-#include <PubSubClient.h>
+#include <PubSubClient.h> // MQTTIoVec and MQTT_MAX_INFLIGHT for both backends
 #include <ArduinoJson.h>
 #include "../config.h"
 #include "../sensors/sensor_data.h" // Include the centralized SensorData definition
+#include "CommandDispatcher.h"
+#include "cbor.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#if CONFIG_SMARTTANK_MQTT_TLS
+#include "TlsClient.h"
+#endif
+#if CONFIG_SMARTTANK_MQTT_ESP_MQTT
+#include "freertos/queue.h"
+#include "mqtt_client.h"
+#endif
 
+/**
+ * CBOR telemetry schema: one map per reading with small integer keys so
+ * field names cost a single byte. Key 0 carries TELEMETRY_SCHEMA_VERSION;
+ * new fields take new keys, existing keys never change type or unit.
+ * Over MQTT 5 the retained status message also announces the schema and
+ * encoding as user properties, for consumers that route on them.
+ */
+enum TelemetryKey : uint8_t {
+    TK_VERSION = 0,
+    TK_TIMESTAMP = 1,       // ms since boot
+    TK_TEMPERATURE = 2,     // °C
+    TK_TDS = 3,             // ppm
+    TK_WATER_LEVEL = 4,     // %
+    TK_POWER = 5,           // W
+    TK_FLOW = 6,            // L/min
+    TK_TOTAL_WATER = 7,     // L
+    TK_PUMP = 8,            // bool
+    TK_SAMPLES = 9,         // Batch: array of delta-encoded samples
+    TK_SEQUENCE = 10        // Backlog: offline queue sequence of the first sample
+};
+
+/**
+ * Batch payload (<topic>/batch/cbor): a map with TK_VERSION, TK_TIMESTAMP
+ * (time of the first sample) and TK_SAMPLES. Each sample is an array
+ *   [dt ms, temperature, tds, level, power, flow, total water, pump]
+ * of integers in the fixed units below. The first sample holds absolute
+ * values, every later one the difference from the sample before it.
+ * Backlog batches (<topic>/backlog/cbor) add TK_SEQUENCE so a replay after
+ * a power loss can be recognised and dropped by the consumer.
+ */
+static const float TELEMETRY_BATCH_SCALE[] = {
+    100.0f,   // temperature, 0.01 °C
+    10.0f,    // tds, 0.1 ppm
+    10.0f,    // level, 0.1 %
+    10.0f,    // power, 0.1 W
+    100.0f,   // flow, 0.01 L/min
+    1000.0f,  // total water, mL
+};
 
 
 class MQTTClient {
     public:
         MQTTClient(); // Constructor
-        void begin(const char* mqttServer); // Initialize MQTT client
+        // Payloads on <topic>/command go to onCommand; replies to <topic>/ack
+        void begin(const char* mqttServer, CommandCallback onCommand);
         void loop(); // Handle MQTT client tasks
         bool isConnected(); // Check if MQTT client is connected
-        void publish(const SensorData& data); // Publish sensor data
+        // Queues a reading; published as a batch of MQTT_BATCH_SIZE, after
+        // MQTT_BATCH_MAX_AGE_MS, or at once when the pump state changes
+        void publish(const SensorData& data);
+        // Flushes a partial batch once it is MQTT_BATCH_MAX_AGE_MS old. Call
+        // on every telemetry tick: publish() only runs for readings that
+        // pass the report filter, so a batch could otherwise wait for hours.
+        void tick();
+        // Publishes the pending batch now (QoS 1), e.g. when an alert fires.
+        // The batch is kept until its PUBACK and spilled to the offline
+        // queue if the connection drops first.
+        bool flush();
+        // Hands back readings that were batched but never sent
+        size_t takePending(SensorData* out, size_t max);
+        // Publishes readings replayed from the offline queue at QoS 1; may
+        // send fewer than `count` if they don't fit one packet. `nextHead`
+        // is what the queue may commit once all `count` are acknowledged.
+        // Returns the number sent, 0 if the connection epoch moved on.
+        size_t publishBacklog(const SensorData* samples, size_t count, uint32_t firstSeq,
+                              uint32_t nextHead, uint32_t epoch);
+        // Oldest-first queue head whose records have all been acknowledged
+        bool takeBacklogAck(uint32_t& nextHead);
+        // True while the window has room for backlog beyond the live reserve
+        bool canPublishBacklog();
+        size_t getBacklogInflight();
+        // Bumped on every disconnect; unacknowledged backlog must be resent
+        uint32_t getConnectionEpoch() const { return epoch; }
+        // Processes incoming packets (PUBACKs) without reconnecting
+        void poll();
+        // Blocks until the socket has data or timeoutMs passes
+        bool waitReadable(uint32_t timeoutMs);
+        // Time left before connect() will try again
+        uint32_t msUntilRetry() const;
+        // QoS 1 publishes (live and backlog) awaiting their acknowledgement
+        size_t getInflightCount();
+
+        // Live batch delivery figures, for the on-device MQTT benchmark
+        struct Stats {
+            uint32_t published;
+            uint32_t acked;
+            uint32_t bytes;
+            uint64_t ackLatencyUs;  // Sum over `acked`
+            uint32_t maxAckLatencyUs;
+        };
+        Stats getStats();
+        void resetStats();
+#if CONFIG_SMARTTANK_MQTT_TLS
+        TlsClient::Stats getTlsStats() { return espClient.getStats(); }
+#endif
         void publishAlert(const char* message); // Publish alert messages
         void attemptReconnect(); // Public method to trigger reconnection
+        void connect();  // Instead of reconnect()
     
     private:
-        void connect();  // Instead of reconnect()
         void callback(char* topic, uint8_t* payload, unsigned int length); // Callback for MQTT messages
-        
-        
+        void onPubAck(uint16_t packetId);
+        // Moves unacknowledged live batches to the offline queue and forgets
+        // backlog packets, which are still in the queue. Lock must be held;
+        // the flash writes happen in writeSpills().
+        void spillInflight();
+        // Same for a single packet the transport gave up on or the broker refused
+        void expireInflight(uint16_t packetId);
+
+        // Transport, implemented once per backend (mqtt_pubsub.cpp or
+        // mqtt_esp.cpp). sendLocked() returns the packet id for QoS 1,
+        // non-zero for a QoS 0 success, and 0 on failure.
+        void initTransport();
+        bool linkUp();
+        uint16_t sendLocked(const char* topic, const MQTTIoVec* iov, size_t iovcnt,
+                            uint8_t qos, bool retained);
+
+#if CONFIG_SMARTTANK_MQTT_ESP_MQTT
+        esp_mqtt_client_handle_t handle;
+        // The esp-mqtt task holds its own lock while it runs event handlers,
+        // so PUBLISHED/DELETED ids are handed over through this queue and
+        // applied by poll() rather than taking clientLock in the handler.
+        struct OutboxEvent {
+            uint16_t packetId;
+            bool delivered;  // false: expired from the outbox
+        };
+        QueueHandle_t outboxEvents;
+        StaticQueue_t outboxEventsBuffer;
+        uint8_t outboxEventsStorage[2 * MQTT_MAX_INFLIGHT * sizeof(OutboxEvent)];
+        static void onMqttEvent(void* arg, esp_event_base_t base, int32_t id, void* data);
+#else
+#if CONFIG_SMARTTANK_MQTT_TLS
+        TlsClient espClient; // Resumes the previous TLS session on reconnect
+#else
         WiFiClient espClient; // ESP32 WiFi client
+#endif
         PubSubClient client; // MQTT client
+#endif
         String deviceId; // Unique device ID
-        bool connected; // Connection status
-        unsigned long lastReconnectAttempt; // Timestamp of last reconnection attempt
+        // Built once per connection so publishing never formats a String
+        struct Topics {
+            char data[MQTT_TOPIC_SIZE];
+            char batch[MQTT_TOPIC_SIZE];
+            char backlog[MQTT_TOPIC_SIZE];
+            char status[MQTT_TOPIC_SIZE];
+            char command[MQTT_TOPIC_SIZE];
+            char ack[MQTT_TOPIC_SIZE];
+            char alert[MQTT_TOPIC_SIZE];
+        } topics;
+        // PubSubClient is not thread-safe and the inflight window is shared;
+        // live telemetry, the backlog drainer and the network task all go
+        // through this lock.
+        SemaphoreHandle_t clientLock;
+        StaticSemaphore_t clientLockBuffer;
+        CommandCallback commandCallback;
+        // Built inside client.loop(), which owns the packet buffer, and
+        // published once it returns
+        char pendingAck[COMMAND_ACK_SIZE];
+        size_t pendingAckLength;
+        SensorData batch[MQTT_BATCH_SIZE];
+        size_t batchCount;
+        uint32_t batchStartMs;
+        bool lastPumpStatus;    // Pump state of the last queued reading
+        // QoS 1 window, mirrored by the transport's packet id list. Live
+        // batches keep their samples until acked; backlog packets only need
+        // the queue position they complete, and are released oldest first.
+        // Spilled batches are written to flash after clientLock is
+        // released, so a publish never waits on SPIFFS
+        enum SpillState : uint8_t { SPILL_NONE, SPILL_PENDING, SPILL_WRITING };
+        struct LiveInflight {
+            uint16_t packetId;  // 0 = free once spill is SPILL_NONE
+            uint8_t count;
+            uint8_t spill;
+            int64_t sentUs;
+            SensorData samples[MQTT_BATCH_SIZE];
+        };
+        struct BacklogInflight {
+            uint16_t packetId;
+            bool acked;
+            uint32_t nextHead;
+        };
+        LiveInflight liveInflight[MQTT_MAX_INFLIGHT];
+        BacklogInflight backlogInflight[MQTT_MAX_INFLIGHT];
+        size_t backlogFront;
+        size_t backlogCount;
+        volatile bool spillPending;
+        volatile uint32_t epoch;
+        Stats stats;
+        std::atomic<bool> connected; // Connection status
+        uint32_t lastReconnectAttempt; // Timestamp of last reconnection attempt
+        uint32_t retryDelayMs;         // Jittered wait after the last failure
+        uint32_t backoffMs;            // Upper bound for the next retry delay
     
-        String createTopic(const char* suffix); // Helper to create MQTT topic
-        String createSensorJson(const SensorData& data); // Helper to serialize sensor data
+        void createTopic(const char* suffix, char* out); // Helper to create MQTT topic
+        void buildTopics();
+        void markSpill(LiveInflight& entry);
+        // Writes batches marked by spillInflight()/expireInflight() to the
+        // offline queue. Called by the transport without clientLock held.
+        void writeSpills();
+        void dropBacklogInflight();
+        size_t inflightLocked() const;
+        // Serializes into buf, returns the length or 0 if it did not fit
+        size_t createSensorJson(const SensorData& data, char* buf, size_t size);
+        // Encodes into buf, returns the length or 0 if it did not fit
+        size_t createSensorCbor(const SensorData& data, uint8_t* buf, size_t size);
+        // firstSeq < 0 leaves TK_SEQUENCE out
+        size_t createBatchCbor(const SensorData* samples, size_t count, int64_t firstSeq,
+                               uint8_t* buf, size_t size);
+        // Payload segments go straight to the socket, nothing is copied
+        bool publishLocked(const char* topic, const MQTTIoVec* iov, size_t iovcnt, bool retained = false);
+        bool publishLocked(const char* topic, const uint8_t* payload, size_t length);
     };
 #endif
\ No newline at end of file
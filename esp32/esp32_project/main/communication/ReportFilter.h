@@ -0,0 +1,42 @@
+#ifndef REPORT_FILTER_H
+#define REPORT_FILTER_H
+#pragma once
+#include <stdint.h>
+#include "../config.h"
+#include "../sensors/sensor_data.h"
+
+/**
+ * Report-by-exception gate between the telemetry task and the publisher.
+ *
+ * Each reading is compared with the last one that was reported, not the
+ * previous sample, so a slow drift is still reported once it adds up to a
+ * deadband. Pump switches always pass and a heartbeat bounds the silence
+ * on a steady tank. The policy is passed per call so config changes apply
+ * to the next reading.
+ */
+class ReportFilter {
+public:
+    struct Stats {
+        uint32_t readings;
+        uint32_t reported;
+    };
+
+    ReportFilter();
+
+    // True if `data` should be published; it then becomes the reference
+    bool shouldReport(const SensorData& data, const ReportPolicy& policy, uint32_t nowMs);
+    // The next reading is reported whatever it holds
+    void reset();
+    Stats getStats() const { return stats; }
+
+    // Deadbands finite and >= 0, heartbeat within REPORT_HEARTBEAT_MAX_MS
+    static bool isValid(const ReportPolicy& policy);
+
+private:
+    SensorData last;
+    bool hasLast;
+    uint32_t lastReportMs;
+    Stats stats;
+};
+
+#endif // REPORT_FILTER_H
@@ -0,0 +1,94 @@
+#ifndef TLS_CLIENT_H
+#define TLS_CLIENT_H
+#pragma once
+#include "sdkconfig.h"
+#include <Arduino.h>
+#include <Client.h>
+#include "esp_tls.h"
+#include "../config.h"
+
+/**
+ * Arduino Client over esp-tls, so PubSubClient can run MQTT over TLS.
+ *
+ * The session from the last successful handshake is offered on the next
+ * connect. A broker that accepts it (RFC 5077 ticket or session id) skips
+ * the certificate chain and the key exchange, which is most of the CPU
+ * time and heap of a full handshake. The session is also copied to RTC
+ * memory that survives a software reset or deep sleep, so the first
+ * connect after a restart can resume as well. That copy holds the session
+ * master secret; it never leaves the chip.
+ *
+ * A client certificate and key are read from the esp_secure_cert
+ * partition when CONFIG_SMARTTANK_MQTT_TLS_SECURE_CERT is set, using the
+ * ECDSA or DS peripheral when the key lives in eFuse.
+ *
+ * Decrypted bytes go through a small buffer so available() can report
+ * data waiting on the socket without blocking.
+ */
+class TlsClient : public Client {
+public:
+    // Handshake cost, split by whether a cached session was offered. A
+    // session the broker refuses still counts as offered, so rejected
+    // tickets show up as a higher resumedUs average.
+    struct Stats {
+        uint32_t fullHandshakes;
+        uint32_t resumedHandshakes;
+        uint64_t fullUs;
+        uint64_t resumedUs;
+        uint32_t failures;
+    };
+
+    TlsClient();
+    ~TlsClient();
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char* host, uint16_t port);
+    int connect(IPAddress ip, uint16_t port, int32_t timeoutMs);
+    int connect(const char* host, uint16_t port, int32_t timeoutMs);
+    size_t write(uint8_t b);
+    size_t write(const uint8_t* buf, size_t size);
+    int available();
+    int read();
+    int read(uint8_t* buf, size_t size);
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool() { return connected(); }
+
+    // Same names as NetworkClient so MQTTClient can hold either
+    void setConnectionTimeout(uint32_t ms) { connectTimeoutMs = ms; }
+    int fd() const;
+
+    // Forgets the cached session; the next connect does a full handshake
+    void clearSession();
+    Stats getStats() const { return stats; }
+    void resetStats();
+
+private:
+    static constexpr const char* TAG = "TlsClient";
+
+    esp_tls_t* tls;
+    bool open;
+    uint32_t connectTimeoutMs;
+    uint8_t rxBuffer[TLS_RX_BUFFER_SIZE];
+    size_t rxLength;
+    size_t rxPos;
+    Stats stats;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_client_session_t* session;
+    void loadSession(const char* host, uint16_t port);
+    void storeSession(const char* host, uint16_t port);
+#endif
+
+    // Pulls decrypted bytes into rxBuffer. Without `block`, only reads
+    // when mbedtls already holds data or the socket is readable.
+    bool fill(bool block);
+    bool socketReadable() const;
+    // Waits up to timeoutUs for the socket to become readable or writable;
+    // false on timeout or error
+    bool waitSocket(bool readable, int64_t timeoutUs) const;
+    void applyClientCertificate(esp_tls_cfg_t& cfg);
+};
+
+#endif // TLS_CLIENT_H
@@ -6,6 +6,9 @@
 #include <WiFi.h>
 #include <Preferences.h>
 #include <DNSServer.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "esp_event.h"
 #include "../config.h"
 
 class WiFiManager {
@@ -20,6 +23,16 @@ private:
     Preferences preferences;
     DNSServer dnsServer;
 
+    // Link state mirrored from WIFI_EVENT / IP_EVENT so nothing has to poll
+    // WiFi.status(). CHANGED_BIT is an edge that waitForEvent() consumes.
+    static constexpr EventBits_t CONNECTED_BIT = BIT0;
+    static constexpr EventBits_t CHANGED_BIT = BIT1;
+    EventGroupHandle_t events;
+    StaticEventGroup_t eventsBuffer;
+    volatile uint32_t lastChangeUs;  // esp_timer time of the last link change, wraps
+
+    static void onWifiEvent(void* arg, esp_event_base_t base, int32_t id, void* data);
+
     void startAP();
     void stopAP();
     bool connectToSavedNetwork();
@@ -34,6 +47,11 @@ public:
     void reset();
     void handleClient();
     bool isConnected() const;
+    // Blocks until the link goes up or down, or the timeout passes.
+    // Returns true if the state changed.
+    bool waitForEvent(TickType_t timeout);
+    // When the link last went up or down (low 32 bits of esp_timer_get_time)
+    uint32_t getLastChangeUs() const { return lastChangeUs; }
     bool isAPMode() const;
     bool hasTimedOut();
     String getIP() const;
@@ -3,6 +3,7 @@
 #include "esp_efuse.h"
 #include "host/ble_uuid.h"
 #include <string.h>
+#include <math.h>
 #include "esp_err.h"
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
@@ -12,40 +13,80 @@
 #include "services/gatt/ble_svc_gatt.h"
 #include "esp_mac.h"
 #include "esp_eth.h"
+#include "esp_timer.h"
 
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 
-// Global instance
+BluetoothManager* BluetoothManager::instance = nullptr;
+
+// Leading space the host needs to prepend the ATT, L2CAP and ACL headers in
+// place, as ble_hs_mbuf_att_pkt() reserves (5 + 4 + 4, rounded up)
+static constexpr uint16_t NOTIFY_LEADING_SPACE = 16;
+static constexpr uint16_t NOTIFY_MBUF_BLOCK = sizeof(struct os_mbuf) +
+    sizeof(struct os_mbuf_pkthdr) + NOTIFY_LEADING_SPACE + BLE_MTU_SIZE;
+
+// Notifications come from their own pool instead of msys: a burst cannot
+// starve the host of buffers for incoming ATT traffic, and nothing touches
+// the heap. ble_gatts_notify_custom() frees the chain back here.
+static os_membuf_t notifyPoolMemory[OS_MEMPOOL_SIZE(BLE_NOTIFY_MBUF_COUNT, NOTIFY_MBUF_BLOCK)];
+static struct os_mempool notifyMempool;
+static struct os_mbuf_pool notifyMbufPool;
 
 // Constructor
 BluetoothManager::BluetoothManager() : 
     deviceConnected(false),
-    commandCallback(nullptr),
+    synced(false),
+    hostStarted(false),
+    advItvlMin(BLE_ADV_ITVL_MIN),
+    advItvlMax(BLE_ADV_ITVL_MAX),
+    currentLength(0),
+    batchCount(0),
+    batchStartMs(0),
     m_sensor_char_handle(0),
-    m_control_char_handle(0) {
+    m_control_char_handle(0),
+    m_packed_char_handle(0),
+    commandCallback(nullptr),
+    tankHeight(TANK_HEIGHT),
+    tankDiameter(TANK_DIAMETER),
+    tankCapacity(TANK_CAPACITY) {
     // Initialize UUIDs
     memset(&service_uuid, 0, sizeof(service_uuid));
     memset(&sensor_char_uuid, 0, sizeof(sensor_char_uuid));
     memset(&control_char_uuid, 0, sizeof(control_char_uuid));
+    memset(&packed_char_uuid, 0, sizeof(packed_char_uuid));
+    memset(lastSample, 0xff, sizeof(lastSample));
+    memset(&notifyStats, 0, sizeof(notifyStats));
+    for (Connection& conn : connections) {
+        conn.handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    lock = xSemaphoreCreateMutexStatic(&lockBuffer);
 }
-{
-    // Initialize persistent storage
-    preferences.begin("tank_config", false); // false = read/write mode
-    
-    // Load saved tank height if exists
-    tankHeight = preferences.getFloat("height", 100.0); // Default 100cm
-    
-    // Set up BLE callbacks
-    ble_gap_event_listener_register(&ble_gap_event_listener, 
-                                  ble_gap_event_cb, 
-                                  this);
-}
+
 void BluetoothManager::begin(CommandCallback callback) {
     commandCallback = callback;
 
-    // Initialize BLE stack
-    ESP_ERROR_CHECK(esp_nimble_hci_init());
-    nimble_port_init();
+    // Tank dimensions set over BLE survive a restart
+    preferences.begin("tank_config", false);
+    tankHeight = preferences.getFloat("height", TANK_HEIGHT);
+    tankDiameter = preferences.getFloat("diameter", TANK_DIAMETER);
+    tankCapacity = preferences.getFloat("capacity", TANK_CAPACITY);
+
+    os_mempool_init(&notifyMempool, BLE_NOTIFY_MBUF_COUNT, NOTIFY_MBUF_BLOCK,
+                    notifyPoolMemory, "ble_notify");
+    os_mbuf_pool_init(&notifyMbufPool, &notifyMempool, NOTIFY_MBUF_BLOCK,
+                      BLE_NOTIFY_MBUF_COUNT);
+
+    // Controller, HCI and host come up once and stay up. WiFi shares the
+    // radio through software coexistence; only advertising changes later.
+    if (nimble_port_init() != ESP_OK) {
+        ESP_LOGE(TAG, "NimBLE init failed");
+        return;
+    }
+    instance = this;
+    ble_hs_cfg.sync_cb = BluetoothManager::onSync;
+    ble_hs_cfg.reset_cb = BluetoothManager::onReset;
+    ble_svc_gap_init();
+    ble_svc_gatt_init();
     
     // Set device name from MAC address
     uint8_t mac[6];
@@ -54,6 +95,10 @@ void BluetoothManager::begin(CommandCallback callback) {
     snprintf(name, sizeof(name), "esp32_%02X%02X", mac[4], mac[5]);
     ble_svc_gap_device_name_set(name);
 
+    // Offered when the central exchanges MTU; BLE_MTU_SIZE fits a full batch
+    // of packed samples in one notification
+    ble_att_set_preferred_mtu(BLE_MTU_SIZE);
+
     // Define UUIDs
     ble_uuid128_t service_uuid128 = BLE_UUID128_INIT(
         0x4f, 0xaf, 0xc2, 0x01, 0x1f, 0xb5, 0x45, 0x9e,
@@ -67,6 +112,10 @@ void BluetoothManager::begin(CommandCallback callback) {
         0xbe, 0xb5, 0x48, 0x3f, 0x36, 0xe1, 0x46, 0x88,
         0xb7, 0xf5, 0xea, 0x07, 0x36, 0x1b, 0x26, 0xa8);
 
+    ble_uuid128_t packed_uuid128 = BLE_UUID128_INIT(
+        0xbe, 0xb5, 0x48, 0x40, 0x36, 0xe1, 0x46, 0x88,
+        0xb7, 0xf5, 0xea, 0x07, 0x36, 0x1b, 0x26, 0xa8);
+
     // Convert to UUID any types
     service_uuid.u.type = BLE_UUID_TYPE_128;
     memcpy(service_uuid.u128.value, service_uuid128.value, 16);
@@ -77,28 +126,40 @@ void BluetoothManager::begin(CommandCallback callback) {
     control_char_uuid.u.type = BLE_UUID_TYPE_128;
     memcpy(control_char_uuid.u128.value, control_uuid128.value, 16);
 
+    packed_char_uuid.u.type = BLE_UUID_TYPE_128;
+    memcpy(packed_char_uuid.u128.value, packed_uuid128.value, 16);
+
     // Define GATT service structure with all fields initialized in correct order
     static ble_gatt_chr_def characteristic_defs[] = {
         {
-            // Initialize in exact order of declaration
             .uuid = &sensor_char_uuid.u,
             .access_cb = BluetoothManager::sensor_char_access,
-            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
-            .val_handle = &m_sensor_char_handle,
+            .arg = this,
             .descriptors = NULL,
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
             .min_key_size = 0,
-            .cpfd = NULL,
-            .arg = this
+            .val_handle = &m_sensor_char_handle,
+            .cpfd = NULL
         },
         {
             .uuid = &control_char_uuid.u,
             .access_cb = BluetoothManager::control_char_access,
+            .arg = this,
+            .descriptors = NULL,
             .flags = BLE_GATT_CHR_F_WRITE,
+            .min_key_size = 0,
             .val_handle = &m_control_char_handle,
+            .cpfd = NULL
+        },
+        {
+            .uuid = &packed_char_uuid.u,
+            .access_cb = BluetoothManager::sensor_char_access,
+            .arg = this,
             .descriptors = NULL,
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
             .min_key_size = 0,
-            .cpfd = NULL,
-            .arg = this
+            .val_handle = &m_packed_char_handle,
+            .cpfd = NULL
         },
         { 0 } // Terminator
     };
@@ -113,12 +174,45 @@ void BluetoothManager::begin(CommandCallback callback) {
         { 0 } // Terminator
     };
 
-    // Register services
+    // Register services. val_handle is filled in here, once, and every
+    // notification uses m_sensor_char_handle from then on.
     ble_gatts_count_cfg(service_defs);
     ble_gatts_add_svcs(service_defs);
+}
+
+void BluetoothManager::startHost() {
+    if (hostStarted || instance == nullptr) {
+        return;
+    }
+    hostStarted = true;
+    nimble_port_freertos_init(BluetoothManager::hostTask);
+}
+
+void BluetoothManager::hostTask(void* param) {
+    nimble_port_run();  // Returns only if the port is stopped
+    nimble_port_freertos_deinit();
+}
 
-    // Start advertising
-    startBLE();
+// Host and controller in sync, at boot or after a controller reset
+void BluetoothManager::onSync() {
+    ble_hs_util_ensure_addr(0);
+
+    struct ble_hs_adv_fields fields;
+    memset(&fields, 0, sizeof(fields));
+    fields.flags = BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP;
+    const char* name = ble_svc_gap_device_name();
+    fields.name = reinterpret_cast<const uint8_t*>(name);
+    fields.name_len = strlen(name);
+    fields.name_is_complete = 1;
+    ble_gap_adv_set_fields(&fields);
+
+    instance->synced = true;
+    instance->startBLE();
+}
+
+void BluetoothManager::onReset(int reason) {
+    instance->synced = false;
+    ESP_LOGW(TAG, "NimBLE host reset, reason %d", reason);
 }
 
 int BluetoothManager::sensor_char_access(
@@ -129,8 +223,13 @@ int BluetoothManager::sensor_char_access(
 ) {
     BluetoothManager* mgr = static_cast<BluetoothManager*>(arg);
     
-    if (ctxt->op == BLE_ATT_ACCESS_OP_READ) {
-        os_mbuf_append(ctxt->om, mgr->currentData.c_str(), mgr->currentData.length());
+    if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
+        xSemaphoreTake(mgr->lock, portMAX_DELAY);
+        int rc = attr_handle == mgr->m_packed_char_handle ?
+                 os_mbuf_append(ctxt->om, mgr->lastSample, sizeof(mgr->lastSample)) :
+                 os_mbuf_append(ctxt->om, mgr->currentData, mgr->currentLength);
+        xSemaphoreGive(mgr->lock);
+        return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
     }
     return 0;
 }
@@ -142,7 +241,7 @@ int BluetoothManager::control_char_access(
     struct ble_gatt_access_ctxt *ctxt,
     void *arg
 ) {
-    if (ctxt->op != BLE_ATT_ACCESS_OP_WRITE) {
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR) {
         return 0; // Only handle write operations
     }
 
@@ -154,87 +253,60 @@ int BluetoothManager::control_char_access(
 
     ESP_LOGI(TAG, "Received BLE command: %s", buf);
 
-    // Handle different command types
-    if (strncmp(buf, "PUMP=", 5) == 0) {
-        // Format: PUMP=ON or PUMP=OFF
-        bool pumpState = (strcmp(buf+5, "ON") == 0);
+    if (buf[0] == '{') {
+        // JSON command, same format as the MQTT command topic
         if (mgr->commandCallback) {
-            mgr->commandCallback(buf);
+            char ack[COMMAND_ACK_SIZE];
+            if (mgr->commandCallback(buf, len, ack, sizeof(ack)) > 0) {
+                mgr->sendAlert(ack);
+            }
         }
-        ESP_LOGI(TAG, "Pump set to %s", pumpState ? "ON" : "OFF");
+        return 0;
     }
-    else if (strncmp(buf, "SET_TANK_DIMENSIONS:", 19) == 0) {
-        // Format: SET_TANK_DIMENSIONS:height:diameter (both in cm)
-        char* ptr = buf + 19;
-        char* endPtr;
-        float height = strtof(ptr, &endPtr);
-        float diameter = strtof(endPtr + 1, NULL); // Skip colon
-
-        if (height > 0 && diameter > 0) {
-            mgr->config.tankHeight = height;
-            mgr->config.tankDiameter = diameter;
-            
-            // Calculate capacity (πr²h/1000 for liters)
-            float radius = diameter / 2.0f;
-            mgr->config.tankCapacity = (3.14159f * radius * radius * height) / 1000.0f;
-            
-            mgr->dataStorage.saveConfig(mgr->config);
-            ESP_LOGI(TAG, "Tank dimensions set: %.1fcm H, %.1fcm D", height, diameter);
-        } else {
-            ESP_LOGE(TAG, "Invalid tank dimensions");
-        }
+    mgr->handleCommand(buf);
+    return 0;
+}
+
+void BluetoothManager::startBLE() {
+    if (!synced || advItvlMin == 0) {
+        return;
     }
-    else if (strncmp(buf, "SET_COST:", 9) == 0) {
-        // Format: SET_COST:water:0.002 or SET_COST:electricity:1.5
-        char* type = strtok(buf + 9, ":");
-        char* value = strtok(NULL, ":");
-        
-        if (type && value) {
-            float costValue = atof(value);
-            if (strcmp(type, "water") == 0) {
-                mgr->config.waterCostPerLiter = costValue;
-            } else if (strcmp(type, "electricity") == 0) {
-                mgr->config.electricityCostPerUnit = costValue;
-            }
-            mgr->dataStorage.saveConfig(mgr->config);
-            ESP_LOGI(TAG, "Cost config updated: %s = %.3f", type, costValue);
-        }
+
+    size_t connected = 0;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (const Connection& conn : connections) {
+        connected += conn.handle != BLE_HS_CONN_HANDLE_NONE;
     }
-    else if (strcmp(buf, "GET_CONFIG") == 0) {
-        // Immediately respond with current config
-        char configStr[128];
-        snprintf(configStr, sizeof(configStr),
-            "CONFIG:HT%.1f:DT%.1f:CP%.1f:WP%.3f:EP%.3f",
-            mgr->config.tankHeight,
-            mgr->config.tankDiameter,
-            mgr->config.tankCapacity,
-            mgr->config.waterCostPerLiter,
-            mgr->config.electricityCostPerUnit);
-        
-        mgr->currentData = configStr;
-        ble_gattc_notify_custom(conn_handle, mgr->m_sensor_char_handle, 
-            ble_hs_mbuf_from_flat(configStr, strlen(configStr)));
+    xSemaphoreGive(lock);
+
+    if (ble_gap_adv_active()) {
+        ble_gap_adv_stop();
     }
-    else {
-        ESP_LOGW(TAG, "Unknown command: %s", buf);
-        return BLE_ATT_ERR_UNLIKELY;
+    // A full house stops advertising until a disconnect starts it again
+    if (connected >= BLE_MAX_CONNECTIONS) {
+        return;
     }
 
-    return 0;
-}
+    // With a phone already connected, a second one is found at the slow
+    // interval; fast advertising would only crowd the open links
+    uint16_t itvlMin = advItvlMin;
+    uint16_t itvlMax = advItvlMax;
+    if (connected > 0 && itvlMin < BLE_ADV_ITVL_MIN) {
+        itvlMin = BLE_ADV_ITVL_MIN;
+        itvlMax = BLE_ADV_ITVL_MAX;
+    }
 
-void BluetoothManager::startBLE() {
     struct ble_gap_adv_params adv_params = {
         .conn_mode = BLE_GAP_CONN_MODE_UND,
         .disc_mode = BLE_GAP_DISC_MODE_GEN,
-        .itvl_min = 0x20,
-        .itvl_max = 0x30,
+        .itvl_min = itvlMin,
+        .itvl_max = itvlMax,
         .channel_map = 0,
         .filter_policy = 0,
         .high_duty_cycle = 0
     };
 
-    ble_gap_adv_start(
+    int rc = ble_gap_adv_start(
         BLE_OWN_ADDR_PUBLIC,
         NULL,
         BLE_HS_FOREVER,
@@ -242,30 +314,333 @@ void BluetoothManager::startBLE() {
         BluetoothManager::ble_gap_event_cb,
         this
     );
+    if (rc != 0) {
+        ESP_LOGW(TAG, "Advertising not started, rc=%d", rc);
+    }
 }
 
 void BluetoothManager::stopBLE() {
-    ble_gap_adv_stop();
-    nimble_port_stop();
-    esp_nimble_hci_deinit();
+    if (ble_gap_adv_active()) {
+        ble_gap_adv_stop();
+    }
 }
 
-// Called when data is received via BLE
-static void ble_gap_event_cb(struct ble_gap_event *event, void *arg) {
-    BluetoothManager* mgr = (BluetoothManager*)arg;
-    
-    if (event->type == BLE_GAP_EVENT_NOTIFY_RX) {
-        // Extract the received command
-        char command[128];
-        int len = os_mbuf_copydata(event->notify_rx.om, 0, sizeof(command)-1, command);
-        command[len] = '\0';
-        
-        // Route to command handler
-        mgr->handleCommand(command);
+void BluetoothManager::setAdvertising(uint16_t itvlMin, uint16_t itvlMax) {
+    advItvlMin = itvlMin;
+    advItvlMax = itvlMax;
+    if (itvlMin == 0) {
+        stopBLE();
+    } else {
+        startBLE();
+    }
+}
+
+int BluetoothManager::ble_gap_event_cb(struct ble_gap_event *event, void *arg) {
+    BluetoothManager* mgr = static_cast<BluetoothManager*>(arg);
+
+    switch (event->type) {
+    case BLE_GAP_EVENT_CONNECT:
+        if (event->connect.status == 0) {
+            mgr->onConnect(event->connect.conn_handle);
+        }
+        // The controller stops advertising on a connection; resume it for
+        // the next central while there are slots left
+        mgr->startBLE();
+        break;
+    case BLE_GAP_EVENT_DISCONNECT:
+        mgr->onDisconnect(event->disconnect.conn.conn_handle);
+        mgr->startBLE();
+        break;
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        mgr->onSubscribe(event->subscribe.conn_handle, event->subscribe.attr_handle,
+                         event->subscribe.cur_notify);
+        break;
+    case BLE_GAP_EVENT_MTU:
+        mgr->onMtu(event->mtu.conn_handle, event->mtu.value);
+        break;
+    case BLE_GAP_EVENT_CONN_UPDATE: {
+        struct ble_gap_conn_desc desc;
+        if (ble_gap_conn_find(event->conn_update.conn_handle, &desc) == 0) {
+            ESP_LOGI(TAG, "Connection %u: interval %u x1.25 ms, latency %u",
+                     desc.conn_handle, desc.conn_itvl, desc.conn_latency);
+        }
+        break;
+    }
+    case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+        ESP_LOGI(TAG, "Connection %u PHY tx %u rx %u", event->phy_updated.conn_handle,
+                 event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+BluetoothManager::Connection* BluetoothManager::findConnection(uint16_t connHandle) {
+    for (Connection& conn : connections) {
+        if (conn.handle == connHandle) {
+            return &conn;
+        }
+    }
+    return nullptr;
+}
+
+void BluetoothManager::onConnect(uint16_t connHandle) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    Connection* conn = findConnection(BLE_HS_CONN_HANDLE_NONE);
+    if (conn != nullptr) {
+        conn->handle = connHandle;
+        conn->mtu = BLE_ATT_MTU_DFLT;
+        conn->sensorNotify = false;
+        conn->packedNotify = false;
+        conn->bulkTransfer = false;
+        conn->mode = CONN_CENTRAL;
+        conn->connectedMs = millis();
+    }
+    deviceConnected = true;
+    xSemaphoreGive(lock);
+
+    if (conn == nullptr) {
+        ESP_LOGW(TAG, "No slot for connection %u, raise BLE_MAX_CONNECTIONS", connHandle);
     }
+
+    // Larger link-layer packets and a faster PHY where both sides support
+    // them. Each is a request: the central may decline and the link stays
+    // usable at the defaults.
+    ble_gattc_exchange_mtu(connHandle, NULL, NULL);
+    ble_gap_set_data_len(connHandle, BLE_DATA_LEN_OCTETS, BLE_DATA_LEN_TIME_US);
+#if CONFIG_BT_NIMBLE_50_FEATURE_SUPPORT
+    ble_gap_set_prefered_le_phy(connHandle, BLE_GAP_LE_PHY_2M_MASK | BLE_GAP_LE_PHY_1M_MASK,
+                                BLE_GAP_LE_PHY_2M_MASK | BLE_GAP_LE_PHY_1M_MASK,
+                                BLE_GAP_LE_PHY_CODED_ANY);
+#endif
 }
 
-// In BluetoothManager.cpp
+void BluetoothManager::onDisconnect(uint16_t connHandle) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    Connection* conn = findConnection(connHandle);
+    if (conn != nullptr) {
+        conn->handle = BLE_HS_CONN_HANDLE_NONE;
+        conn->sensorNotify = false;
+        conn->packedNotify = false;
+    }
+    deviceConnected = false;
+    for (const Connection& other : connections) {
+        deviceConnected |= other.handle != BLE_HS_CONN_HANDLE_NONE;
+    }
+    xSemaphoreGive(lock);
+}
+
+void BluetoothManager::onSubscribe(uint16_t connHandle, uint16_t attrHandle, bool notify) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    Connection* conn = findConnection(connHandle);
+    if (conn != nullptr && attrHandle == m_sensor_char_handle) {
+        conn->sensorNotify = notify;
+    } else if (conn != nullptr && attrHandle == m_packed_char_handle) {
+        conn->packedNotify = notify;
+    }
+    xSemaphoreGive(lock);
+
+    updateConnectionParams();
+}
+
+void BluetoothManager::onMtu(uint16_t connHandle, uint16_t mtu) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    Connection* conn = findConnection(connHandle);
+    if (conn != nullptr) {
+        conn->mtu = mtu;
+    }
+    xSemaphoreGive(lock);
+}
+
+os_mbuf* BluetoothManager::notifyMbuf(const void* value, size_t length) {
+    os_mbuf* om = os_mbuf_get_pkthdr(&notifyMbufPool, 0);
+    if (om == nullptr) {
+        return nullptr;
+    }
+    om->om_data += NOTIFY_LEADING_SPACE;
+    if (os_mbuf_append(om, value, length) != 0) {
+        os_mbuf_free_chain(om);
+        return nullptr;
+    }
+    return om;
+}
+
+// Keeps the value for reads and notifies the subscribers of the sensor
+// characteristic
+void BluetoothManager::sendNotification(const char* value, size_t length) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    currentLength = MIN(length, sizeof(currentData));
+    memcpy(currentData, value, currentLength);
+    xSemaphoreGive(lock);
+
+    notifySubscribers(m_sensor_char_handle, value, length);
+}
+
+// The host truncates to each connection's MTU
+void BluetoothManager::notifySubscribers(uint16_t attrHandle, const void* value, size_t length) {
+    int64_t start = esp_timer_get_time();
+    uint16_t targets[BLE_MAX_CONNECTIONS];
+    size_t count = 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (const Connection& conn : connections) {
+        bool subscribed = attrHandle == m_packed_char_handle ? conn.packedNotify : conn.sensorNotify;
+        if (conn.handle != BLE_HS_CONN_HANDLE_NONE && subscribed) {
+            targets[count++] = conn.handle;
+        }
+    }
+    xSemaphoreGive(lock);
+
+    // Outside the lock: the host reports BLE_GAP_EVENT_NOTIFY_TX from
+    // within ble_gatts_notify_custom()
+    for (size_t i = 0; i < count; i++) {
+        os_mbuf* om = notifyMbuf(value, length);
+        // The host owns om from here, sent or not
+        if (om == nullptr || ble_gatts_notify_custom(targets[i], attrHandle, om) != 0) {
+            notifyStats.dropped++;
+        } else {
+            notifyStats.sent++;
+        }
+    }
+    notifyStats.busyUs += esp_timer_get_time() - start;
+}
+
+static void putLe16(uint8_t* out, uint16_t value) {
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+static void putLe32(uint8_t* out, uint32_t value) {
+    putLe16(out, value & 0xffff);
+    putLe16(out + 2, value >> 16);
+}
+
+// Scales a reading into a u16 field; NaN and out-of-range become 0xffff
+static uint16_t scaleU16(float value, float scale) {
+    float scaled = roundf(value * scale);
+    return (scaled >= 0 && scaled < 0xffff) ? (uint16_t)scaled : 0xffff;
+}
+
+size_t BluetoothManager::packSample(const SensorData& data, uint8_t* out) {
+    float temperature = roundf(data.temperature * 100);
+    int16_t temp = (temperature > INT16_MIN && temperature <= INT16_MAX) ?
+                   (int16_t)temperature : INT16_MIN;
+    float total = roundf(data.totalWaterUsed * 1000);
+
+    putLe32(out, data.lastUpdate);
+    putLe16(out + 4, (uint16_t)temp);
+    putLe16(out + 6, scaleU16(data.tdsValue, 1));
+    putLe16(out + 8, scaleU16(data.waterLevel, 100));
+    putLe16(out + 10, scaleU16(data.powerConsumption, 10));
+    putLe16(out + 12, scaleU16(data.waterFlow, 100));
+    putLe32(out + 14, (total >= 0 && total < 4294967295.0f) ? (uint32_t)total : 0xffffffff);
+    out[18] = data.pumpStatus ? 0x01 : 0x00;
+    return BLE_PACKED_SAMPLE_SIZE;
+}
+
+bool BluetoothManager::isStreaming() {
+    bool streaming = false;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (const Connection& conn : connections) {
+        streaming |= conn.handle != BLE_HS_CONN_HANDLE_NONE && conn.packedNotify;
+    }
+    xSemaphoreGive(lock);
+    return streaming;
+}
+
+void BluetoothManager::setBulkTransfer(uint16_t connHandle, bool active) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    Connection* conn = findConnection(connHandle);
+    if (conn != nullptr) {
+        conn->bulkTransfer = active;
+    }
+    xSemaphoreGive(lock);
+
+    updateConnectionParams();
+}
+
+void BluetoothManager::updateConnectionParams() {
+    uint16_t handles[BLE_MAX_CONNECTIONS];
+    bool streaming[BLE_MAX_CONNECTIONS];
+    size_t count = 0;
+    uint32_t now = millis();
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (Connection& conn : connections) {
+        if (conn.handle == BLE_HS_CONN_HANDLE_NONE) {
+            continue;
+        }
+        bool busy = conn.packedNotify || conn.bulkTransfer;
+        ConnMode want = busy ? CONN_STREAMING : CONN_IDLE;
+        if (conn.mode == want || (!busy && now - conn.connectedMs < BLE_CONN_IDLE_AFTER_MS)) {
+            continue;
+        }
+        handles[count] = conn.handle;
+        streaming[count++] = busy;
+    }
+    xSemaphoreGive(lock);
+
+    for (size_t i = 0; i < count; i++) {
+        struct ble_gap_upd_params params = {
+            .itvl_min = (uint16_t)(streaming[i] ? BLE_CONN_STREAM_ITVL_MIN : BLE_CONN_IDLE_ITVL_MIN),
+            .itvl_max = (uint16_t)(streaming[i] ? BLE_CONN_STREAM_ITVL_MAX : BLE_CONN_IDLE_ITVL_MAX),
+            .latency = (uint16_t)(streaming[i] ? BLE_CONN_STREAM_LATENCY : BLE_CONN_IDLE_LATENCY),
+            .supervision_timeout = BLE_CONN_SUPERVISION_TIMEOUT,
+            .min_ce_len = 0,
+            .max_ce_len = 0
+        };
+        int rc = ble_gap_update_params(handles[i], &params);
+        if (rc != 0) {
+            // Left unchanged, so the next call asks again
+            ESP_LOGW(TAG, "Connection %u parameter update failed, rc=%d", handles[i], rc);
+            continue;
+        }
+        notifyStats.connParamUpdates++;
+
+        // Asked once per change; a central that refuses keeps its own
+        xSemaphoreTake(lock, portMAX_DELAY);
+        Connection* conn = findConnection(handles[i]);
+        if (conn != nullptr) {
+            conn->mode = streaming[i] ? CONN_STREAMING : CONN_IDLE;
+        }
+        xSemaphoreGive(lock);
+    }
+}
+
+// Samples that fit one notification on every packed subscriber
+size_t BluetoothManager::batchCapacity() {
+    uint16_t mtu = BLE_MTU_SIZE;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (const Connection& conn : connections) {
+        if (conn.handle != BLE_HS_CONN_HANDLE_NONE && conn.packedNotify) {
+            mtu = MIN(mtu, conn.mtu);
+        }
+    }
+    xSemaphoreGive(lock);
+
+    // ATT notification header is 3 bytes
+    size_t capacity = (mtu - 3) / BLE_PACKED_SAMPLE_SIZE;
+    return capacity == 0 ? 1 : MIN(capacity, (size_t)BLE_PACKED_BATCH_MAX);
+}
+
+void BluetoothManager::addLiveSample(const SensorData& data) {
+    uint8_t* sample = batch + batchCount * BLE_PACKED_SAMPLE_SIZE;
+    packSample(data, sample);
+    if (batchCount++ == 0) {
+        batchStartMs = millis();
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    memcpy(lastSample, sample, sizeof(lastSample));
+    xSemaphoreGive(lock);
+
+    if (batchCount < batchCapacity() && millis() - batchStartMs < BLE_LIVE_BATCH_MS) {
+        return;
+    }
+    notifySubscribers(m_packed_char_handle, batch, batchCount * BLE_PACKED_SAMPLE_SIZE);
+    batchCount = 0;
+}
 
 void BluetoothManager::updateSensorData(const SensorData& data) {
     if (!isConnected()) return;
@@ -278,65 +653,100 @@ void BluetoothManager::updateSensorData(const SensorData& data) {
     doc["flow"] = data.waterFlow;
     doc["pump"] = data.pumpStatus ? "ON" : "OFF";
     
-    currentData.clear();
-    serializeJson(doc, currentData);
-
-    uint16_t svc_handle, chr_handle;
-    if (ble_gatts_find_chr(&service_uuid.u, &sensor_char_uuid.u, &svc_handle, &chr_handle) == 0) {
-        struct os_mbuf *om = ble_hs_mbuf_from_flat(currentData.c_str(), currentData.length());
-        if (om) {
-            ble_gattc_notify_custom(BLE_HS_CONN_HANDLE_NONE, chr_handle, om);
-            os_mbuf_free_chain(om);  // Free the memory after sending
-        }
-    }
+    char value[BLE_MTU_SIZE];
+    size_t length = serializeJson(doc, value, sizeof(value));
+    sendNotification(value, length);
 }
 
 void BluetoothManager::handleCommand(const char* command) {
     if (command == nullptr || command[0] == '\0') {
-        DEBUG_E("Received null or empty command");
+        ESP_LOGE(TAG, "Received null or empty command");
         return;
     }
 
-    // Tank height configuration
-    if (strncmp(command, "SET_TANK_HEIGHT:", 16) == 0) {
-        if (strlen(command) > 16) {  // Ensure there's data after the prefix
-            handleTankHeightCommand(command);
-        } else {
-            DEBUG_E("Invalid tank height command format");
+    if (strncmp(command, "PUMP=", 5) == 0) {
+        // Format: PUMP=ON or PUMP=OFF, translated to the JSON pump command
+        bool pumpState = (strcmp(command + 5, "ON") == 0);
+        if (commandCallback) {
+            char json[48];
+            int length = snprintf(json, sizeof(json),
+                                  "{\"action\":\"pump\",\"status\":%s}",
+                                  pumpState ? "true" : "false");
+            char ack[COMMAND_ACK_SIZE];
+            if (commandCallback(json, length, ack, sizeof(ack)) > 0) {
+                sendAlert(ack);
+            }
         }
+        ESP_LOGI(TAG, "Pump set to %s", pumpState ? "ON" : "OFF");
+    }
+    else if (strncmp(command, "SET_TANK_DIMENSIONS:", 20) == 0) {
+        handleTankDimensions(command + 20);
     }
-    // Cost configuration
     else if (strncmp(command, "SET_COST:", 9) == 0) {
-        if (strlen(command) > 9) {
-            handleCostCommand(command);
-        } else {
-            DEBUG_E("Invalid cost command format");
-        }
+        handleCostConfiguration(command + 9);
+    }
+    else if (strcmp(command, "GET_CONFIG") == 0) {
+        notifyConfig();
     }
     else {
-        DEBUG_E("Unknown command: " + String(command));
+        ESP_LOGW(TAG, "Unknown command: %s", command);
     }
 }
 
-// Your existing implementation (now properly connected)
-void BluetoothManager::handleTankHeightCommand(const char* command) {
-    float height = atof(command + 16); // Skip "SET_TANK_HEIGHT:"
-    
-    if (height >= 30.0) {  // Minimum safe height
-        preferences.begin("tank_config", false);
-        preferences.putFloat("height", height);
-        preferences.end();
-        
-        // Confirm back to app
-        char response[32];
-        snprintf(response, sizeof(response), "HEIGHT_ACK:%.1f", height);
-        sendBLEResponse(response);
-    } else {
-        sendBLEResponse("ERROR:MIN_HEIGHT_30CM");
+// Format: height:diameter (both in cm)
+void BluetoothManager::handleTankDimensions(const char* command) {
+    char* endPtr;
+    float height = strtof(command, &endPtr);
+    float diameter = *endPtr == ':' ? strtof(endPtr + 1, NULL) : 0.0f;
+
+    if (height <= 0 || diameter <= 0) {
+        ESP_LOGE(TAG, "Invalid tank dimensions");
+        return;
     }
+
+    // Capacity in liters: pi r^2 h / 1000
+    float radius = diameter / 2.0f;
+    tankHeight = height;
+    tankDiameter = diameter;
+    tankCapacity = (3.14159f * radius * radius * height) / 1000.0f;
+
+    preferences.putFloat("height", tankHeight);
+    preferences.putFloat("diameter", tankDiameter);
+    preferences.putFloat("capacity", tankCapacity);
+    ESP_LOGI(TAG, "Tank dimensions set: %.1fcm H, %.1fcm D", height, diameter);
+}
+
+// Format: water:0.002. The water price lives in DeviceConfig, so it goes
+// through the config command like an MQTT update would.
+void BluetoothManager::handleCostConfiguration(const char* command) {
+    const char* value = strchr(command, ':');
+    if (value == nullptr) {
+        ESP_LOGE(TAG, "Invalid cost command format");
+        return;
+    }
+    if (strncmp(command, "water:", 6) != 0) {
+        ESP_LOGW(TAG, "Unsupported cost type: %.*s", (int)(value - command), command);
+        return;
+    }
+    if (commandCallback) {
+        char json[64];
+        int length = snprintf(json, sizeof(json),
+                              "{\"action\":\"config\",\"costPerLiter\":%.4f}",
+                              strtof(value + 1, NULL));
+        char ack[COMMAND_ACK_SIZE];
+        if (commandCallback(json, length, ack, sizeof(ack)) > 0) {
+            sendAlert(ack);
+        }
+    }
+}
+
+void BluetoothManager::notifyConfig() {
+    char value[64];
+    int length = snprintf(value, sizeof(value), "CONFIG:HT%.1f:DT%.1f:CP%.1f",
+                          tankHeight, tankDiameter, tankCapacity);
+    sendNotification(value, MIN((size_t)length, sizeof(value) - 1));
 }
 
-// Add this right after it:
 void BluetoothManager::sendWaterCost(float totalLiters, float costPerLiter) {
     if (!isConnected()) return;
     
@@ -345,29 +755,13 @@ void BluetoothManager::sendWaterCost(float totalLiters, float costPerLiter) {
     doc["liters"] = totalLiters;
     doc["cost"] = totalLiters * costPerLiter;
     
-    currentData.clear();
-    serializeJson(doc, currentData);
-    
-    uint16_t svc_handle, chr_handle;
-    if (ble_gatts_find_chr(&service_uuid.u, &sensor_char_uuid.u, &svc_handle, &chr_handle) == 0) {
-        struct os_mbuf *om = ble_hs_mbuf_from_flat(currentData.c_str(), currentData.length());
-        if (om) {
-            ble_gattc_notify_custom(BLE_HS_CONN_HANDLE_NONE, chr_handle, om);
-            os_mbuf_free_chain(om);  // Free the memory after sending
-        }
-    }
+    char value[BLE_MTU_SIZE];
+    size_t length = serializeJson(doc, value, sizeof(value));
+    sendNotification(value, length);
 }
 
 void BluetoothManager::sendAlert(const char* message) {
     if (!isConnected()) return;
     
-    currentData = message;
-    uint16_t svc_handle, chr_handle;
-    if (ble_gatts_find_chr(&service_uuid.u, &sensor_char_uuid.u, &svc_handle, &chr_handle) == 0) {
-        struct os_mbuf *om = ble_hs_mbuf_from_flat(currentData.c_str(), currentData.length());
-        if (om) {
-            ble_gattc_notify_custom(BLE_HS_CONN_HANDLE_NONE, chr_handle, om);
-            os_mbuf_free_chain(om);  // Free the memory after sending
-        }
-    }
-}
\ No newline at end of file
+    sendNotification(message, strlen(message));
+}
@@ -0,0 +1,94 @@
+#include "CommandDispatcher.h"
+#include "esp_log.h"
+#include <Arduino.h>
+#include <string.h>
+
+static const char* TAG = "Commands";
+
+CommandDispatcher::CommandDispatcher() :
+    entryCount(0),
+    lastStatus(CommandStatus::OK) {
+    memset(entries, 0, sizeof(entries));
+    lock = xSemaphoreCreateMutexStatic(&lockBuffer);
+}
+
+bool CommandDispatcher::addHandler(const char* action, CommandHandler handler, uint32_t minIntervalMs,
+                                   CommandLimit limit) {
+    if (action == nullptr || handler == nullptr || entryCount >= COMMAND_MAX_HANDLERS) {
+        return false;
+    }
+
+    Entry& entry = entries[entryCount++];
+    entry.action = action;
+    entry.handler = handler;
+    entry.limit = limit;
+    entry.minIntervalMs = minIntervalMs;
+    entry.hasRun = false;
+    return true;
+}
+
+const char* CommandDispatcher::statusName(CommandStatus status) {
+    switch (status) {
+        case CommandStatus::OK:             return "ok";
+        case CommandStatus::BAD_REQUEST:    return "bad_request";
+        case CommandStatus::UNKNOWN_ACTION: return "unknown_action";
+        case CommandStatus::RATE_LIMITED:   return "rate_limited";
+        case CommandStatus::FAILED:         return "failed";
+    }
+    return "failed";
+}
+
+size_t CommandDispatcher::dispatch(char* payload, size_t length, char* ack, size_t ackSize) {
+    // Only the node pool lives here; a non-const payload makes ArduinoJson
+    // point strings into it instead of copying them.
+    StaticJsonDocument<COMMAND_JSON_CAPACITY> doc;
+    DeserializationError error = deserializeJson(doc, payload, length);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    CommandStatus status = error ? CommandStatus::BAD_REQUEST : run(doc.as<JsonObjectConst>());
+    lastStatus = status;
+    xSemaphoreGive(lock);
+
+    if (status != CommandStatus::OK) {
+        ESP_LOGW(TAG, "Command rejected: %s", statusName(status));
+    }
+    if (ack == nullptr || ackSize == 0) {
+        return 0;
+    }
+
+    StaticJsonDocument<96> reply;
+    JsonVariantConst id = doc["id"];
+    if (!error && !id.isNull()) {
+        reply["id"] = id;  // Still points into the payload, serialised below
+    }
+    reply["status"] = statusName(status);
+    if (measureJson(reply) >= ackSize) {
+        return 0;
+    }
+    return serializeJson(reply, ack, ackSize);
+}
+
+CommandStatus CommandDispatcher::run(JsonObjectConst command) {
+    const char* action = command["action"];
+    if (action == nullptr) {
+        return CommandStatus::BAD_REQUEST;
+    }
+
+    for (size_t i = 0; i < entryCount; i++) {
+        Entry& entry = entries[i];
+        if (strcmp(entry.action, action) != 0) {
+            continue;
+        }
+
+        uint32_t now = millis();
+        if (entry.hasRun && entry.minIntervalMs > 0 &&
+            now - entry.lastRunMs < entry.minIntervalMs &&
+            (entry.limit == nullptr || entry.limit(command))) {
+            return CommandStatus::RATE_LIMITED;
+        }
+        entry.lastRunMs = now;
+        entry.hasRun = true;
+        return entry.handler(command);
+    }
+    return CommandStatus::UNKNOWN_ACTION;
+}
@@ -0,0 +1,158 @@
+#include "ConnectivityManager.h"
+#include <Arduino.h>
+#include "esp_log.h"
+#include <string.h>
+
+ConnectivityManager::ConnectivityManager(BluetoothManager& ble) :
+    ble(ble),
+    state(State::STARTING),
+    boostTimer(nullptr),
+    pressTimer(nullptr),
+    buttonPin(-1),
+    boosted(false),
+    boostStartUs(0),
+    lastPress(0) {
+    memset(&stats, 0, sizeof(stats));
+    lock = xSemaphoreCreateMutexStatic(&lockBuffer);
+}
+
+ConnectivityManager::~ConnectivityManager() {
+    if (buttonPin >= 0) {
+        detachInterrupt(buttonPin);
+    }
+    if (pressTimer != nullptr) {
+        esp_timer_stop(pressTimer);
+        esp_timer_delete(pressTimer);
+    }
+    if (boostTimer != nullptr) {
+        esp_timer_stop(boostTimer);
+        esp_timer_delete(boostTimer);
+    }
+}
+
+bool ConnectivityManager::begin(int buttonPin) {
+    const esp_timer_create_args_t args = {
+        .callback = &ConnectivityManager::boostExpired,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "adv_boost",
+        .skip_unhandled_events = true
+    };
+    if (esp_timer_create(&args, &boostTimer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create advertising window timer");
+        return false;
+    }
+
+    if (buttonPin >= 0) {
+        const esp_timer_create_args_t pressArgs = {
+            .callback = &ConnectivityManager::buttonPressed,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "adv_button",
+            .skip_unhandled_events = true
+        };
+        if (esp_timer_create(&pressArgs, &pressTimer) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to create button timer");
+            return false;
+        }
+        pinMode(buttonPin, INPUT_PULLUP);
+        attachInterruptArg(buttonPin, buttonIsr, this, FALLING);
+        this->buttonPin = buttonPin;
+    }
+
+    boost();
+    return true;
+}
+
+void ConnectivityManager::boost() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (!boosted) {
+        boosted = true;
+        boostStartUs = esp_timer_get_time();
+        stats.boosts++;
+        applyAdvertising();
+    }
+    xSemaphoreGive(lock);
+
+    if (boostTimer != nullptr) {
+        esp_timer_stop(boostTimer);
+        esp_timer_start_once(boostTimer, (uint64_t)BLE_ADV_FAST_WINDOW_MS * 1000);
+    }
+}
+
+uint64_t ConnectivityManager::getBoostEndUs() const {
+    uint64_t expiry = 0;
+    if (boostTimer == nullptr || !esp_timer_is_active(boostTimer) ||
+        esp_timer_get_expiry_time(boostTimer, &expiry) != ESP_OK) {
+        return 0;
+    }
+    return expiry;
+}
+
+void ConnectivityManager::endBoost() {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (boosted) {
+        boosted = false;
+        stats.fastUs += esp_timer_get_time() - boostStartUs;
+        applyAdvertising();
+    }
+    xSemaphoreGive(lock);
+}
+
+// Called with the lock held
+void ConnectivityManager::applyAdvertising() {
+    if (boosted) {
+        ble.setAdvertising(BLE_ADV_FAST_ITVL_MIN, BLE_ADV_FAST_ITVL_MAX);
+    } else if (state == State::WIFI) {
+        ble.setAdvertising(BLE_ADV_WIFI_ITVL_MIN, BLE_ADV_WIFI_ITVL_MAX);
+    } else {
+        ble.setAdvertising(BLE_ADV_ITVL_MIN, BLE_ADV_ITVL_MAX);
+    }
+}
+
+void ConnectivityManager::boostExpired(void* arg) {
+    static_cast<ConnectivityManager*>(arg)->endBoost();
+}
+
+void IRAM_ATTR ConnectivityManager::buttonIsr(void* arg) {
+    ConnectivityManager* self = static_cast<ConnectivityManager*>(arg);
+    TickType_t now = xTaskGetTickCountFromISR();
+    if (now - self->lastPress < pdMS_TO_TICKS(BLE_BUTTON_DEBOUNCE_MS)) {
+        return;
+    }
+    self->lastPress = now;
+
+    // NimBLE calls are not allowed here. The esp_timer task makes them, as
+    // it does when the window closes; a press already pending is enough.
+    esp_timer_start_once(self->pressTimer, 0);
+}
+
+void ConnectivityManager::buttonPressed(void* arg) {
+    static_cast<ConnectivityManager*>(arg)->boost();
+}
+
+void ConnectivityManager::update(bool wifiUp, uint32_t changedAtUs) {
+    State next = wifiUp ? State::WIFI : State::BLE;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (next == state) {
+        xSemaphoreGive(lock);
+        return;
+    }
+
+    State previous = state;
+    state = next;
+    applyAdvertising();
+    xSemaphoreGive(lock);
+
+    // The boot transition has no link event to measure from
+    if (previous != State::STARTING) {
+        uint32_t latencyUs = (uint32_t)esp_timer_get_time() - changedAtUs;
+        stats.transitions++;
+        stats.lastUs = latencyUs;
+        stats.totalUs += latencyUs;
+        if (latencyUs > stats.maxUs) {
+            stats.maxUs = latencyUs;
+        }
+        ESP_LOGI(TAG, "Switched to %s in %u us", wifiUp ? "WiFi" : "BLE", (unsigned)latencyUs);
+    }
+}
@@ -0,0 +1,356 @@
+#include "HistoryService.h"
+#include "BluetoothManager.h"
+#include "esp_log.h"
+#include <Arduino.h>
+#include <string.h>
+
+// Records per notification at BLE_MTU_SIZE (3 bytes of ATT header)
+static constexpr size_t RECORDS_PER_NOTIFY = (BLE_MTU_SIZE - 3) / HISTORY_RECORD_SIZE;
+// Re-check a stalled transfer even if no event wakes the task
+static constexpr uint32_t HISTORY_POLL_MS = 1000;
+
+// Same layout as the live notification pool in bluetooth.cpp, but separate
+// so a bulk download cannot take the buffers live data and alerts need
+static constexpr uint16_t NOTIFY_LEADING_SPACE = 16;
+static constexpr uint16_t NOTIFY_MBUF_BLOCK = sizeof(struct os_mbuf) +
+    sizeof(struct os_mbuf_pkthdr) + NOTIFY_LEADING_SPACE + BLE_MTU_SIZE;
+static os_membuf_t historyPoolMemory[OS_MEMPOOL_SIZE(HISTORY_MBUF_COUNT, NOTIFY_MBUF_BLOCK)];
+static struct os_mempool historyMempool;
+static struct os_mbuf_pool historyMbufPool;
+
+static const ble_uuid128_t historyServiceUuid = BLE_UUID128_INIT(
+    0x4f, 0xaf, 0xc2, 0x02, 0x1f, 0xb5, 0x45, 0x9e,
+    0x8f, 0xcc, 0xc5, 0xc9, 0xc3, 0x31, 0x91, 0x4b);
+static const ble_uuid128_t historyControlUuid = BLE_UUID128_INIT(
+    0xbe, 0xb5, 0x48, 0x41, 0x36, 0xe1, 0x46, 0x88,
+    0xb7, 0xf5, 0xea, 0x07, 0x36, 0x1b, 0x26, 0xa8);
+static const ble_uuid128_t historyDataUuid = BLE_UUID128_INIT(
+    0xbe, 0xb5, 0x48, 0x42, 0x36, 0xe1, 0x46, 0x88,
+    0xb7, 0xf5, 0xea, 0x07, 0x36, 0x1b, 0x26, 0xa8);
+
+static os_mbuf* historyMbuf(const void* value, size_t length) {
+    os_mbuf* om = os_mbuf_get_pkthdr(&historyMbufPool, 0);
+    if (om == nullptr) {
+        return nullptr;
+    }
+    om->om_data += NOTIFY_LEADING_SPACE;
+    if (os_mbuf_append(om, value, length) != 0) {
+        os_mbuf_free_chain(om);
+        return nullptr;
+    }
+    return om;
+}
+
+static uint32_t getLe32(const uint8_t* in) {
+    return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static void putLe32(uint8_t* out, uint32_t value) {
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = value >> 24;
+}
+
+HistoryService::HistoryService(DataQueue& queue) :
+    queue(queue),
+    taskHandle(nullptr),
+    controlHandle(0),
+    dataHandle(0),
+    connHandle(BLE_HS_CONN_HANDLE_NONE),
+    subscribedConn(BLE_HS_CONN_HANDLE_NONE),
+    generation(0),
+    cursor(0),
+    fromMs(0),
+    toMs(0),
+    credits(0),
+    sent(0),
+    startMs(0) {
+    memset(&gapListener, 0, sizeof(gapListener));
+    memset(&stats, 0, sizeof(stats));
+}
+
+bool HistoryService::begin() {
+    if (taskHandle != nullptr) {
+        return true;
+    }
+
+    os_mempool_init(&historyMempool, HISTORY_MBUF_COUNT, NOTIFY_MBUF_BLOCK,
+                    historyPoolMemory, "ble_history");
+    os_mbuf_pool_init(&historyMbufPool, &historyMempool, NOTIFY_MBUF_BLOCK,
+                      HISTORY_MBUF_COUNT);
+
+    static ble_gatt_chr_def characteristicDefs[] = {
+        {
+            .uuid = &historyControlUuid.u,
+            .access_cb = HistoryService::accessCb,
+            .arg = this,
+            .descriptors = NULL,
+            .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
+            .min_key_size = 0,
+            .val_handle = &controlHandle,
+            .cpfd = NULL
+        },
+        {
+            .uuid = &historyDataUuid.u,
+            .access_cb = HistoryService::accessCb,
+            .arg = this,
+            .descriptors = NULL,
+            .flags = BLE_GATT_CHR_F_NOTIFY,
+            .min_key_size = 0,
+            .val_handle = &dataHandle,
+            .cpfd = NULL
+        },
+        { 0 } // Terminator
+    };
+
+    static ble_gatt_svc_def serviceDefs[] = {
+        {
+            .type = BLE_GATT_SVC_TYPE_PRIMARY,
+            .uuid = &historyServiceUuid.u,
+            .includes = NULL,
+            .characteristics = characteristicDefs
+        },
+        { 0 } // Terminator
+    };
+
+    if (ble_gatts_count_cfg(serviceDefs) != 0 || ble_gatts_add_svcs(serviceDefs) != 0) {
+        ESP_LOGE(TAG, "Failed to register history service");
+        return false;
+    }
+    // Sees every GAP event, whichever callback owns the connection
+    ble_gap_event_listener_register(&gapListener, gapEvent, this);
+
+    if (xTaskCreate(transferTask, "HistoryTask", 4096, this, 1, &taskHandle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start history task");
+        return false;
+    }
+    return true;
+}
+
+int HistoryService::accessCb(uint16_t connHandle, uint16_t attrHandle,
+                             ble_gatt_access_ctxt* ctxt, void* arg) {
+    HistoryService* service = static_cast<HistoryService*>(arg);
+    if (ctxt->op != BLE_GATT_ACCESS_OP_WRITE_CHR || attrHandle != service->controlHandle) {
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+
+    uint8_t buf[16];
+    uint16_t len = 0;
+    if (OS_MBUF_PKTLEN(ctxt->om) > sizeof(buf) ||
+        ble_hs_mbuf_to_flat(ctxt->om, buf, sizeof(buf), &len) != 0 || len == 0) {
+        return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    }
+    return service->handleControl(connHandle, buf, len);
+}
+
+int HistoryService::handleControl(uint16_t conn, const uint8_t* buf, size_t len) {
+    switch (buf[0]) {
+    case OP_START: {
+        if (len < 14) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        // A new START replaces whatever transfer was running
+        portENTER_CRITICAL(&mux);
+        uint16_t previous = connHandle;
+        connHandle = conn;
+        generation++;
+        cursor = getLe32(buf + 1);
+        fromMs = getLe32(buf + 5);
+        toMs = getLe32(buf + 9);
+        credits = buf[13];
+        sent = 0;
+        startMs = millis();
+        portEXIT_CRITICAL(&mux);
+
+        // Short connection interval for the duration of the download
+        if (previous != BLE_HS_CONN_HANDLE_NONE && previous != conn) {
+            bluetoothManager.setBulkTransfer(previous, false);
+        }
+        bluetoothManager.setBulkTransfer(conn, true);
+
+        uint8_t info[13];
+        info[0] = OP_INFO;
+        putLe32(info + 1, queue.headSequence());
+        putLe32(info + 5, queue.tailSequence());
+        putLe32(info + 9, esp_log_timestamp());
+        notifyControl(conn, info, sizeof(info));
+        break;
+    }
+    case OP_CREDIT:
+        if (len < 2) {
+            return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+        }
+        portENTER_CRITICAL(&mux);
+        if (conn == connHandle) {
+            credits = credits + buf[1] > HISTORY_MAX_CREDITS ? HISTORY_MAX_CREDITS : credits + buf[1];
+        }
+        portEXIT_CRITICAL(&mux);
+        break;
+    case OP_STOP:
+        portENTER_CRITICAL(&mux);
+        if (conn == connHandle) {
+            connHandle = BLE_HS_CONN_HANDLE_NONE;
+            generation++;
+        }
+        portEXIT_CRITICAL(&mux);
+        bluetoothManager.setBulkTransfer(conn, false);
+        break;
+    default:
+        return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+    }
+
+    xTaskNotifyGive(taskHandle);
+    return 0;
+}
+
+int HistoryService::gapEvent(ble_gap_event* event, void* arg) {
+    HistoryService* service = static_cast<HistoryService*>(arg);
+
+    switch (event->type) {
+    case BLE_GAP_EVENT_DISCONNECT:
+        portENTER_CRITICAL(&service->mux);
+        if (event->disconnect.conn.conn_handle == service->connHandle) {
+            service->connHandle = BLE_HS_CONN_HANDLE_NONE;
+            service->generation++;
+        }
+        if (event->disconnect.conn.conn_handle == service->subscribedConn) {
+            service->subscribedConn = BLE_HS_CONN_HANDLE_NONE;
+        }
+        portEXIT_CRITICAL(&service->mux);
+        break;
+    case BLE_GAP_EVENT_SUBSCRIBE:
+        if (event->subscribe.attr_handle != service->dataHandle) {
+            break;
+        }
+        portENTER_CRITICAL(&service->mux);
+        if (event->subscribe.cur_notify) {
+            service->subscribedConn = event->subscribe.conn_handle;
+        } else if (event->subscribe.conn_handle == service->subscribedConn) {
+            service->subscribedConn = BLE_HS_CONN_HANDLE_NONE;
+        }
+        portEXIT_CRITICAL(&service->mux);
+        xTaskNotifyGive(service->taskHandle);
+        break;
+    case BLE_GAP_EVENT_NOTIFY_TX:
+        // A history mbuf went back to the pool
+        if (event->notify_tx.attr_handle == service->dataHandle) {
+            xTaskNotifyGive(service->taskHandle);
+        }
+        break;
+    default:
+        break;
+    }
+    return 0;
+}
+
+void HistoryService::transferTask(void* arg) {
+    HistoryService* service = static_cast<HistoryService*>(arg);
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HISTORY_POLL_MS));
+        while (service->sendNext()) {
+        }
+    }
+}
+
+bool HistoryService::sendNext() {
+    portENTER_CRITICAL(&mux);
+    bool ready = connHandle != BLE_HS_CONN_HANDLE_NONE && connHandle == subscribedConn &&
+                 credits > 0;
+    uint16_t conn = connHandle;
+    uint32_t gen = generation;
+    uint32_t from = cursor;
+    uint32_t lo = fromMs;
+    uint32_t hi = toMs;
+    portEXIT_CRITICAL(&mux);
+    if (!ready) {
+        return false;
+    }
+
+    uint16_t mtu = ble_att_mtu(conn);
+    size_t max = mtu > 3 ? (mtu - 3) / HISTORY_RECORD_SIZE : 0;
+    if (max == 0) {
+        ESP_LOGW(TAG, "MTU %u too small for history records", mtu);
+        finish(conn, gen, from);
+        return false;
+    }
+    if (max > RECORDS_PER_NOTIFY) {
+        max = RECORDS_PER_NOTIFY;
+    }
+
+    SensorData records[RECORDS_PER_NOTIFY];
+    uint32_t firstSeq, nextSeq;
+    size_t count = queue.peek(from, records, max, firstSeq, nextSeq);
+    if (count == 0 && nextSeq == from) {
+        finish(conn, gen, from);
+        return false;
+    }
+
+    // Records outside the time window are skipped without using a credit
+    uint8_t payload[RECORDS_PER_NOTIFY * HISTORY_RECORD_SIZE];
+    size_t length = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t ts = records[i].lastUpdate;
+        if (ts < lo || (hi != 0 && ts > hi)) {
+            continue;
+        }
+        putLe32(payload + length, firstSeq + i);
+        BluetoothManager::packSample(records[i], payload + length + 4);
+        length += HISTORY_RECORD_SIZE;
+    }
+
+    if (length > 0) {
+        os_mbuf* om = historyMbuf(payload, length);
+        if (om == nullptr) {
+            return false;  // Woken again by BLE_GAP_EVENT_NOTIFY_TX
+        }
+        // The host owns om from here, sent or not
+        if (ble_gatts_notify_custom(conn, dataHandle, om) != 0) {
+            return false;
+        }
+    }
+
+    portENTER_CRITICAL(&mux);
+    if (gen == generation) {
+        cursor = nextSeq;
+        if (length > 0) {
+            credits--;
+            sent += length / HISTORY_RECORD_SIZE;
+            stats.notifications++;
+        }
+    }
+    portEXIT_CRITICAL(&mux);
+    return true;
+}
+
+void HistoryService::finish(uint16_t conn, uint32_t gen, uint32_t nextSeq) {
+    portENTER_CRITICAL(&mux);
+    bool current = gen == generation;
+    uint32_t records = sent;
+    if (current) {
+        connHandle = BLE_HS_CONN_HANDLE_NONE;
+        generation++;
+        stats.transfers++;
+        stats.records += records;
+        stats.lastTransferMs = millis() - startMs;
+    }
+    portEXIT_CRITICAL(&mux);
+    if (!current) {
+        return;
+    }
+    bluetoothManager.setBulkTransfer(conn, false);
+
+    uint8_t end[9];
+    end[0] = OP_END;
+    putLe32(end + 1, nextSeq);
+    putLe32(end + 5, records);
+    notifyControl(conn, end, sizeof(end));
+    ESP_LOGI(TAG, "Sent %u records up to %u", (unsigned)records, (unsigned)nextSeq);
+}
+
+void HistoryService::notifyControl(uint16_t conn, const uint8_t* value, size_t length) {
+    os_mbuf* om = historyMbuf(value, length);
+    if (om == nullptr || ble_gatts_notify_custom(conn, controlHandle, om) != 0) {
+        ESP_LOGW(TAG, "Control notification 0x%02x dropped", value[0]);
+    }
+}
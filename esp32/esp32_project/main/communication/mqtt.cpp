@@ -1,131 +1,489 @@
+// Backend-independent half of MQTTClient: topics, payload encoding,
+// batching and the QoS 1 window. The transport lives in mqtt_pubsub.cpp or
+// mqtt_esp.cpp, chosen by CONFIG_SMARTTANK_MQTT_BACKEND.
 #include "MqttClient.h"
-#include "WifiManager.h" // Include WiFiManager for connectivity checks
-#include "BluetoothManager.h" // Include BluetoothManager for fallback
 #include "../config.h" // Include configuration constants
-#include "PubSubClient.h"
+#include "../storage/DataQueue.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <Arduino.h>
 #include <ArduinoJson.h> // Include ArduinoJson for JSON handling
 
 
-extern BluetoothManager bluetoothManager; // Include BluetoothManager for fallback
-extern WiFiManager wifiManager;  // Add this line
+extern DataQueue dataQueue;
 
 MQTTClient::MQTTClient() : 
-    client(espClient),
     connected(false),
-    lastReconnectAttempt(0) {
+    lastReconnectAttempt(0),
+    retryDelayMs(0),
+    backoffMs(MQTT_BACKOFF_MIN_MS),
+    batchCount(0),
+    batchStartMs(0),
+    lastPumpStatus(false),
+    backlogFront(0),
+    backlogCount(0),
+    spillPending(false),
+    epoch(0),
+    commandCallback(nullptr),
+    pendingAckLength(0) {
     // Generate unique device ID using ESP32's MAC address
     deviceId = "smarttank_" + String((uint32_t)ESP.getEfuseMac(), HEX);
+    memset(&topics, 0, sizeof(topics));
+    memset(liveInflight, 0, sizeof(liveInflight));
+    memset(&stats, 0, sizeof(stats));
+    clientLock = xSemaphoreCreateMutexStatic(&clientLockBuffer);
+    initTransport();
 }
 
-void MQTTClient::begin(const char* mqttServer) {
-    // Setup MQTT client
-    client.setServer(mqttServer, 1883);
+void MQTTClient::createTopic(const char* suffix, char* out) {
+    snprintf(out, MQTT_TOPIC_SIZE, "smarttank/%s/%s", deviceId.c_str(), suffix);
+}
+
+void MQTTClient::buildTopics() {
+#if MQTT_PAYLOAD_CBOR
+    createTopic("data/cbor", topics.data);
+#else
+    createTopic("data", topics.data);
+#endif
+    createTopic("batch/cbor", topics.batch);
+    createTopic("backlog/cbor", topics.backlog);
+    createTopic("status", topics.status);
+    createTopic("command", topics.command);
+    createTopic("ack", topics.ack);
+    createTopic("alert", topics.alert);
+}
+
+size_t MQTTClient::createSensorJson(const SensorData& data, char* buf, size_t size) {
+    StaticJsonDocument<300> doc; // Increased size to accommodate all fields
+    
+    // Add all sensor data fields
+    doc["temperature"] = data.temperature;
+    doc["tdsValue"] = data.tdsValue;
+    doc["waterLevel"] = data.waterLevel;
+    doc["powerConsumption"] = data.powerConsumption;
+    doc["waterFlow"] = data.waterFlow;
+    doc["totalWaterUsed"] = data.totalWaterUsed;
+    doc["pumpStatus"] = data.pumpStatus;
+    doc["timestamp"] = data.lastUpdate;
+
+    if (measureJson(doc) >= size) {
+        return 0;
+    }
+    return serializeJson(doc, buf, size);
+}
+
+size_t MQTTClient::createSensorCbor(const SensorData& data, uint8_t* buf, size_t size) {
+    CborEncoder encoder, map;
+    cbor_encoder_init(&encoder, buf, size, 0);
+
+    int err = cbor_encoder_create_map(&encoder, &map, 9);
+    err |= cbor_encode_uint(&map, TK_VERSION);
+    err |= cbor_encode_uint(&map, TELEMETRY_SCHEMA_VERSION);
+    err |= cbor_encode_uint(&map, TK_TIMESTAMP);
+    err |= cbor_encode_uint(&map, data.lastUpdate);
+    err |= cbor_encode_uint(&map, TK_TEMPERATURE);
+    err |= cbor_encode_float(&map, data.temperature);
+    err |= cbor_encode_uint(&map, TK_TDS);
+    err |= cbor_encode_float(&map, data.tdsValue);
+    err |= cbor_encode_uint(&map, TK_WATER_LEVEL);
+    err |= cbor_encode_float(&map, data.waterLevel);
+    err |= cbor_encode_uint(&map, TK_POWER);
+    err |= cbor_encode_float(&map, data.powerConsumption);
+    err |= cbor_encode_uint(&map, TK_FLOW);
+    err |= cbor_encode_float(&map, data.waterFlow);
+    err |= cbor_encode_uint(&map, TK_TOTAL_WATER);
+    err |= cbor_encode_float(&map, data.totalWaterUsed);
+    err |= cbor_encode_uint(&map, TK_PUMP);
+    err |= cbor_encode_boolean(&map, data.pumpStatus);
+    err |= cbor_encoder_close_container(&encoder, &map);
+
+    if (err != CborNoError) {
+        return 0;
+    }
+    return cbor_encoder_get_buffer_size(&encoder, buf);
+}
+
+// Fixed-point fields of a reading in TELEMETRY_BATCH_SCALE units
+static void quantize(const SensorData& data, int64_t out[6]) {
+    const float values[6] = {
+        data.temperature, data.tdsValue, data.waterLevel,
+        data.powerConsumption, data.waterFlow, data.totalWaterUsed
+    };
+    for (size_t i = 0; i < 6; i++) {
+        out[i] = llroundf(values[i] * TELEMETRY_BATCH_SCALE[i]);
+    }
+}
+
+size_t MQTTClient::createBatchCbor(const SensorData* samples, size_t count, int64_t firstSeq,
+                                   uint8_t* buf, size_t size) {
+    CborEncoder encoder, map, list, sample;
+    cbor_encoder_init(&encoder, buf, size, 0);
+
+    int err = cbor_encoder_create_map(&encoder, &map, firstSeq < 0 ? 3 : 4);
+    err |= cbor_encode_uint(&map, TK_VERSION);
+    err |= cbor_encode_uint(&map, TELEMETRY_SCHEMA_VERSION);
+    if (firstSeq >= 0) {
+        err |= cbor_encode_uint(&map, TK_SEQUENCE);
+        err |= cbor_encode_uint(&map, firstSeq);
+    }
+    err |= cbor_encode_uint(&map, TK_TIMESTAMP);
+    err |= cbor_encode_uint(&map, samples[0].lastUpdate);
+    err |= cbor_encode_uint(&map, TK_SAMPLES);
+    err |= cbor_encoder_create_array(&map, &list, count);
+
+    int64_t previous[6] = {0};
+    uint32_t previousMs = samples[0].lastUpdate;
+    for (size_t i = 0; i < count; i++) {
+        int64_t current[6];
+        quantize(samples[i], current);
 
-    // Use a lambda function to wrap the non-static member function
-    client.setCallback([this](char* topic, uint8_t* payload, unsigned int length) {
-        this->callback(topic, payload, length); // Call the private callback method
-    });
+        err |= cbor_encoder_create_array(&list, &sample, 8);
+        err |= cbor_encode_uint(&sample, samples[i].lastUpdate - previousMs);
+        for (size_t f = 0; f < 6; f++) {
+            err |= cbor_encode_int(&sample, current[f] - previous[f]);
+            previous[f] = current[f];
+        }
+        err |= cbor_encode_boolean(&sample, samples[i].pumpStatus);
+        err |= cbor_encoder_close_container(&list, &sample);
+        previousMs = samples[i].lastUpdate;
+    }
 
-    // Initial connection attempt
-    reconnect();
+    err |= cbor_encoder_close_container(&map, &list);
+    err |= cbor_encoder_close_container(&encoder, &map);
+    if (err != CborNoError) {
+        return 0;
+    }
+    return cbor_encoder_get_buffer_size(&encoder, buf);
 }
 
-void MQTTClient::callback(char* topic, uint8_t* payload, unsigned int length) {
-    StaticJsonDocument<200> doc;
-    deserializeJson(doc, payload, length);
+void MQTTClient::publish(const SensorData& data) {
+#if MQTT_PAYLOAD_CBOR && MQTT_BATCH_SIZE > 1
+    // Compared against the last reading queued, not the batch tail, so a
+    // switch right after a flush still goes out at once
+    bool pumpChanged = data.pumpStatus != lastPumpStatus;
+    lastPumpStatus = data.pumpStatus;
+    if (batchCount == MQTT_BATCH_SIZE) {
+        // Previous flush failed; drop the oldest rather than the newest
+        memmove(batch, batch + 1, (MQTT_BATCH_SIZE - 1) * sizeof(SensorData));
+        batchCount--;
+    }
+    if (batchCount == 0) {
+        batchStartMs = millis();
+    }
+    batch[batchCount++] = data;
 
-    // Process commands here
-    const char* command = doc["command"];
-    if (command) {
-        // Handle different commands
-        Serial.printf("Received command: %s\n", command);
+    if (pumpChanged || batchCount == MQTT_BATCH_SIZE ||
+        millis() - batchStartMs >= MQTT_BATCH_MAX_AGE_MS) {
+        flush();
+    }
+#elif MQTT_PAYLOAD_CBOR
+    if (linkUp()) {
+        // ~50 bytes against ~200 for JSON, and nothing on the heap
+        uint8_t payload[TELEMETRY_CBOR_BUFFER];
+        size_t length = createSensorCbor(data, payload, sizeof(payload));
+        if (length == 0) {
+            ESP_LOGE("MQTT", "CBOR encode overflow");
+            return;
+        }
+        publishLocked(topics.data, payload, length);
     }
+#else
+    if (linkUp()) {
+        char payload[256];
+        size_t length = createSensorJson(data, payload, sizeof(payload));
+        if (length > 0) {
+            publishLocked(topics.data, (const uint8_t*)payload, length);
+        }
+    }
+#endif
 }
 
-void MQTTClient::attemptReconnect() {
-    this->reconnect(); // Call the private reconnect method
+void MQTTClient::tick() {
+#if MQTT_PAYLOAD_CBOR && MQTT_BATCH_SIZE > 1
+    if (batchCount > 0 && millis() - batchStartMs >= MQTT_BATCH_MAX_AGE_MS) {
+        flush();
+    }
+#endif
+}
+
+bool MQTTClient::flush() {
+    if (batchCount == 0) {
+        return true;
+    }
+    if (!linkUp()) {
+        return false;
+    }
+
+    uint8_t payload[TELEMETRY_BATCH_BUFFER];
+    size_t length = createBatchCbor(batch, batchCount, -1, payload, sizeof(payload));
+    if (length == 0) {
+        ESP_LOGE("MQTT", "CBOR batch overflow (%u samples)", (unsigned)batchCount);
+        batchCount = 0;
+        return false;
+    }
+
+    // The slot is claimed under the same lock as the send, so the PUBACK
+    // (handled in poll()) always finds it.
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    LiveInflight* slot = nullptr;
+    for (LiveInflight& entry : liveInflight) {
+        if (entry.packetId == 0 && entry.spill == SPILL_NONE) {
+            slot = &entry;
+            break;
+        }
+    }
+    uint16_t packetId = 0;
+    if (slot) {
+        MQTTIoVec iov = { payload, length };
+        packetId = sendLocked(topics.batch, &iov, 1, 1, false);
+    }
+    if (packetId != 0) {
+        slot->packetId = packetId;
+        slot->sentUs = esp_timer_get_time();
+        stats.published++;
+        stats.bytes += length;
+        slot->count = batchCount;
+        memcpy(slot->samples, batch, batchCount * sizeof(SensorData));
+        batchCount = 0;
+    }
+    xSemaphoreGive(clientLock);
+    return packetId != 0;
 }
 
-void MQTTClient::connect() {
-    if (!client.connected() && (millis() - lastReconnectAttempt > 5000)) {
-        lastReconnectAttempt = millis();
-        Serial.print("Attempting MQTT connection...");
-        if (client.connect(deviceId.c_str())) {
-            Serial.println("connected");
-            connected = true;
+size_t MQTTClient::publishBacklog(const SensorData* samples, size_t count, uint32_t firstSeq,
+                                  uint32_t nextHead, uint32_t expectedEpoch) {
+    if (count == 0 || !linkUp()) {
+        return 0;
+    }
 
-            // Subscribe to command topic
-            String commandTopic = createTopic("command");
-            client.subscribe(commandTopic.c_str());
+    // Shrink the run until it fits one packet
+    size_t requested = count;
+    uint8_t payload[TELEMETRY_BATCH_BUFFER];
+    size_t length = 0;
+    while (count > 0 &&
+           (length = createBatchCbor(samples, count, firstSeq, payload, sizeof(payload))) == 0) {
+        count /= 2;
+    }
+    if (length == 0) {
+        return 0;
+    }
 
-            // Publish online status
-            String statusTopic = createTopic("status");
-            client.publish(statusTopic.c_str(), "online", true);
-        } else {
-            Serial.print("failed, rc=");
-            Serial.println(client.state());
-            connected = false;
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    uint16_t packetId = 0;
+    // A cursor from before a reconnect would commit past resent records
+    if (expectedEpoch == epoch && backlogCount < MQTT_MAX_INFLIGHT) {
+        MQTTIoVec iov = { payload, length };
+        packetId = sendLocked(topics.backlog, &iov, 1, 1, false);
+    }
+    if (packetId != 0) {
+        BacklogInflight& entry = backlogInflight[(backlogFront + backlogCount) % MQTT_MAX_INFLIGHT];
+        entry.packetId = packetId;
+        entry.acked = false;
+        // A partial send completes the queue up to the last record sent. If
+        // corrupt records were skipped inside it this errs towards
+        // replaying a few readings, never towards losing any.
+        entry.nextHead = count == requested ? nextHead : firstSeq + count;
+        backlogCount++;
+    }
+    xSemaphoreGive(clientLock);
+    return packetId != 0 ? count : 0;
+}
 
-            // If WiFi has been down for too long, switch to BLE
-            if (!wifiManager.isConnected() && wifiManager.hasTimedOut()) {
-                Serial.println("WiFi unavailable, switching to BLE...");
-                bluetoothManager.startBLE();
+bool MQTTClient::takeBacklogAck(uint32_t& nextHead) {
+    bool found = false;
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    while (backlogCount > 0 && backlogInflight[backlogFront].acked) {
+        nextHead = backlogInflight[backlogFront].nextHead;
+        backlogFront = (backlogFront + 1) % MQTT_MAX_INFLIGHT;
+        backlogCount--;
+        found = true;
+    }
+    xSemaphoreGive(clientLock);
+    return found;
+}
+
+bool MQTTClient::canPublishBacklog() {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    bool room = linkUp() && inflightLocked() + BACKLOG_LIVE_RESERVE < MQTT_MAX_INFLIGHT;
+    xSemaphoreGive(clientLock);
+    return room;
+}
+
+size_t MQTTClient::getBacklogInflight() {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    size_t count = backlogCount;
+    xSemaphoreGive(clientLock);
+    return count;
+}
+
+size_t MQTTClient::inflightLocked() const {
+    size_t count = 0;
+    for (const LiveInflight& entry : liveInflight) {
+        count += entry.packetId != 0;
+    }
+    for (size_t i = 0; i < backlogCount; i++) {
+        count += !backlogInflight[(backlogFront + i) % MQTT_MAX_INFLIGHT].acked;
+    }
+    return count;
+}
+
+size_t MQTTClient::getInflightCount() {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    size_t count = inflightLocked();
+    xSemaphoreGive(clientLock);
+    return count;
+}
+
+MQTTClient::Stats MQTTClient::getStats() {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    Stats copy = stats;
+    xSemaphoreGive(clientLock);
+    return copy;
+}
+
+void MQTTClient::resetStats() {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    memset(&stats, 0, sizeof(stats));
+    xSemaphoreGive(clientLock);
+}
+
+void MQTTClient::onPubAck(uint16_t packetId) {
+    for (LiveInflight& entry : liveInflight) {
+        if (entry.packetId == packetId) {
+            entry.packetId = 0;
+            uint32_t latency = (uint32_t)(esp_timer_get_time() - entry.sentUs);
+            stats.acked++;
+            stats.ackLatencyUs += latency;
+            if (latency > stats.maxAckLatencyUs) {
+                stats.maxAckLatencyUs = latency;
             }
+            return;
+        }
+    }
+    for (size_t i = 0; i < backlogCount; i++) {
+        BacklogInflight& entry = backlogInflight[(backlogFront + i) % MQTT_MAX_INFLIGHT];
+        if (entry.packetId == packetId) {
+            entry.acked = true;
+            return;
         }
     }
 }
 
-String MQTTClient::createTopic(const char* suffix) {
-    return "smarttank/" + deviceId + "/" + suffix;
+void MQTTClient::markSpill(LiveInflight& entry) {
+    entry.packetId = 0;
+    entry.spill = SPILL_PENDING;
+    spillPending = true;
 }
 
-String MQTTClient::createSensorJson(const SensorData& data) {
-    StaticJsonDocument<300> doc; // Increased size to accommodate all fields
-    
-    // Add all sensor data fields
-    doc["temperature"] = data.temperature;
-    doc["tdsValue"] = data.tdsValue;
-    doc["waterLevel"] = data.waterLevel;
-    doc["powerConsumption"] = data.powerConsumption;
-    doc["waterFlow"] = data.waterFlow;
-    doc["totalWaterUsed"] = data.totalWaterUsed;
-    doc["pumpStatus"] = data.pumpStatus;
-    doc["timestamp"] = data.lastUpdate;
+void MQTTClient::writeSpills() {
+    if (!spillPending) {
+        return;
+    }
 
-    String jsonString;
-    serializeJson(doc, jsonString);
-    return jsonString;
+    // Claim the marked slots, so a second caller does not write them twice
+    static_assert(MQTT_MAX_INFLIGHT <= 32, "claimed is a 32-bit slot mask");
+    uint32_t claimed = 0;
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    spillPending = false;
+    for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (liveInflight[i].spill == SPILL_PENDING) {
+            liveInflight[i].spill = SPILL_WRITING;
+            claimed |= 1u << i;
+        }
+    }
+    xSemaphoreGive(clientLock);
+    if (claimed == 0) {
+        return;
+    }
+
+    size_t spilled = 0;
+    for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (claimed & (1u << i)) {
+            for (size_t s = 0; s < liveInflight[i].count; s++) {
+                spilled += dataQueue.enqueue(liveInflight[i].samples[s]);
+            }
+        }
+    }
+    ESP_LOGW("MQTT", "Spilled %u unacknowledged readings to the offline queue",
+             (unsigned)spilled);
+
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    for (size_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+        if (claimed & (1u << i)) {
+            liveInflight[i].spill = SPILL_NONE;
+        }
+    }
+    xSemaphoreGive(clientLock);
 }
 
-void MQTTClient::publish(const SensorData& data) {
-    if (client.connected()) {
-        String topic = createTopic("data");
-        String payload = createSensorJson(data);
-        client.publish(topic.c_str(), payload.c_str());
+void MQTTClient::dropBacklogInflight() {
+    // Acked backlog entries may still be waiting for takeBacklogAck(); the
+    // rest are still in the queue and will be resent from head.
+    size_t acked = 0;
+    while (acked < backlogCount &&
+           backlogInflight[(backlogFront + acked) % MQTT_MAX_INFLIGHT].acked) {
+        acked++;
     }
+    backlogCount = acked;
+    epoch++;
 }
 
-void MQTTClient::publishAlert(const char* message) {
-    if (client.connected()) {
-        DynamicJsonDocument doc(100); // Use DynamicJsonDocument instead of JsonDocument
-        doc["type"] = "alert";
-        doc["message"] = message;
-        doc["timestamp"] = millis();
+void MQTTClient::spillInflight() {
+    for (LiveInflight& entry : liveInflight) {
+        if (entry.packetId != 0) {
+            markSpill(entry);
+        }
+    }
+    dropBacklogInflight();
+    connected = false;
+}
 
-        String jsonString;
-        serializeJson(doc, jsonString);
-        String topic = createTopic("alert");
-        client.publish(topic.c_str(), jsonString.c_str());
+void MQTTClient::expireInflight(uint16_t packetId) {
+    for (LiveInflight& entry : liveInflight) {
+        if (entry.packetId == packetId) {
+            ESP_LOGW("MQTT", "Batch %u expired unacknowledged", (unsigned)packetId);
+            markSpill(entry);
+            return;
+        }
+    }
+    for (size_t i = 0; i < backlogCount; i++) {
+        if (backlogInflight[(backlogFront + i) % MQTT_MAX_INFLIGHT].packetId == packetId) {
+            dropBacklogInflight();
+            return;
+        }
     }
 }
 
-void MQTTClient::loop() {
-    if (!client.connected()) {
-        reconnect();
+bool MQTTClient::publishLocked(const char* topic, const MQTTIoVec* iov, size_t iovcnt, bool retained) {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    bool ok = sendLocked(topic, iov, iovcnt, 0, retained) != 0;
+    xSemaphoreGive(clientLock);
+    return ok;
+}
+
+bool MQTTClient::publishLocked(const char* topic, const uint8_t* payload, size_t length) {
+    MQTTIoVec iov = { payload, length };
+    return publishLocked(topic, &iov, 1);
+}
+
+size_t MQTTClient::takePending(SensorData* out, size_t max) {
+    size_t count = batchCount < max ? batchCount : max;
+    memcpy(out, batch, count * sizeof(SensorData));
+    batchCount = 0;
+    return count;
+}
+
+void MQTTClient::publishAlert(const char* message) {
+    if (linkUp()) {
+        StaticJsonDocument<128> doc;
+        doc["type"] = "alert";
+        doc["message"] = message;  // Stored as a pointer, not copied
+        doc["timestamp"] = millis();
+
+        char payload[256];
+        size_t length = serializeJson(doc, payload, sizeof(payload));
+        publishLocked(topics.alert, (const uint8_t*)payload, length);
     }
-    client.loop();
 }
 
 bool MQTTClient::isConnected() {
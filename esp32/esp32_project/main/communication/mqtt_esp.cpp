@@ -0,0 +1,167 @@
+#include "sdkconfig.h"
+#if CONFIG_SMARTTANK_MQTT_ESP_MQTT
+// MQTTClient transport on ESP-IDF's esp-mqtt. The client runs its own task,
+// reconnects by itself and keeps QoS 1 messages in its outbox until they
+// are acknowledged, resending them after a reconnect. Our live batches are
+// only spilled to flash once the outbox gives up on them.
+#include "MqttClient.h"
+#include "../config.h"
+#include "esp_log.h"
+#include <Arduino.h>
+#include <string.h>
+
+static const char* TAG = "MQTT";
+
+void MQTTClient::initTransport() {
+    handle = nullptr;
+    outboxEvents = xQueueCreateStatic(2 * MQTT_MAX_INFLIGHT, sizeof(OutboxEvent),
+                                      outboxEventsStorage, &outboxEventsBuffer);
+}
+
+bool MQTTClient::linkUp() {
+    return connected;
+}
+
+void MQTTClient::begin(const char* mqttServer, CommandCallback onCommand) {
+    commandCallback = onCommand;
+    buildTopics();
+
+    esp_mqtt_client_config_t cfg = {};
+    cfg.broker.address.hostname = mqttServer;
+    cfg.broker.address.port = MQTT_PORT;
+    cfg.broker.address.transport = MQTT_TRANSPORT_OVER_TCP;
+    cfg.credentials.client_id = deviceId.c_str();
+    cfg.network.timeout_ms = MQTT_SOCKET_TIMEOUT_S * 1000;
+    cfg.network.reconnect_timeout_ms = MQTT_BACKOFF_MIN_MS * 8;
+
+    handle = esp_mqtt_client_init(&cfg);
+    if (handle == nullptr) {
+        ESP_LOGE(TAG, "esp-mqtt init failed");
+        return;
+    }
+    esp_mqtt_client_register_event(handle, MQTT_EVENT_ANY, onMqttEvent, this);
+    if (esp_mqtt_client_start(handle) != ESP_OK) {
+        ESP_LOGE(TAG, "esp-mqtt start failed");
+    }
+}
+
+void MQTTClient::onMqttEvent(void* arg, esp_event_base_t base, int32_t id, void* data) {
+    MQTTClient* self = static_cast<MQTTClient*>(arg);
+    esp_mqtt_event_handle_t event = static_cast<esp_mqtt_event_handle_t>(data);
+
+    switch ((esp_mqtt_event_id_t)id) {
+        case MQTT_EVENT_CONNECTED:
+            ESP_LOGI(TAG, "connected");
+            esp_mqtt_client_subscribe(self->handle, self->topics.command, 0);
+            esp_mqtt_client_publish(self->handle, self->topics.status, "online", 0, 0, 1);
+            self->connected = true;
+            break;
+
+        case MQTT_EVENT_DISCONNECTED:
+            // Unacknowledged messages stay in the outbox for the next session
+            self->connected = false;
+            break;
+
+        case MQTT_EVENT_PUBLISHED:
+        case MQTT_EVENT_DELETED: {
+            OutboxEvent outbox = { (uint16_t)event->msg_id, id == MQTT_EVENT_PUBLISHED };
+            if (xQueueSend(self->outboxEvents, &outbox, 0) != pdTRUE) {
+                ESP_LOGW(TAG, "Outbox event %d dropped", event->msg_id);
+            }
+            break;
+        }
+
+        case MQTT_EVENT_DATA: {
+            // Commands are small; anything split across events is refused
+            bool whole = event->current_data_offset == 0 && event->data_len == event->total_data_len;
+            bool isCommand = event->topic_len == (int)strlen(self->topics.command) &&
+                             strncmp(event->topic, self->topics.command, event->topic_len) == 0;
+            if (self->commandCallback && whole && isCommand) {
+                // Parsed in place in the client's receive buffer; the API is
+                // re-entrant from its own task, so the ack goes out directly
+                char ack[COMMAND_ACK_SIZE];
+                size_t length = self->commandCallback(event->data, event->data_len, ack, sizeof(ack));
+                if (length > 0) {
+                    esp_mqtt_client_publish(self->handle, self->topics.ack, ack, length, 0, 0);
+                }
+            }
+            break;
+        }
+
+        case MQTT_EVENT_ERROR:
+            ESP_LOGW(TAG, "error, type %d", event->error_handle ? event->error_handle->error_type : -1);
+            break;
+
+        default:
+            break;
+    }
+}
+
+uint16_t MQTTClient::sendLocked(const char* topic, const MQTTIoVec* iov, size_t iovcnt,
+                                uint8_t qos, bool retained) {
+    if (handle == nullptr) {
+        return 0;
+    }
+
+    // esp-mqtt takes one contiguous payload
+    const char* payload = reinterpret_cast<const char*>(iov[0].data);
+    size_t length = iov[0].length;
+    char gathered[TELEMETRY_BATCH_BUFFER];
+    if (iovcnt > 1) {
+        length = 0;
+        for (size_t i = 0; i < iovcnt; i++) {
+            if (length + iov[i].length > sizeof(gathered)) {
+                return 0;
+            }
+            memcpy(gathered + length, iov[i].data, iov[i].length);
+            length += iov[i].length;
+        }
+        payload = gathered;
+    }
+
+    // Enqueued for the client task, so a slow socket never blocks the
+    // caller. Returns the message id, 0 for QoS 0, -1 on failure.
+    int msgId = esp_mqtt_client_enqueue(handle, topic, payload, length, qos, retained, true);
+    if (msgId < 0) {
+        return 0;
+    }
+    return qos == 0 ? 1 : (uint16_t)msgId;
+}
+
+void MQTTClient::attemptReconnect() {
+    this->connect();
+}
+
+void MQTTClient::connect() {
+    // esp-mqtt reconnects on its own every reconnect_timeout_ms
+}
+
+void MQTTClient::loop() {
+    poll();
+}
+
+uint32_t MQTTClient::msUntilRetry() const {
+    return MQTT_POLL_INTERVAL_MS;
+}
+
+bool MQTTClient::waitReadable(uint32_t timeoutMs) {
+    // The socket belongs to the client task; wait for acknowledgements instead
+    OutboxEvent next;
+    return xQueuePeek(outboxEvents, &next, pdMS_TO_TICKS(timeoutMs)) == pdTRUE;
+}
+
+void MQTTClient::poll() {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    OutboxEvent outbox;
+    while (xQueueReceive(outboxEvents, &outbox, 0) == pdTRUE) {
+        if (outbox.delivered) {
+            onPubAck(outbox.packetId);
+        } else {
+            expireInflight(outbox.packetId);
+        }
+    }
+    xSemaphoreGive(clientLock);
+    writeSpills();
+}
+
+#endif // CONFIG_SMARTTANK_MQTT_ESP_MQTT
@@ -0,0 +1,231 @@
+#include "sdkconfig.h"
+#if !CONFIG_SMARTTANK_MQTT_ESP_MQTT
+// MQTTClient transport on the vendored PubSubClient. Everything here runs
+// on the caller's task: the network task drives connect() and poll().
+#include "MqttClient.h"
+#include "../config.h"
+#include "esp_log.h"
+#include "esp_random.h"
+#include <sys/select.h>
+#include <Arduino.h>
+#include <string.h>
+
+#if CONFIG_SMARTTANK_MQTT5
+// Topic aliases; the broker's Topic Alias Maximum decides which are used
+enum TopicAliasId : uint16_t {
+    ALIAS_DATA = 1,
+    ALIAS_BATCH,
+    ALIAS_BACKLOG,
+    ALIAS_STATUS,
+    ALIAS_ACK,
+    ALIAS_ALERT
+};
+
+static size_t writeUtf8(const char* value, uint8_t* buf) {
+    size_t length = strlen(value);
+    buf[0] = length >> 8;
+    buf[1] = length & 0xFF;
+    memcpy(buf + 2, value, length);
+    return length + 2;
+}
+
+// User properties for the retained status message. The payload encoding
+// and schema are described once per connection instead of per message.
+static size_t writeStatusProperties(uint8_t* buf) {
+    char schema[8];
+    snprintf(schema, sizeof(schema), "%u", (unsigned)TELEMETRY_SCHEMA_VERSION);
+    const char* const properties[][2] = {
+        { "schema", schema },
+        { "encoding", MQTT_PAYLOAD_CBOR ? "cbor" : "json" },
+    };
+    size_t length = 0;
+    for (const auto& property : properties) {
+        buf[length++] = 0x26;  // User Property
+        length += writeUtf8(property[0], buf + length);
+        length += writeUtf8(property[1], buf + length);
+    }
+    return length;
+}
+#endif
+
+void MQTTClient::initTransport() {
+    client.setClient(espClient);
+}
+
+bool MQTTClient::linkUp() {
+    return client.connected();
+}
+
+uint16_t MQTTClient::sendLocked(const char* topic, const MQTTIoVec* iov, size_t iovcnt,
+                                uint8_t qos, bool retained) {
+    if (qos == 0) {
+        return client.publishv(topic, iov, iovcnt, retained) ? 1 : 0;
+    }
+    return client.publishQos1(topic, iov, iovcnt, retained);
+}
+
+void MQTTClient::begin(const char* mqttServer, CommandCallback onCommand) {
+    commandCallback = onCommand;
+
+    // Setup MQTT client
+#if CONFIG_SMARTTANK_MQTT_TLS
+    client.setServer(mqttServer, MQTT_TLS_PORT);
+#else
+    client.setServer(mqttServer, MQTT_PORT);
+#endif
+#if CONFIG_SMARTTANK_MQTT5
+    // After the first publish on a connection, each topic costs 2 bytes
+    // instead of its ~40 character name
+    client.setProtocolVersion(MQTT_VERSION_5);
+    buildTopics();
+    client.setTopicAlias(topics.data, ALIAS_DATA);
+    client.setTopicAlias(topics.batch, ALIAS_BATCH);
+    client.setTopicAlias(topics.backlog, ALIAS_BACKLOG);
+    client.setTopicAlias(topics.status, ALIAS_STATUS);
+    client.setTopicAlias(topics.ack, ALIAS_ACK);
+    client.setTopicAlias(topics.alert, ALIAS_ALERT);
+#endif
+    // Bound every blocking step of a connect so a dead broker costs
+    // seconds, not the library's 15 s defaults
+    espClient.setConnectionTimeout(MQTT_CONNECT_TIMEOUT_MS);
+    client.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+
+    // Use a lambda function to wrap the non-static member function
+    client.setCallback([this](char* topic, uint8_t* payload, unsigned int length) {
+        this->callback(topic, payload, length); // Call the private callback method
+    });
+    client.setPubAckCallback([this](uint16_t packetId, uint8_t reasonCode) {
+        if (reasonCode >= 0x80) {
+            // Refused by an MQTT 5 broker (e.g. quota exceeded): handled
+            // like an expired packet, so the readings are sent again later
+            ESP_LOGW("MQTT", "Packet %u refused, reason 0x%02x", (unsigned)packetId, reasonCode);
+            this->expireInflight(packetId);
+        } else {
+            this->onPubAck(packetId);
+        }
+    });
+
+    // Initial connection attempt
+    connect();
+}
+
+void MQTTClient::callback(char* topic, uint8_t* payload, unsigned int length) {
+    // Only the command topic is subscribed. The payload sits in the
+    // client's packet buffer and is parsed there without a copy.
+    if (commandCallback && strcmp(topic, topics.command) == 0) {
+        pendingAckLength = commandCallback(reinterpret_cast<char*>(payload), length,
+                                           pendingAck, sizeof(pendingAck));
+    }
+}
+
+void MQTTClient::attemptReconnect() {
+    this->connect();
+}
+
+void MQTTClient::connect() {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    if (!client.connected()) {
+        // The new session starts with an empty window
+        spillInflight();
+    }
+    if (!client.connected() && msUntilRetry() == 0) {
+        lastReconnectAttempt = millis();
+        Serial.print("Attempting MQTT connection...");
+        if (client.connect(deviceId.c_str())) {
+            Serial.println("connected");
+            connected = true;
+            backoffMs = MQTT_BACKOFF_MIN_MS;
+            retryDelayMs = 0;
+            buildTopics();
+
+            // Subscribe to command topic
+            client.subscribe(topics.command);
+
+            // Publish online status
+#if CONFIG_SMARTTANK_MQTT5
+            uint8_t properties[MQTT_STATUS_PROPERTIES_SIZE];
+            MQTTIoVec online = { reinterpret_cast<const uint8_t*>("online"), 6 };
+            client.publishv(topics.status, &online, 1, true, properties,
+                            writeStatusProperties(properties));
+#else
+            client.publish(topics.status, "online", true);
+#endif
+        } else {
+            Serial.print("failed, rc=");
+            Serial.println(client.state());
+            connected = false;
+#if CONFIG_SMARTTANK_MQTT5
+            // A 3.1.1-only broker refuses the protocol level (0x01 from a
+            // 3.1.1 broker, 0x84 from a 5.0 one); stay on 3.1.1 from then on
+            if (client.state() == MQTT_CONNECT_BAD_PROTOCOL || client.state() == 0x84) {
+                ESP_LOGW("MQTT", "Broker refused MQTT 5, falling back to 3.1.1");
+                client.setProtocolVersion(MQTT_VERSION);
+            }
+#endif
+
+            // Exponential backoff with "equal jitter": wait between half
+            // and all of the current bound so devices that lost the broker
+            // together do not come back in lockstep.
+            retryDelayMs = backoffMs / 2 + esp_random() % (backoffMs / 2 + 1);
+            backoffMs = backoffMs * 2 < MQTT_BACKOFF_MAX_MS ? backoffMs * 2 : MQTT_BACKOFF_MAX_MS;
+        }
+    }
+    xSemaphoreGive(clientLock);
+    writeSpills();
+}
+
+void MQTTClient::loop() {
+    if (!client.connected()) {
+        connect();
+    }
+    poll();
+}
+
+uint32_t MQTTClient::msUntilRetry() const {
+    uint32_t elapsed = millis() - lastReconnectAttempt;
+    return elapsed >= retryDelayMs ? 0 : retryDelayMs - elapsed;
+}
+
+bool MQTTClient::waitReadable(uint32_t timeoutMs) {
+    // The client may already hold bytes that select() cannot see (for
+    // TLS, records mbedtls has already decrypted)
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    int fd = espClient.fd();
+    bool buffered = fd >= 0 && espClient.available() > 0;
+    xSemaphoreGive(clientLock);
+    if (buffered) {
+        return true;
+    }
+    if (fd < 0) {
+        vTaskDelay(pdMS_TO_TICKS(timeoutMs));
+        return false;
+    }
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(fd, &readable);
+    struct timeval timeout = {
+        .tv_sec = (time_t)(timeoutMs / 1000),
+        .tv_usec = (suseconds_t)((timeoutMs % 1000) * 1000),
+    };
+    // A closed or failed socket also reports readable, so drops are
+    // noticed by the poll() that follows
+    return select(fd + 1, &readable, NULL, NULL, &timeout) > 0;
+}
+
+void MQTTClient::poll() {
+    xSemaphoreTake(clientLock, portMAX_DELAY);
+    client.loop();
+    if (pendingAckLength > 0) {
+        client.publish(topics.ack, reinterpret_cast<const uint8_t*>(pendingAck),
+                       pendingAckLength, false);
+        pendingAckLength = 0;
+    }
+    if (!client.connected()) {
+        connected = false;
+    }
+    xSemaphoreGive(clientLock);
+    writeSpills();
+}
+
+#endif // !CONFIG_SMARTTANK_MQTT_ESP_MQTT
@@ -0,0 +1,58 @@
+#include "ReportFilter.h"
+#include <math.h>
+#include <string.h>
+
+ReportFilter::ReportFilter() {
+    reset();
+    memset(&stats, 0, sizeof(stats));
+}
+
+void ReportFilter::reset() {
+    hasLast = false;
+    lastReportMs = 0;
+}
+
+static bool moved(float value, float reference, float deadband) {
+    // A sensor going to or from NaN (failed read) is a change worth sending
+    if (isnan(value) || isnan(reference)) {
+        return isnan(value) != isnan(reference);
+    }
+    return fabsf(value - reference) > deadband;
+}
+
+bool ReportFilter::shouldReport(const SensorData& data, const ReportPolicy& policy, uint32_t nowMs) {
+    stats.readings++;
+
+    bool report = !hasLast ||
+                  policy.heartbeatMs == 0 ||
+                  nowMs - lastReportMs >= policy.heartbeatMs ||
+                  data.pumpStatus != last.pumpStatus ||
+                  moved(data.temperature, last.temperature, policy.temperature) ||
+                  moved(data.tdsValue, last.tdsValue, policy.tds) ||
+                  moved(data.waterLevel, last.waterLevel, policy.waterLevel) ||
+                  moved(data.powerConsumption, last.powerConsumption, policy.power) ||
+                  moved(data.waterFlow, last.waterFlow, policy.flow) ||
+                  moved(data.totalWaterUsed, last.totalWaterUsed, policy.totalWater);
+    if (!report) {
+        return false;
+    }
+
+    last = data;
+    hasLast = true;
+    lastReportMs = nowMs;
+    stats.reported++;
+    return true;
+}
+
+bool ReportFilter::isValid(const ReportPolicy& policy) {
+    const float deadbands[] = {
+        policy.temperature, policy.tds, policy.waterLevel,
+        policy.power, policy.flow, policy.totalWater
+    };
+    for (float deadband : deadbands) {
+        if (!isfinite(deadband) || deadband < 0) {
+            return false;
+        }
+    }
+    return policy.heartbeatMs <= REPORT_HEARTBEAT_MAX_MS;
+}
@@ -0,0 +1,350 @@
+#include "TlsClient.h"
+#include "esp_attr.h"
+#include "esp_crt_bundle.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include <sys/select.h>
+#include <string.h>
+#if CONFIG_SMARTTANK_MQTT_TLS_SECURE_CERT
+#include "esp_secure_cert_read.h"
+#endif
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+// Serialized session for the first connect after a restart. RTC_NOINIT
+// keeps it across software resets and deep sleep; a power cycle leaves
+// garbage, which the magic and CRC reject.
+struct RtcSession {
+    uint32_t magic;
+    uint32_t hostCrc;
+    uint16_t port;
+    uint16_t length;
+    uint32_t crc;
+    uint8_t data[TLS_SESSION_CACHE_SIZE];
+};
+static constexpr uint32_t RTC_SESSION_MAGIC = 0x544c5331;  // "TLS1"
+RTC_NOINIT_ATTR static RtcSession rtcSession;
+
+static uint32_t hostCrc(const char* host) {
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(host), strlen(host));
+}
+#endif
+
+TlsClient::TlsClient() :
+    tls(nullptr),
+    open(false),
+    connectTimeoutMs(MQTT_CONNECT_TIMEOUT_MS),
+    rxLength(0),
+    rxPos(0) {
+    memset(&stats, 0, sizeof(stats));
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    session = nullptr;
+#endif
+}
+
+TlsClient::~TlsClient() {
+    stop();
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_free_client_session(session);
+#endif
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port) {
+    return connect(ip.toString().c_str(), port, connectTimeoutMs);
+}
+
+int TlsClient::connect(const char* host, uint16_t port) {
+    return connect(host, port, connectTimeoutMs);
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port, int32_t timeoutMs) {
+    return connect(ip.toString().c_str(), port, timeoutMs);
+}
+
+int TlsClient::connect(const char* host, uint16_t port, int32_t timeoutMs) {
+    stop();
+    tls = esp_tls_init();
+    if (tls == nullptr) {
+        ESP_LOGE(TAG, "esp_tls_init failed");
+        return 0;
+    }
+
+    esp_tls_cfg_t cfg = {};
+    cfg.timeout_ms = timeoutMs;
+    const char* ca = MQTT_TLS_CA_CERT;
+    if (ca != nullptr) {
+        cfg.cacert_buf = reinterpret_cast<const unsigned char*>(ca);
+        cfg.cacert_bytes = strlen(ca) + 1;
+    } else {
+        cfg.crt_bundle_attach = esp_crt_bundle_attach;
+    }
+    applyClientCertificate(cfg);
+
+    bool resuming = false;
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    if (session == nullptr) {
+        loadSession(host, port);
+    }
+    cfg.client_session = session;
+    resuming = session != nullptr;
+#endif
+
+    int64_t start = esp_timer_get_time();
+    int rc = esp_tls_conn_new_sync(host, strlen(host), port, &cfg, tls);
+    uint32_t elapsedUs = esp_timer_get_time() - start;
+    if (rc != 1) {
+        // Keep the session: a dropped link is no reason to pay for a full
+        // handshake next time, and a broker that refuses the session falls
+        // back to one by itself
+        stats.failures++;
+        ESP_LOGW(TAG, "Handshake with %s:%u failed", host, port);
+        esp_tls_conn_destroy(tls);
+        tls = nullptr;
+        return 0;
+    }
+
+    open = true;
+    rxLength = rxPos = 0;
+    if (resuming) {
+        stats.resumedHandshakes++;
+        stats.resumedUs += elapsedUs;
+    } else {
+        stats.fullHandshakes++;
+        stats.fullUs += elapsedUs;
+    }
+    ESP_LOGI(TAG, "%s handshake in %u ms", resuming ? "Resumed" : "Full",
+             (unsigned)(elapsedUs / 1000));
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    storeSession(host, port);
+#endif
+    return 1;
+}
+
+void TlsClient::applyClientCertificate(esp_tls_cfg_t& cfg) {
+#if CONFIG_SMARTTANK_MQTT_TLS_SECURE_CERT
+    // The partition is memory-mapped; the pointers stay valid for good
+    static char* cert = nullptr;
+    static uint32_t certLength = 0;
+    if (cert == nullptr && esp_secure_cert_get_device_cert(&cert, &certLength) != ESP_OK) {
+        ESP_LOGW(TAG, "No device certificate in esp_secure_cert");
+        cert = nullptr;
+        return;
+    }
+    cfg.clientcert_buf = reinterpret_cast<const unsigned char*>(cert);
+    cfg.clientcert_bytes = certLength;
+
+#if CONFIG_ESP_SECURE_CERT_DS_PERIPHERAL
+    static esp_ds_data_ctx_t* ds = esp_secure_cert_get_ds_ctx();
+    cfg.ds_data = ds;
+#else
+#if CONFIG_MBEDTLS_HARDWARE_ECDSA_SIGN && !CONFIG_ESP_SECURE_CERT_SUPPORT_LEGACY_FORMATS
+    // ECDSA key burnt into eFuse: the peripheral signs, the key never
+    // reaches RAM
+    esp_secure_cert_key_type_t keyType;
+    uint8_t efuseBlock;
+    if (esp_secure_cert_get_priv_key_type(&keyType) == ESP_OK &&
+        keyType == ESP_SECURE_CERT_ECDSA_PERIPHERAL_KEY &&
+        esp_secure_cert_get_priv_key_efuse_id(&efuseBlock) == ESP_OK) {
+        cfg.use_ecdsa_peripheral = true;
+        cfg.ecdsa_key_efuse_blk = efuseBlock;
+        return;
+    }
+#endif
+    static char* key = nullptr;
+    static uint32_t keyLength = 0;
+    if (key == nullptr && esp_secure_cert_get_priv_key(&key, &keyLength) != ESP_OK) {
+        ESP_LOGW(TAG, "No private key in esp_secure_cert");
+        key = nullptr;
+        cfg.clientcert_buf = nullptr;
+        cfg.clientcert_bytes = 0;
+        return;
+    }
+    cfg.clientkey_buf = reinterpret_cast<const unsigned char*>(key);
+    cfg.clientkey_bytes = keyLength;
+#endif
+#else
+    (void)cfg;
+#endif
+}
+
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+void TlsClient::loadSession(const char* host, uint16_t port) {
+    if (rtcSession.magic != RTC_SESSION_MAGIC ||
+        rtcSession.hostCrc != hostCrc(host) || rtcSession.port != port ||
+        rtcSession.length > sizeof(rtcSession.data) ||
+        rtcSession.crc != esp_rom_crc32_le(0, rtcSession.data, rtcSession.length)) {
+        return;
+    }
+
+    esp_tls_client_session_t* restored =
+        static_cast<esp_tls_client_session_t*>(calloc(1, sizeof(esp_tls_client_session_t)));
+    if (restored == nullptr) {
+        return;
+    }
+    mbedtls_ssl_session_init(&restored->saved_session);
+    if (mbedtls_ssl_session_load(&restored->saved_session, rtcSession.data, rtcSession.length) != 0) {
+        // Saved by a different mbedtls build or configuration
+        esp_tls_free_client_session(restored);
+        rtcSession.magic = 0;
+        return;
+    }
+    session = restored;
+}
+
+void TlsClient::storeSession(const char* host, uint16_t port) {
+    // The broker may have issued a new ticket, so take it every time
+    esp_tls_client_session_t* fresh = esp_tls_get_client_session(tls);
+    if (fresh == nullptr) {
+        return;
+    }
+    esp_tls_free_client_session(session);
+    session = fresh;
+
+    size_t length = 0;
+    rtcSession.magic = 0;
+    if (mbedtls_ssl_session_save(&session->saved_session, rtcSession.data,
+                                 sizeof(rtcSession.data), &length) != 0) {
+        // Resumption still works until the next restart
+        ESP_LOGW(TAG, "Session does not fit TLS_SESSION_CACHE_SIZE, kept in RAM only");
+        return;
+    }
+    rtcSession.hostCrc = hostCrc(host);
+    rtcSession.port = port;
+    rtcSession.length = length;
+    rtcSession.crc = esp_rom_crc32_le(0, rtcSession.data, length);
+    rtcSession.magic = RTC_SESSION_MAGIC;
+}
+#endif
+
+void TlsClient::clearSession() {
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+    esp_tls_free_client_session(session);
+    session = nullptr;
+    rtcSession.magic = 0;
+#endif
+}
+
+void TlsClient::resetStats() {
+    memset(&stats, 0, sizeof(stats));
+}
+
+int TlsClient::fd() const {
+    int sockfd = -1;
+    if (tls == nullptr || esp_tls_get_conn_sockfd(tls, &sockfd) != ESP_OK) {
+        return -1;
+    }
+    return sockfd;
+}
+
+bool TlsClient::socketReadable() const {
+    return waitSocket(true, 0);
+}
+
+bool TlsClient::waitSocket(bool readable, int64_t timeoutUs) const {
+    int sockfd = fd();
+    if (sockfd < 0) {
+        return false;
+    }
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sockfd, &fds);
+    struct timeval timeout = {
+        .tv_sec = (time_t)(timeoutUs / 1000000),
+        .tv_usec = (suseconds_t)(timeoutUs % 1000000),
+    };
+    return select(sockfd + 1, readable ? &fds : NULL, readable ? NULL : &fds, NULL, &timeout) > 0;
+}
+
+bool TlsClient::fill(bool block) {
+    if (rxPos < rxLength) {
+        return true;
+    }
+    if (!open) {
+        return false;
+    }
+    if (!block && esp_tls_get_bytes_avail(tls) <= 0 && !socketReadable()) {
+        return false;
+    }
+
+    ssize_t n = esp_tls_conn_read(tls, rxBuffer, sizeof(rxBuffer));
+    if (n == ESP_TLS_ERR_SSL_WANT_READ || n == ESP_TLS_ERR_SSL_WANT_WRITE) {
+        // Only handshake traffic (e.g. a new ticket), or the read timed out
+        return false;
+    }
+    if (n <= 0) {
+        // Closed by the broker or a TLS error
+        open = false;
+        return false;
+    }
+    rxLength = n;
+    rxPos = 0;
+    return true;
+}
+
+size_t TlsClient::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+size_t TlsClient::write(const uint8_t* buf, size_t size) {
+    size_t written = 0;
+    int64_t deadline = esp_timer_get_time() + (int64_t)connectTimeoutMs * 1000;
+    while (open && written < size) {
+        ssize_t n = esp_tls_conn_write(tls, buf + written, size - written);
+        if (n == ESP_TLS_ERR_SSL_WANT_READ || n == ESP_TLS_ERR_SSL_WANT_WRITE) {
+            // Send buffer full, or mbedtls needs the peer first: sleep on the
+            // socket instead of spinning, and give up on a stalled peer
+            int64_t left = deadline - esp_timer_get_time();
+            if (left <= 0 || !waitSocket(n == ESP_TLS_ERR_SSL_WANT_READ, left)) {
+                ESP_LOGW(TAG, "Write stalled, %u of %u bytes sent", (unsigned)written, (unsigned)size);
+                stop();
+                break;
+            }
+            continue;
+        }
+        if (n <= 0) {
+            open = false;
+            break;
+        }
+        written += n;
+    }
+    return written;
+}
+
+int TlsClient::available() {
+    return fill(false) ? rxLength - rxPos : 0;
+}
+
+int TlsClient::read() {
+    return fill(true) ? rxBuffer[rxPos++] : -1;
+}
+
+int TlsClient::read(uint8_t* buf, size_t size) {
+    if (!fill(true)) {
+        return -1;
+    }
+    size_t n = rxLength - rxPos < size ? rxLength - rxPos : size;
+    memcpy(buf, rxBuffer + rxPos, n);
+    rxPos += n;
+    return n;
+}
+
+int TlsClient::peek() {
+    return fill(false) ? rxBuffer[rxPos] : -1;
+}
+
+void TlsClient::flush() {
+    // esp_tls_conn_write() hands every record to the socket before returning
+}
+
+void TlsClient::stop() {
+    if (tls != nullptr) {
+        esp_tls_conn_destroy(tls);
+        tls = nullptr;
+    }
+    open = false;
+    rxLength = rxPos = 0;
+}
+
+uint8_t TlsClient::connected() {
+    return open || rxPos < rxLength;
+}
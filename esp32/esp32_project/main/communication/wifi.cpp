@@ -1,6 +1,10 @@
-#include "WiFiManager.h"
+#include "WifiManager.h"
 #include <WiFi.h>
 #include <esp_wifi.h> // if using ESP-IDF specific functions
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char* TAG = "WiFiManager";
 
 
 bool wifi_is_connected() {
@@ -9,10 +13,24 @@ bool wifi_is_connected() {
 // Constructor
 WiFiManager::WiFiManager() :
     apMode(false),
-    apStartTime(0) {}
+    apStartTime(0),
+    lastChangeUs(0) {
+    events = xEventGroupCreateStatic(&eventsBuffer);
+}
 
 void WiFiManager::begin() {
     preferences.begin("wifi-config", false);
+
+    // The Arduino WiFi layer creates the default loop too; whoever is
+    // first wins and the other gets ESP_ERR_INVALID_STATE.
+    esp_err_t err = esp_event_loop_create_default();
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Event loop unavailable: %s", esp_err_to_name(err));
+    }
+    esp_event_handler_instance_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED,
+                                        onWifiEvent, this, NULL);
+    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP,
+                                        onWifiEvent, this, NULL);
     
     // Try to connect using saved credentials
     if (!connectToSavedNetwork()) {
@@ -27,18 +45,32 @@ bool WiFiManager::connectToSavedNetwork() {
     return false;
 }
 
+void WiFiManager::onWifiEvent(void* arg, esp_event_base_t base, int32_t id, void* data) {
+    WiFiManager* manager = static_cast<WiFiManager*>(arg);
+    if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        manager->lastChangeUs = esp_timer_get_time();
+        xEventGroupSetBits(manager->events, CONNECTED_BIT | CHANGED_BIT);
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+        manager->lastChangeUs = esp_timer_get_time();
+        xEventGroupClearBits(manager->events, CONNECTED_BIT);
+        xEventGroupSetBits(manager->events, CHANGED_BIT);
+    }
+}
+
+bool WiFiManager::waitForEvent(TickType_t timeout) {
+    EventBits_t bits = xEventGroupWaitBits(events, CHANGED_BIT, pdTRUE, pdFALSE, timeout);
+    return (bits & CHANGED_BIT) != 0;
+}
+
 bool WiFiManager::connect(const char* ssid, const char* password) {
+    xEventGroupClearBits(events, CONNECTED_BIT);
     WiFi.mode(WIFI_STA);
     WiFi.begin(ssid, password);
-    
-    unsigned long startAttemptTime = millis();
-    
-    while (WiFi.status() != WL_CONNECTED && 
-           millis() - startAttemptTime < WIFI_TIMEOUT) {
-        delay(100);
-    }
-    
-    if (WiFi.status() == WL_CONNECTED) {
+
+    // Sleep until the GOT_IP event instead of polling WiFi.status()
+    xEventGroupWaitBits(events, CONNECTED_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(WIFI_TIMEOUT));
+
+    if (isConnected()) {
         saveCredentials(ssid, password);
         if (apMode) {
             stopAP();
@@ -105,7 +137,7 @@ void WiFiManager::handleClient() {
 }
 
 bool WiFiManager::isConnected() const {
-    return WiFi.status() == WL_CONNECTED;
+    return (xEventGroupGetBits(events) & CONNECTED_BIT) != 0;
 }
 
 bool WiFiManager::isAPMode() const {
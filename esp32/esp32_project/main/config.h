@@ -7,8 +7,54 @@
 #define WIFI_PASSWORD "wifipassword"
 #define MQTT_SERVER "192.168.10.12"
 #define MQTT_PORT 1883
+#define MQTT_TLS_PORT 8883              // Used with CONFIG_SMARTTANK_MQTT_TLS
+#define MQTT_TLS_CA_CERT nullptr        // PEM of a private broker CA; nullptr: certificate bundle
+#define TLS_RX_BUFFER_SIZE 256          // Decrypted bytes held for available()
+#define TLS_SESSION_CACHE_SIZE 2048     // RTC copy of the last session, peer certificate included
+#define TLS_BENCH_ROUNDS 10             // Handshakes of each kind in Test::benchmarkTls()
 #define MQTT_USER "mqtt_user"
 #define MQTT_PASSWORD "mqtt_password"
+#define MQTT_PAYLOAD_CBOR 1             // 1: CBOR telemetry on <topic>/cbor (server/src/mqtt/telemetry.ts), 0: JSON
+#define TELEMETRY_SCHEMA_VERSION 1      // Bump when TelemetryKey changes meaning
+#define TELEMETRY_CBOR_BUFFER 64        // Stack buffer for one encoded reading
+#define MQTT_BATCH_SIZE 10              // Readings per batched publish
+#define MQTT_BATCH_MAX_AGE_MS 30000     // Flush a partial batch after this long
+#define TELEMETRY_BATCH_BUFFER 448      // Stack buffer for one encoded batch
+#define MQTT_TOPIC_SIZE 48              // Longest precomputed topic
+#define MQTT_CONNECT_TIMEOUT_MS 2000    // TCP connect bound
+#define MQTT_SOCKET_TIMEOUT_S 3         // CONNACK / packet read bound
+#define MQTT_BACKOFF_MIN_MS 500         // First reconnect delay
+#define MQTT_BACKOFF_MAX_MS 60000       // Reconnect delay cap
+#define MQTT_POLL_INTERVAL_MS 1000      // Longest sleep on the socket (keepalive)
+#define MQTT_STATUS_PROPERTIES_SIZE 48  // MQTT 5 user properties on the status message
+#define MQTT_BENCH_BATCHES 200          // Batches sent by Test::benchmarkMqtt()
+#define MQTT_BENCH_TIMEOUT_MS 10000     // Wait for the last acks
+#define SELF_TEST_WIFI_WAIT_MS 30000    // Link wait before the tests (CONFIG_SMARTTANK_SELF_TEST)
+
+// ==================== COMMANDS ====================
+#define COMMAND_MAX_HANDLERS 8          // Actions in the dispatch table
+#define COMMAND_JSON_CAPACITY 256       // Node pool only, strings stay in the payload
+#define COMMAND_ACK_SIZE 96             // Longest {"id":..,"status":..} reply
+#define COMMAND_PUMP_MIN_INTERVAL_MS 2000   // Relay protection
+#define COMMAND_CONFIG_MIN_INTERVAL_MS 5000 // Each config command writes flash
+
+// ==================== REPORT BY EXCEPTION ====================
+// Defaults for DeviceConfig::report, changed with the config command
+#define REPORT_DEADBAND_TEMPERATURE 0.2f    // °C
+#define REPORT_DEADBAND_TDS 5.0f            // ppm
+#define REPORT_DEADBAND_LEVEL 1.0f          // %
+#define REPORT_DEADBAND_POWER 5.0f          // W
+#define REPORT_DEADBAND_FLOW 0.1f           // L/min
+#define REPORT_DEADBAND_TOTAL_WATER 1.0f    // L
+#define REPORT_HEARTBEAT_MS 300000          // Longest silence on a steady tank
+#define REPORT_HEARTBEAT_MAX_MS 3600000     // Upper bound accepted from the config command
+
+// ==================== OFFLINE BACKLOG ====================
+#define BACKLOG_BATCH_SIZE 24           // Queued readings per backlog publish
+#define BACKLOG_BATCH_INTERVAL_MS 20    // Pause while the QoS 1 window is full
+#define BACKLOG_LIVE_RESERVE 1          // QoS 1 window slots kept for live batches
+#define BACKLOG_RETRY_MS 2000           // Back-off after a failed publish
+#define BACKLOG_IDLE_MS 1000            // Poll interval while nothing to drain
 
 // ==================== HARDWARE PIN CONFIGURATION ====================
 #define TEMP_SENSOR_PIN 4       // DHT22 data pin
@@ -28,10 +74,42 @@ constexpr char DEVICE_NAME[] = "SmartTank";
 constexpr char SERVICE_UUID_STR[] = "4fafc201-1fb5-459e-8fcc-c5c9c331914b";
 constexpr char SENSOR_CHAR_UUID_STR[] = "beb5483e-36e1-4688-b7f5-ea07361b26a8";
 constexpr char CONTROL_CHAR_UUID_STR[] = "beb5483f-36e1-4688-b7f5-ea07361b26a8";
+constexpr char PACKED_CHAR_UUID_STR[] = "beb54840-36e1-4688-b7f5-ea07361b26a8";
+constexpr char HISTORY_SERVICE_UUID_STR[] = "4fafc202-1fb5-459e-8fcc-c5c9c331914b";
+constexpr char HISTORY_CONTROL_UUID_STR[] = "beb54841-36e1-4688-b7f5-ea07361b26a8";
+constexpr char HISTORY_DATA_UUID_STR[] = "beb54842-36e1-4688-b7f5-ea07361b26a8";
 constexpr uint16_t BLE_MTU_SIZE = 256;  // Maximum transmission unit size
+#define BLE_MAX_CONNECTIONS 3           // Centrals tracked for subscriptions (<= CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+#define BLE_NOTIFY_MBUF_COUNT 8         // Notification mbufs in flight across all connections
+#define BLE_PACKED_SAMPLE_SIZE 19       // Bytes per sample on the packed characteristic
+#define BLE_PACKED_BATCH_MAX 8          // Most samples in one packed notification
+#define BLE_LIVE_SAMPLE_MS 100          // Live sample period while the packed characteristic is subscribed
+#define BLE_LIVE_BATCH_MS 400           // Longest a live sample waits for its batch
+#define BLE_DATA_LEN_OCTETS 251         // LL payload asked for with Data Length Extension
+#define BLE_DATA_LEN_TIME_US 2120       // Airtime of 251 octets on the 1M PHY
+#define BLE_ADV_FAST_ITVL_MIN 0x20      // 20 ms right after boot, a button press or an alert (0.625 ms units)
+#define BLE_ADV_FAST_ITVL_MAX 0x30      // 30 ms
+#define BLE_ADV_FAST_WINDOW_MS 30000    // How long fast advertising lasts
+#define BLE_ADV_ITVL_MIN 0x290          // 410 ms afterwards while BLE is the only link
+#define BLE_ADV_ITVL_MAX 0x2B0          // 430 ms
+#define BLE_ADV_WIFI_ITVL_MIN 0x640     // 1 s while WiFi carries telemetry; 0 stops advertising
+#define BLE_ADV_WIFI_ITVL_MAX 0x780     // 1.2 s
+#define BLE_BUTTON_PIN 0                // BOOT button starts fast advertising; -1 if there is none
+#define BLE_BUTTON_DEBOUNCE_MS 250
+#define BLE_CONN_STREAM_ITVL_MIN 12     // 15 ms while live samples or history stream (1.25 ms units)
+#define BLE_CONN_STREAM_ITVL_MAX 24     // 30 ms
+#define BLE_CONN_STREAM_LATENCY 0
+#define BLE_CONN_IDLE_ITVL_MIN 80       // 100 ms while the app only reads now and then
+#define BLE_CONN_IDLE_ITVL_MAX 120      // 150 ms
+#define BLE_CONN_IDLE_LATENCY 4         // Connection events the device may skip with nothing to send
+#define BLE_CONN_SUPERVISION_TIMEOUT 500 // 5 s (10 ms units), > 2 * max interval * (latency + 1)
+#define BLE_CONN_IDLE_AFTER_MS 5000     // Central's parameters left alone while the app discovers
+#define HISTORY_RECORD_SIZE (4 + BLE_PACKED_SAMPLE_SIZE)  // Sequence number + packed sample
+#define HISTORY_MBUF_COUNT 6            // History notifications in flight
+#define HISTORY_MAX_CREDITS 255         // Notifications the app may grant ahead
 
 // ==================== OPERATIONAL PARAMETERS ====================
-#define SENSOR_READ_INTERVAL 2000     // Reduced from 5000ms for better responsiveness
+#define SENSOR_READ_INTERVAL 2000     // Telemetry publish interval (sensors sample on their own periods)
 #define MIN_WATER_LEVEL 20            // Minimum water level percentage
 #define MAX_WATER_LEVEL 90            // Maximum water level percentage
 #define MAX_TDS_THRESHOLD 500         // Changed from MIN_WATER_PURITY (now in ppm)
@@ -45,17 +123,60 @@ constexpr uint16_t BLE_MTU_SIZE = 256;  // Maximum transmission unit size
 #define TDS_SAMPLE_DELAY_MS          10      // Delay between TDS samples
 
 // Water Flow Sensor
-#define FLOW_SENSOR_DEBOUNCE_US      10000   // Minimum time between pulses (10ms)
-#define FLOW_UPDATE_INTERVAL_MS      1000    // Flow rate calculation interval
+#define FLOW_SENSOR_DEBOUNCE_US      10000   // Minimum time between pulses (10ms, ISR fallback only)
+#define FLOW_PCNT_GLITCH_NS          12000   // PCNT glitch filter (hardware max ~12.7us at 80MHz APB)
+#define FLOW_PCNT_HIGH_LIMIT         30000   // Counter overflows here into the driver accumulator
+#define FLOW_RATE_WINDOW             10      // update() intervals in the windowed rate
+#define FLOW_RATE_EWMA_ALPHA         0.3f    // Weight of the newest interval in the smoothed rate
+#define FLOW_INSTANT_MIN_PULSES      4       // Pulses needed before trusting an instant rate
 #define FLOW_CALIBRATION_FACTOR      7.5     // Default pulses per liter
 
 // Power Sensor
 #define POWER_SAMPLE_COUNT           20      // Number of power samples to average
 #define POWER_SAMPLE_DELAY_MS        1       // Delay between power samples
+#define MAINS_VOLTAGE_RMS            220.0f  // Nominal supply voltage for apparent power
+#define MAINS_FREQUENCY_HZ           50.0f   // Supply frequency, sets the RMS window length
+#define AC_POWER_WINDOW_CYCLES       5       // Whole mains cycles per RMS window
+#define AC_CURRENT_NOISE_FLOOR_A     0.05f   // RMS current below this reads as 0
+#define ADC_REFERENCE_VOLTAGE        3.3f    // Full-scale ADC voltage
+#define ADC_MAX_COUNT                4095.0f // Full-scale ADC count (12-bit)
+
+// ADC Continuous Sampler (TDS + power channels on ADC1)
+#define ADC_SAMPLER_FREQ_HZ          20000   // Total conversion rate, split across channels
+#define ADC_SAMPLER_FRAME_BYTES      256     // DMA conversion frame size
+#define ADC_SAMPLER_RING_SIZE        1024    // Samples kept per channel
 
 // Water Level Sensor
 #define WATER_LEVEL_TIMEOUT_US       23529   // ~4m max distance timeout (23529μs)
 #define WATER_LEVEL_PULSE_US         10      // Trigger pulse duration
+#define WATER_LEVEL_PING_INTERVAL_MS 30      // Hardware-triggered ping rate
+#define WATER_LEVEL_PING_HISTORY     5       // Pings kept for the median
+#define WATER_LEVEL_FILTER_WINDOW    7       // Median window over scheduled reads
+#define WATER_LEVEL_PROCESS_NOISE    0.01f   // Kalman Q, %^2 per read
+#define WATER_LEVEL_MEASURE_NOISE    1.0f    // Kalman R, %^2 after the median
+#define WATER_LEVEL_GATE_SIGMA       3.0f    // Reject innovations beyond this many sigma
+#define WATER_LEVEL_MIN_CONFIDENCE   0.5f    // Auto mode keeps the pump off below this
+#define SENSOR_FILTER_MAX_WINDOW     15      // Upper bound for any filter window
+
+// ==================== OFFLINE QUEUE ====================
+#define QUEUE_SEGMENT_COUNT          16      // Segment files in the SPIFFS ring log (640KB of the 1.9MB spiffs partition)
+#define QUEUE_SEGMENT_RECORDS        1024    // Fixed-size records per segment (~40KB)
+// Sensor Scheduler (period ms / deadline ms / cost budget us)
+#define WATER_LEVEL_PERIOD_MS        100     // 10 Hz for pump cutoff
+#define WATER_LEVEL_DEADLINE_MS      50
+#define WATER_LEVEL_BUDGET_US        500     // Echo is timed by RMT, read only takes the median
+#define FLOW_PERIOD_MS               1000
+#define FLOW_DEADLINE_MS             100
+#define FLOW_BUDGET_US               200
+#define POWER_PERIOD_MS              500
+#define POWER_DEADLINE_MS            250
+#define POWER_BUDGET_US              2000
+#define TDS_PERIOD_MS                1000
+#define TDS_DEADLINE_MS              500
+#define TDS_BUDGET_US                2000
+#define TEMP_PERIOD_MS               2000    // DHT22 cannot be read faster than 0.5 Hz
+#define TEMP_DEADLINE_MS             1000
+#define TEMP_BUDGET_US               30000
 // ==================== SENSOR THRESHOLDS ====================
 #define MAX_TEMP_THRESHOLD 40         // Maximum temperature in °C
 #define MIN_TEMP_THRESHOLD 5          // Minimum temperature in °C
@@ -64,6 +185,19 @@ constexpr uint16_t BLE_MTU_SIZE = 256;  // Maximum transmission unit size
 #define TDS_CALIBRATION_OFFSET 0      // TDS sensor calibration offset
 #define POWER_CALIBRATION_FACTOR 0.066 // 66mV/A for ACS712 30A module
 // ==================== DEVICE CONFIG STRUCTURE ====================
+// A reading is published when any field has moved more than its deadband
+// since the last published reading, the pump switches, or heartbeatMs
+// passes. heartbeatMs = 0 publishes every reading.
+struct ReportPolicy {
+    float temperature = REPORT_DEADBAND_TEMPERATURE;
+    float tds = REPORT_DEADBAND_TDS;
+    float waterLevel = REPORT_DEADBAND_LEVEL;
+    float power = REPORT_DEADBAND_POWER;
+    float flow = REPORT_DEADBAND_FLOW;
+    float totalWater = REPORT_DEADBAND_TOTAL_WATER;
+    uint32_t heartbeatMs = REPORT_HEARTBEAT_MS;
+};
+
 struct DeviceConfig {
     bool autoMode = true;
     float targetWaterLevel = 70.0;    // Default target level percentage
@@ -79,6 +213,7 @@ struct DeviceConfig {
     };
     bool notificationsEnabled = true;
     unsigned long cleaningSchedule = 604800000; // Weekly cleaning (7 days)
+    ReportPolicy report;
 };
 
 // ==================== DATA STRUCTURES ====================
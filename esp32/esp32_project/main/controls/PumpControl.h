@@ -21,6 +21,11 @@ public:
     void begin();
     bool setPumpState(bool state);
     bool getStatus();
+    // Auto mode: pumps while `level` is below `target`. Below
+    // WATER_LEVEL_MIN_CONFIDENCE the level is not trusted, so a running
+    // pump is stopped and a stopped one stays off. Returns whether the
+    // level was trusted.
+    bool autoControl(float level, float confidence, float target);
     unsigned long getTotalRuntime();
     unsigned long getDailyRuntime();
     void resetDailyRuntime();
@@ -55,6 +55,15 @@ bool PumpControl::checkSafetyConditions() {
     return true;
 }
 
+bool PumpControl::autoControl(float level, float confidence, float target) {
+    if (confidence < WATER_LEVEL_MIN_CONFIDENCE) {
+        setPumpState(false);
+        return false;
+    }
+    setPumpState(level < target);
+    return true;
+}
+
 bool PumpControl::getStatus() {
     return isRunning;
 }
@@ -12,11 +12,17 @@
 #include "communication/MqttClient.h"
 #include "communication/BluetoothManager.h"
 #include "communication/WifiManager.h"
+#include "communication/CommandDispatcher.h"
+#include "communication/ReportFilter.h"
+#include "communication/HistoryService.h"
+#include "communication/ConnectivityManager.h"
 #include "sensors/TemperatureSensor.h"
 #include "sensors/WaterLevelSensor.h"
 #include "sensors/TdsSensor.h"  // Changed from TurbiditySensor
 #include "sensors/PowerSensor.h"
 #include "sensors/WaterFlowSensor.h"  // Added new sensor
+#include "sensors/AdcSampler.h"
+#include "sensors/SensorScheduler.h"
 #include "controls/PumpControl.h"
 #include "storage/DataQueue.h"
 #include "storage/DataStorage.h"
@@ -24,6 +30,7 @@
 #include "utils/debug.h"
 #include "utils/error_handler.h"
 #include "utils/test.h"
+#include "utils/SeqLock.h"
 
 static const char* TAG = "SMART_TANK";
 
@@ -33,109 +40,312 @@ WaterLevelSensor waterLevelSensor(WATER_LEVEL_TRIG, WATER_LEVEL_ECHO);
 TdsSensor tdsSensor(TDS_SENSOR_PIN);  // Changed from TurbiditySensor
 PowerSensor powerSensor(POWER_SENSOR_PIN);
 WaterFlowSensor flowSensor(FLOW_SENSOR_PIN);  // Added
+AdcSampler adcSampler;
+SensorScheduler sensorScheduler;
 PumpControl pumpControl(PUMP_RELAY_PIN);
 DataStorage dataStorage;
+DataQueue dataQueue;
 MQTTClient mqttClient;
+WiFiManager wifiManager;
+CommandDispatcher commandDispatcher;
+ReportFilter reportFilter;
 BluetoothManager bluetoothManager;  // Added missing declaration
+HistoryService historyService(dataQueue);
+ConnectivityManager connectivityManager(bluetoothManager);
 
-SensorData currentData;
-DeviceConfig config;
+// Shared across tasks: readers get a consistent copy without locking
+SeqLock<SensorData> currentData;
+SeqLock<DeviceConfig> config;
 
-// Network Task
+// Network Task: sleeps on WiFi events while the link is down, on the
+// reconnect backoff while the broker is unreachable, and on the socket
+// while connected, so inbound commands are handled as soon as they arrive.
 void networkTask(void* pvParameters) {
+    bool wifiUp = false;
     while (1) {
-        wifi_ap_record_t ap_info;
-        esp_err_t err = esp_wifi_sta_get_ap_info(&ap_info);
+        bool linkUp = wifiManager.isConnected();
+        connectivityManager.update(linkUp, wifiManager.getLastChangeUs());
+        if (linkUp != wifiUp) {
+            wifiUp = linkUp;
+            if (wifiUp) {
+                ESP_LOGI(TAG, "WiFi connected, starting MQTT...");
+            } else {
+                ESP_LOGW(TAG, "WiFi disconnected, BLE is the only link");
+            }
+        }
 
-        if (err == ESP_OK) {
+        if (!wifiUp) {
+            wifiManager.waitForEvent(portMAX_DELAY);
+            continue;
+        }
+
+        if (!mqttClient.isConnected()) {
+            mqttClient.connect();
             if (!mqttClient.isConnected()) {
-                ESP_LOGI(TAG, "WiFi connected, starting MQTT...");
-                bluetoothManager.stopBLE();
-                mqttClient.connect();
+                // Wake early if the link drops during the backoff
+                wifiManager.waitForEvent(pdMS_TO_TICKS(mqttClient.msUntilRetry()));
             }
-        } else {
-            ESP_LOGW(TAG, "WiFi disconnected, switching to BLE...");
-            bluetoothManager.startBLE();
+            continue;
         }
 
-        mqttClient.loop();
-        vTaskDelay(pdMS_TO_TICKS(5000));
+        mqttClient.waitReadable(MQTT_POLL_INTERVAL_MS);
+        mqttClient.poll();
     }
 }
 
-void updateSensorData() {
-    float temp = tempSensor.readTemperature();
+// Scheduler jobs, each runs at its own rate on the scheduler task
+static float readTemperatureJob(void*) {
+    return tempSensor.readTemperature();
+}
+
+static float readTdsJob(void*) {
+    return tdsSensor.readTDS(sensorScheduler.values().get(SensorId::TEMPERATURE));
+}
+
+static float readWaterLevelJob(void*) {
+    return waterLevelSensor.readWaterLevel();
+}
+
+static float readPowerJob(void*) {
+    return powerSensor.readPowerConsumption();
+}
+
+static float readFlowJob(void*) {
+    flowSensor.update();
+    return flowSensor.getFlowRate();
+}
+
+// Replays readings queued while offline. Runs below the telemetry task so
+// live data always wins the client lock. Backlog batches are pipelined at
+// QoS 1 up to the inflight window; head is only committed once every batch
+// before it has been acknowledged, so a drop or power loss replays them.
+void backlogTask(void* pvParameters) {
+    static SensorData batch[BACKLOG_BATCH_SIZE];
+    uint32_t cursor = 0;
+    uint32_t epoch = 0;
+    bool haveCursor = false;
+    while (1) {
+        uint32_t ackedHead;
+        if (mqttClient.takeBacklogAck(ackedHead)) {
+            dataQueue.commit(ackedHead);
+        }
+
+        if (!mqttClient.isConnected()) {
+            vTaskDelay(pdMS_TO_TICKS(BACKLOG_IDLE_MS));
+            continue;
+        }
+
+        // The epoch moves when in-flight batches were dropped (e.g. by a
+        // disconnect); everything from head is sent again
+        if (!haveCursor || epoch != mqttClient.getConnectionEpoch()) {
+            epoch = mqttClient.getConnectionEpoch();
+            cursor = dataQueue.headSequence();
+            haveCursor = true;
+        }
+
+        bool waiting = mqttClient.getBacklogInflight() > 0;
+        if (cursor == dataQueue.tailSequence() || !mqttClient.canPublishBacklog()) {
+            if (waiting) {
+                mqttClient.poll();  // Pump PUBACKs
+            }
+            vTaskDelay(pdMS_TO_TICKS(waiting ? BACKLOG_BATCH_INTERVAL_MS : BACKLOG_IDLE_MS));
+            continue;
+        }
+
+        uint32_t firstSeq, nextHead;
+        size_t count = dataQueue.peek(cursor, batch, BACKLOG_BATCH_SIZE, firstSeq, nextHead);
+        if (count == 0) {
+            if (!waiting) {
+                dataQueue.commit(nextHead);  // Nothing but corrupt records
+            }
+            cursor = nextHead;
+            continue;
+        }
+
+        size_t sent = mqttClient.publishBacklog(batch, count, firstSeq, nextHead, epoch);
+        if (sent == 0) {
+            vTaskDelay(pdMS_TO_TICKS(BACKLOG_RETRY_MS));
+            continue;
+        }
+        // A partial send leaves the rest for the next peek
+        cursor = sent == count ? nextHead : firstSeq + sent;
+        mqttClient.poll();
+    }
+}
+
+// Latest value of every sensor, as the scheduler last sampled it
+static SensorData readSensors() {
+    const SensorValueTable& values = sensorScheduler.values();
     
-    currentData = {
-        .temperature = temp,
-        .tdsValue = tdsSensor.readTDS(temp),  // Changed from waterPurity
-        .waterLevel = waterLevelSensor.readWaterLevel(),
-        .powerConsumption = powerSensor.readPowerConsumption(),
-        .waterFlow = flowSensor.getFlowRate(),  // Added
+    SensorData data = {
+        .temperature = values.get(SensorId::TEMPERATURE),
+        .tdsValue = values.get(SensorId::TDS),  // Changed from waterPurity
+        .waterLevel = values.get(SensorId::WATER_LEVEL),
+        .powerConsumption = values.get(SensorId::POWER),
+        .waterFlow = values.get(SensorId::FLOW),  // Added
+        .totalWaterUsed = flowSensor.getTotalVolume(),
         .pumpStatus = pumpControl.getStatus(),
         .lastUpdate = esp_log_timestamp()
     };
+    return data;
+}
+
+void updateSensorData() {
+    SensorData data = readSensors();
+    currentData.write(data);
 
     // Calculate water cost monthly (example)
     static uint32_t lastCostCalc = 0;
     if (millis() - lastCostCalc > 2592000000) { // ~30 days
+        // Read and reset in one step so no pulses fall between billing periods.
+        // totalWaterUsed drops back to ~0 in the next reading; that drop is
+        // beyond any deadband and the batch deltas are signed, so it is
+        // reported like any other change.
         bluetoothManager.sendWaterCost(
-            flowSensor.getTotalVolume(),
-            config.costPerLiter
+            flowSensor.takeTotalVolume(),
+            config.read().costPerLiter
         );
-        flowSensor.resetTotalVolume();
         lastCostCalc = millis();
     }
 
+    // Unchanged readings go neither to the broker nor to the offline queue
+    bool report = reportFilter.shouldReport(data, config.read().report, millis());
+
     if (mqttClient.isConnected()) {
-        mqttClient.publish(currentData);
+        if (report) {
+            mqttClient.publish(data);
+        }
+        mqttClient.tick();
     } else {
-        bluetoothManager.updateSensorData(currentData);
+        // Readings batched before the link dropped go to the queue first
+        SensorData pending[MQTT_BATCH_SIZE];
+        size_t pendingCount = mqttClient.takePending(pending, MQTT_BATCH_SIZE);
+        for (size_t i = 0; i < pendingCount; i++) {
+            dataQueue.enqueue(pending[i]);
+        }
+
+        // Buffer offline readings so they can be uploaded later
+        if (report && !dataQueue.enqueue(data)) {
+            ESP_LOGW(TAG, "Offline queue full, reading dropped");
+        }
+        bluetoothManager.updateSensorData(data);
     }
 }
 
-void handleCommands(const char* command) {
-    StaticJsonDocument<256> doc;
-    DeserializationError error = deserializeJson(doc, command);
-    
-    if (error) {
-        ESP_LOGE(TAG, "Invalid command JSON");
-        return;
+// {"action":"pump","status":true}. A manual pump command takes the pump
+// out of auto mode, otherwise the auto task would undo it a moment later.
+static CommandStatus pumpCommand(JsonObjectConst command) {
+    JsonVariantConst status = command["status"];
+    if (!status.is<bool>()) {
+        return CommandStatus::BAD_REQUEST;
+    }
+
+    DeviceConfig cfg = config.read();
+    if (cfg.autoMode) {
+        cfg.autoMode = false;
+        config.write(cfg);
+        // Saved like a config command, or auto mode is back after a reboot
+        if (dataStorage.saveConfig(cfg) != DataStorage::StorageError::NONE) {
+            ESP_LOGW(TAG, "Auto mode off not saved");
+        }
+        ESP_LOGI(TAG, "Manual pump command, auto mode off");
     }
+    return pumpControl.setPumpState(status.as<bool>()) ? CommandStatus::OK : CommandStatus::FAILED;
+}
 
-    const char* action = doc["action"];
-    if (!action) return;
+// Relay protection: switching on within COMMAND_PUMP_MIN_INTERVAL_MS of the
+// last pump command (a repeat, or a quick off-on toggle) is refused, but
+// the pump can always be switched off.
+static bool pumpLimit(JsonObjectConst command) {
+    return command["status"] != false;
+}
 
-    if (strcmp(action, "pump") == 0) {
-        bool status = doc["status"];
-        pumpControl.setPumpState(status);
-    } 
-    else if (strcmp(action, "config") == 0) {
-        config.autoMode = doc["autoMode"];
-        config.targetWaterLevel = doc["targetLevel"];
-        config.costPerLiter = doc["costPerLiter"];  // Added
-        dataStorage.saveConfig(config);
+// {"action":"config", ...}; fields that are left out keep their value.
+// Report-by-exception: "deadband":{"temperature":0.2,"tds":5,"level":1,
+// "power":5,"flow":0.1,"totalWater":1} and "heartbeatS":300.
+static CommandStatus configCommand(JsonObjectConst command) {
+    DeviceConfig updated = config.read();
+    if (command["autoMode"].is<bool>()) {
+        updated.autoMode = command["autoMode"];
+    }
+    if (command["targetLevel"].is<float>()) {
+        updated.targetWaterLevel = command["targetLevel"];
+    }
+    if (command["costPerLiter"].is<float>()) {
+        float cost = command["costPerLiter"];
+        if (cost <= 0) {
+            return CommandStatus::BAD_REQUEST;
+        }
+        updated.costPerLiter = cost;
     }
 
-    // Acknowledge command
-    if (mqttClient.isConnected()) {
-        mqttClient.publishAlert("CMD_ACK: " + String(command));
+    JsonObjectConst deadband = command["deadband"];
+    const struct {
+        const char* key;
+        float* value;
+    } deadbands[] = {
+        { "temperature", &updated.report.temperature },
+        { "tds", &updated.report.tds },
+        { "level", &updated.report.waterLevel },
+        { "power", &updated.report.power },
+        { "flow", &updated.report.flow },
+        { "totalWater", &updated.report.totalWater },
+    };
+    for (const auto& field : deadbands) {
+        if (deadband[field.key].is<float>()) {
+            *field.value = deadband[field.key];
+        }
+    }
+    if (command["heartbeatS"].is<uint32_t>()) {
+        uint32_t heartbeatS = command["heartbeatS"];
+        if (heartbeatS > REPORT_HEARTBEAT_MAX_MS / 1000) {
+            return CommandStatus::BAD_REQUEST;
+        }
+        updated.report.heartbeatMs = heartbeatS * 1000;
     }
+    if (!ReportFilter::isValid(updated.report)) {
+        return CommandStatus::BAD_REQUEST;
+    }
+
+    config.write(updated);
+    return dataStorage.saveConfig(updated) == DataStorage::StorageError::NONE ?
+           CommandStatus::OK : CommandStatus::FAILED;
+}
+
+size_t handleCommands(char* payload, size_t length, char* ack, size_t ackSize) {
+    return commandDispatcher.dispatch(payload, length, ack, ackSize);
 }
 
 void checkAlerts() {
-    if (currentData.waterLevel < MIN_WATER_LEVEL) {
-        bluetoothManager.sendAlert("LOW_LEVEL:" + String(currentData.waterLevel));
+    SensorData data = currentData.read();
+    bool alert = false;
+    if (data.waterLevel < MIN_WATER_LEVEL) {
+        bluetoothManager.sendAlert("LOW_LEVEL:" + String(data.waterLevel));
+        alert = true;
+    }
+    if (data.temperature > MAX_TEMP_THRESHOLD) {
+        bluetoothManager.sendAlert("HIGH_TEMP:" + String(data.temperature));
+        alert = true;
     }
-    if (currentData.temperature > MAX_TEMP_THRESHOLD) {
-        bluetoothManager.sendAlert("HIGH_TEMP:" + String(currentData.temperature));
+    if (data.tdsValue > MAX_TDS_THRESHOLD) {  // Changed from purity check
+        bluetoothManager.sendAlert("HIGH_TDS:" + String(data.tdsValue));
+        alert = true;
     }
-    if (currentData.tdsValue > MAX_TDS_THRESHOLD) {  // Changed from purity check
-        bluetoothManager.sendAlert("HIGH_TDS:" + String(currentData.tdsValue));
+
+    // Only when an alert starts: push out the readings that explain it
+    // rather than holding them back in a batch, and let a nearby phone
+    // find the tank quickly. An ongoing alert batches as usual.
+    static bool alerting = false;
+    if (alert && !alerting) {
+        if (mqttClient.isConnected()) {
+            mqttClient.flush();
+        }
+        connectivityManager.boost();
     }
+    alerting = alert;
 }
 
-void sensorTask(void* pvParameters) {
+void telemetryTask(void* pvParameters) {
     while (1) {
         updateSensorData();
         checkAlerts();
@@ -143,17 +353,63 @@ void sensorTask(void* pvParameters) {
     }
 }
 
+// Live samples for the packed BLE characteristic, only while an app is
+// subscribed to it. Samples go out in batches, so the radio wakes a few
+// times a second rather than on every sample.
+void bleLiveTask(void* pvParameters) {
+    TickType_t lastWake = xTaskGetTickCount();
+    while (1) {
+        if (!bluetoothManager.isStreaming()) {
+            // Moves connections that went quiet to the idle parameters
+            bluetoothManager.updateConnectionParams();
+            vTaskDelay(pdMS_TO_TICKS(SENSOR_READ_INTERVAL));
+            lastWake = xTaskGetTickCount();
+            continue;
+        }
+        bluetoothManager.addLiveSample(readSensors());
+        vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(BLE_LIVE_SAMPLE_MS));
+    }
+}
+
+#if CONFIG_SMARTTANK_SELF_TEST
+// Test build: the tests drive the pump and poll the MQTT client
+// themselves, so they run instead of the application tasks
+void selfTestTask(void* pvParameters) {
+    // The MQTT benchmark is skipped if the broker stays out of reach
+    if (!wifiManager.isConnected()) {
+        wifiManager.waitForEvent(pdMS_TO_TICKS(SELF_TEST_WIFI_WAIT_MS));
+    }
+    if (wifiManager.isConnected()) {
+        mqttClient.connect();
+    }
+    Test::runAllTests();
+    vTaskDelete(NULL);
+}
+#endif
+
 void autoModeTask(void* pvParameters) {
+    bool levelLost = false;
     while (1) {
-        if (config.autoMode) {
-            bool shouldPump = currentData.waterLevel < config.targetWaterLevel;
-            
-            if (shouldPump != pumpControl.getStatus()) {
-                pumpControl.setPumpState(shouldPump);
-                ESP_LOGI(TAG, "Auto %s pump", shouldPump ? "starting" : "stopping");
+        DeviceConfig cfg = config.read();
+        if (cfg.autoMode) {
+            // Latest level straight from the scheduler, not the 2s telemetry snapshot
+            float level = sensorScheduler.values().get(SensorId::WATER_LEVEL);
+            bool wasRunning = pumpControl.getStatus();
+            // Too many rejected pings to trust the level: the pump is held off
+            // so a dead sensor cannot overflow the tank
+            bool trusted = pumpControl.autoControl(level, waterLevelSensor.getConfidence(),
+                                                   cfg.targetWaterLevel);
+            if (!trusted && !levelLost) {
+                ESP_LOGW(TAG, "Water level unreliable, auto mode holds the pump off");
+                bluetoothManager.sendAlert("LEVEL_SENSOR_FAULT");
+            }
+            levelLost = !trusted;
+
+            if (pumpControl.getStatus() != wasRunning) {
+                ESP_LOGI(TAG, "Auto %s pump", wasRunning ? "stopping" : "starting");
             }
         }
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        vTaskDelay(pdMS_TO_TICKS(WATER_LEVEL_PERIOD_MS));
     }
 }
 
@@ -175,17 +431,33 @@ extern "C" void app_main() {
     powerSensor.begin();
     flowSensor.begin();  // Added
 
+    // Start background ADC sampling for the channels registered above
+    if (!adcSampler.start()) {
+        ESP_LOGW(TAG, "ADC sampler unavailable, using blocking reads");
+    }
+
     // Control Initialization
     pumpControl.begin();
 
+    // Offline buffer
+    if (!dataQueue.begin()) {
+        ESP_LOGW(TAG, "Offline queue unavailable");
+    }
+
     // Communication
+    commandDispatcher.addHandler("pump", pumpCommand, COMMAND_PUMP_MIN_INTERVAL_MS, pumpLimit);
+    commandDispatcher.addHandler("config", configCommand, COMMAND_CONFIG_MIN_INTERVAL_MS);
     bluetoothManager.begin(handleCommands);
+    if (!historyService.begin()) {
+        ESP_LOGW(TAG, "BLE history download unavailable");
+    }
+    bluetoothManager.startHost();
+    connectivityManager.begin(BLE_BUTTON_PIN);
     wifiManager.begin();  // Added missing WiFi init
-    mqttClient.begin(MQTT_SERVER);
+    mqttClient.begin(MQTT_SERVER, handleCommands);
 
     // Load configuration
 // Initialize Data Storage with enhanced error handling
-DataStorage dataStorage;
 DataStorage::StorageError storageErr = dataStorage.begin();
 if (storageErr != DataStorage::StorageError::NONE) {
     ESP_LOGE(TAG, "Storage initialization failed: %s", 
@@ -196,35 +468,59 @@ if (storageErr != DataStorage::StorageError::NONE) {
 }
 
 // Load configuration with fallback to defaults
-DeviceConfig config;
-storageErr = dataStorage.loadConfig(config);
+DeviceConfig loadedConfig;
+storageErr = dataStorage.loadConfig(loadedConfig);
 if (storageErr != DataStorage::StorageError::NONE) {
     ESP_LOGW(TAG, "Using default config due to load error: %s", 
             dataStorage.getErrorString(storageErr));
-    config = DeviceConfig(); // Initialize with defaults
+    loadedConfig = DeviceConfig(); // Initialize with defaults
     
     // Set safe defaults explicitly
-    config.autoMode = true;
-    config.targetWaterLevel = 70.0f;
-    config.costPerLiter = 0.002f;
-    config.notificationsEnabled = true;
+    loadedConfig.autoMode = true;
+    loadedConfig.targetWaterLevel = 70.0f;
+    loadedConfig.costPerLiter = 0.002f;
+    loadedConfig.notificationsEnabled = true;
     
     // Attempt to save defaults
-    if (dataStorage.saveConfig(config) != DataStorage::StorageError::NONE) {
+    if (dataStorage.saveConfig(loadedConfig) != DataStorage::StorageError::NONE) {
         ESP_LOGW(TAG, "Failed to save default config");
     }
 }
 
 // Verify critical configuration values
-if (config.costPerLiter <= 0) {
-    ESP_LOGW(TAG, "Invalid cost per liter (%.4f), using default", config.costPerLiter);
-    config.costPerLiter = 0.002f;
+if (loadedConfig.costPerLiter <= 0) {
+    ESP_LOGW(TAG, "Invalid cost per liter (%.4f), using default", loadedConfig.costPerLiter);
+    loadedConfig.costPerLiter = 0.002f;
 }
+config.write(loadedConfig);
+
+    // Per-sensor sampling rates
+    sensorScheduler.addSensor(SensorId::WATER_LEVEL, "level", readWaterLevelJob, NULL,
+                              WATER_LEVEL_PERIOD_MS, WATER_LEVEL_DEADLINE_MS, WATER_LEVEL_BUDGET_US);
+    sensorScheduler.addSensor(SensorId::FLOW, "flow", readFlowJob, NULL,
+                              FLOW_PERIOD_MS, FLOW_DEADLINE_MS, FLOW_BUDGET_US);
+    sensorScheduler.addSensor(SensorId::POWER, "power", readPowerJob, NULL,
+                              POWER_PERIOD_MS, POWER_DEADLINE_MS, POWER_BUDGET_US);
+    sensorScheduler.addSensor(SensorId::TDS, "tds", readTdsJob, NULL,
+                              TDS_PERIOD_MS, TDS_DEADLINE_MS, TDS_BUDGET_US);
+    sensorScheduler.addSensor(SensorId::TEMPERATURE, "temp", readTemperatureJob, NULL,
+                              TEMP_PERIOD_MS, TEMP_DEADLINE_MS, TEMP_BUDGET_US);
+
+#if CONFIG_SMARTTANK_SELF_TEST
+    xTaskCreate(selfTestTask, "SelfTestTask", 8192, NULL, 1, NULL);
+    ESP_LOGW(TAG, "Self-test build, application tasks not started");
+    return;
+#endif
 
     // Create tasks
-    xTaskCreate(sensorTask, "SensorTask", 8192, NULL, 2, NULL);
+    if (!sensorScheduler.start()) {
+        ESP_LOGE(TAG, "Sensor scheduler failed to start");
+    }
+    xTaskCreate(telemetryTask, "TelemetryTask", 8192, NULL, 2, NULL);
     xTaskCreate(networkTask, "NetworkTask", 8192, NULL, 3, NULL);
     xTaskCreate(autoModeTask, "AutoModeTask", 4096, NULL, 1, NULL);
+    xTaskCreate(backlogTask, "BacklogTask", 6144, NULL, 1, NULL);
+    xTaskCreate(bleLiveTask, "BleLiveTask", 4096, NULL, 1, NULL);
 
     ESP_LOGI(TAG, "System initialized");
 }
\ No newline at end of file
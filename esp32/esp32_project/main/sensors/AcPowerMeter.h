@@ -0,0 +1,50 @@
+#ifndef AC_POWER_METER_H
+#define AC_POWER_METER_H
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "../config.h"
+
+/**
+ * True-RMS current and apparent power from a window of raw ACS712 samples.
+ *
+ * Pure computation with no Arduino or driver dependencies, so it can be
+ * fed synthetic waveforms in tests. Windows should span a whole number of
+ * mains cycles (see windowSamples()) or the RMS value will ripple.
+ */
+class AcPowerMeter {
+public:
+    static constexpr size_t MAX_WINDOW = ADC_SAMPLER_RING_SIZE;
+
+    /**
+     * @param sensitivity ACS712 output in volts per amp
+     * @param lineVoltage Nominal mains RMS voltage used for apparent power
+     */
+    AcPowerMeter(float sensitivity = POWER_CALIBRATION_FACTOR,
+                 float lineVoltage = MAINS_VOLTAGE_RMS);
+
+    // Largest whole-cycle window that fits in MAX_WINDOW at this sample rate
+    static size_t windowSamples(float sampleRateHz, float mainsHz = MAINS_FREQUENCY_HZ);
+
+    // Returns false if the window is empty or larger than MAX_WINDOW
+    bool processWindow(const uint16_t* raw, size_t count);
+    // Adds `watts` sustained over `seconds` to the energy total
+    void accumulate(float watts, float seconds);
+
+    float getRmsCurrent() const { return rmsCurrent; }
+    float getApparentPower() const { return rmsCurrent * lineVoltage; }
+    float getOffsetVoltage() const { return offsetVoltage; }
+    float getEnergyKWh() const { return energyKWh; }
+    void resetEnergy() { energyKWh = 0; }
+
+private:
+    const float sensitivity;
+    const float lineVoltage;
+
+    float samples[MAX_WINDOW];
+    float rmsCurrent;
+    float offsetVoltage;
+    float energyKWh;
+};
+
+#endif // AC_POWER_METER_H
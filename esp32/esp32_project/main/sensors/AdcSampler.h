@@ -0,0 +1,69 @@
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+#pragma once
+#include <Arduino.h>
+#include "esp_adc/adc_continuous.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "../config.h"
+
+/**
+ * Background ADC1 sampler built on the IDF continuous (DMA) driver.
+ *
+ * Sensors register their pin with addChannel() before start(). A worker
+ * task drains conversion frames into a ring buffer per channel and keeps
+ * a running sum, so getAverage() is O(1) and never touches the ADC.
+ */
+class AdcSampler {
+public:
+    static constexpr int MAX_CHANNELS = 4;
+    static constexpr size_t RING_SIZE = ADC_SAMPLER_RING_SIZE;
+
+    AdcSampler();
+
+    // Returns a slot id for the pin, or -1 if the pin is not on ADC1
+    int addChannel(uint8_t pin);
+    bool start();
+    void stop();
+    bool isRunning() const { return running; }
+
+    // Mean raw count (0-4095) over the ring window
+    float getAverage(int slot) const;
+    // Copies the newest `count` raw samples in chronological order, returns samples copied
+    size_t getSamples(int slot, uint16_t* out, size_t count) const;
+    // Per-channel sample rate in Hz
+    uint32_t getChannelRate() const;
+    uint32_t getOverflowCount() const { return overflows; }
+
+private:
+    struct Channel {
+        adc_channel_t channel;
+        uint16_t ring[RING_SIZE];
+        size_t head;     // Next write position
+        size_t count;    // Valid samples, saturates at RING_SIZE
+        uint32_t sum;    // Running sum of the valid samples
+    };
+
+    Channel channels[MAX_CHANNELS];
+    int8_t slotForChannel[SOC_ADC_MAX_CHANNEL_NUM];
+    int channelCount;
+
+    adc_continuous_handle_t handle;
+    TaskHandle_t taskHandle;
+    bool running;
+    volatile uint32_t overflows;
+    mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    void processFrame(const uint8_t* frame, uint32_t length);
+    static void samplerTask(void* arg);
+    static bool IRAM_ATTR onConvDone(adc_continuous_handle_t handle,
+                                     const adc_continuous_evt_data_t* edata,
+                                     void* userData);
+    static bool IRAM_ATTR onPoolOverflow(adc_continuous_handle_t handle,
+                                         const adc_continuous_evt_data_t* edata,
+                                         void* userData);
+};
+
+extern AdcSampler adcSampler;
+
+#endif // ADC_SAMPLER_H
@@ -3,24 +3,31 @@
 #pragma once
 #include <Arduino.h>
 #include "../config.h"
+#include "AcPowerMeter.h"
 
 class PowerSensor {
 private:
     uint8_t pin;
+    int adcSlot;  // AdcSampler slot, -1 falls back to analogRead
     float lastValidReading;
     uint8_t errorCount;
     
+    AcPowerMeter meter;
+    uint16_t window[AcPowerMeter::MAX_WINDOW];
+    
+    bool readRmsPower(float& power);
+    float readAverageRaw();
     float calculatePower(float voltage);
     bool isReadingValid(float reading);
-    float totalEnergy = 0;  // kWh
     uint32_t lastUpdate = 0;
 public:
     PowerSensor(uint8_t pin);
     void begin();
     float readPowerConsumption();
     float getLastValidReading();
-    float getEnergyKWh() { return totalEnergy; }
-    void resetEnergy() { totalEnergy = 0; lastUpdate = millis(); }
+    float getRmsCurrent() const { return meter.getRmsCurrent(); }
+    float getEnergyKWh() const { return meter.getEnergyKWh(); }
+    void resetEnergy() { meter.resetEnergy(); lastUpdate = millis(); }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,68 @@
+#ifndef SENSOR_FILTER_H
+#define SENSOR_FILTER_H
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "../config.h"
+
+/**
+ * Sliding median followed by a scalar Kalman filter.
+ *
+ * The median removes single-ping spikes; the Kalman stage smooths what is
+ * left and gates measurements whose innovation is beyond gateSigma
+ * standard deviations. If the gate rejects a whole window in a row the
+ * estimate is snapped to the median, so real steps are followed.
+ *
+ * All storage is inline and each sample costs O(window), with the window
+ * bounded by MAX_WINDOW.
+ */
+class SensorFilter {
+public:
+    static constexpr size_t MAX_WINDOW = SENSOR_FILTER_MAX_WINDOW;
+
+    /**
+     * @param window       Median window, clamped to 1..MAX_WINDOW
+     * @param processNoise Kalman Q, variance added per sample
+     * @param measureNoise Kalman R, variance of the median output
+     * @param gateSigma    Innovation gate, 0 disables outlier rejection
+     */
+    SensorFilter(size_t window, float processNoise, float measureNoise, float gateSigma);
+
+    // Feeds one valid reading and returns the new estimate
+    float update(float measurement);
+    // Records a failed read; lowers confidence without moving the estimate
+    void miss();
+    void reset();
+
+    float getValue() const { return estimate; }
+    float getVariance() const { return variance; }
+    // 0..1: share of recent samples accepted, scaled by estimate certainty
+    float getConfidence() const;
+    uint32_t getRejectedCount() const { return rejectedTotal; }
+
+private:
+    const size_t window;
+    const float processNoise;
+    const float measureNoise;
+    const float gateSigma;
+
+    float ring[MAX_WINDOW];      // Samples in arrival order
+    float sorted[MAX_WINDOW];    // Same samples, ascending
+    size_t ringHead;
+    size_t ringCount;
+
+    // Bit i set if sample i ago was accepted
+    uint32_t acceptHistory;
+    size_t historyCount;
+    size_t consecutiveRejects;
+    uint32_t rejectedTotal;
+
+    float estimate;
+    float variance;
+    bool initialized;
+
+    float pushMedian(float sample);
+    void recordOutcome(bool accepted);
+};
+
+#endif // SENSOR_FILTER_H
@@ -0,0 +1,112 @@
+#ifndef SENSOR_SCHEDULER_H
+#define SENSOR_SCHEDULER_H
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "../config.h"
+
+enum class SensorId : uint8_t {
+    TEMPERATURE = 0,
+    TDS,
+    WATER_LEVEL,
+    POWER,
+    FLOW,
+    COUNT
+};
+
+/**
+ * Latest reading of every sensor, one atomic slot each.
+ *
+ * Written only by the scheduler task; any task may read without locking.
+ * Each value is individually consistent, not the table as a whole.
+ */
+class SensorValueTable {
+public:
+    void publish(SensorId id, float value, uint32_t timestampMs) {
+        Slot& slot = slots[static_cast<size_t>(id)];
+        slot.value.store(value, std::memory_order_relaxed);
+        slot.timestampMs.store(timestampMs, std::memory_order_release);
+    }
+
+    float get(SensorId id) const {
+        return slots[static_cast<size_t>(id)].value.load(std::memory_order_relaxed);
+    }
+
+    // 0 until the sensor has published once
+    uint32_t getTimestamp(SensorId id) const {
+        return slots[static_cast<size_t>(id)].timestampMs.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Slot {
+        std::atomic<float> value{0};
+        std::atomic<uint32_t> timestampMs{0};
+    };
+    Slot slots[static_cast<size_t>(SensorId::COUNT)];
+};
+
+/**
+ * Runs each sensor at its own rate from a single worker task.
+ *
+ * A one-shot esp_timer is armed for the earliest due job and wakes the
+ * worker, which runs every due job earliest-deadline-first and publishes
+ * the result into the value table. Slow sensors no longer hold back fast
+ * ones, and jobs that exceed their cost budget or deadline are counted.
+ */
+class SensorScheduler {
+public:
+    typedef float (*ReadFn)(void* ctx);
+
+    struct JobStats {
+        uint32_t runs;
+        uint32_t budgetOverruns;   // Read took longer than budgetUs
+        uint32_t deadlineMisses;   // Read finished later than deadlineMs after it was due
+        uint32_t maxDurationUs;
+    };
+
+    SensorScheduler();
+
+    /**
+     * @param periodMs   Interval between reads
+     * @param deadlineMs Latest acceptable completion after the due time (<= periodMs)
+     * @param budgetUs   Expected worst-case cost of one read
+     */
+    bool addSensor(SensorId id, const char* name, ReadFn read, void* ctx,
+                   uint32_t periodMs, uint32_t deadlineMs, uint32_t budgetUs);
+    bool start();
+
+    const SensorValueTable& values() const { return table; }
+    JobStats getStats(SensorId id) const;
+
+private:
+    struct Job {
+        const char* name;
+        ReadFn read;
+        void* ctx;
+        int64_t periodUs;
+        int64_t deadlineUs;
+        uint32_t budgetUs;
+        int64_t nextDueUs;
+        JobStats stats;
+        bool active;
+    };
+
+    Job jobs[static_cast<size_t>(SensorId::COUNT)];
+    SensorValueTable table;
+    esp_timer_handle_t timer;
+    TaskHandle_t taskHandle;
+    mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    void runDueJobs();
+    void runJob(Job& job, SensorId id, int64_t now);
+    void armTimer();
+    static void timerCallback(void* arg);
+    static void schedulerTask(void* arg);
+};
+
+extern SensorScheduler sensorScheduler;
+
+#endif // SENSOR_SCHEDULER_H
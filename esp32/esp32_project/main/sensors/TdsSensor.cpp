@@ -1,21 +1,33 @@
 #include "TdsSensor.h"
+#include "AdcSampler.h"
 
 TdsSensor::TdsSensor(uint8_t pin) :
     pin(pin),
+    adcSlot(-1),
     lastValidReading(0),
     errorCount(0) {}
 
 void TdsSensor::begin() {
     pinMode(pin, INPUT);
+    adcSlot = adcSampler.addChannel(pin);
 }
 
-float TDSSensor::readTDS(float temperature) {
+float TdsSensor::readAverageRaw() {
+    if (adcSampler.isRunning() && adcSlot >= 0) {
+        return adcSampler.getAverage(adcSlot);
+    }
+
+    // Sampler not running: fall back to blocking oneshot reads
     float sum = 0;
     for(int i = 0; i < TDS_CALIBRATION_SAMPLES; i++) {
         sum += analogRead(pin);
         delay(TDS_SAMPLE_DELAY_MS);
     }
-    float averageVoltage = (sum / 10) * (3.3 / 4095.0);
+    return sum / TDS_CALIBRATION_SAMPLES;
+}
+
+float TdsSensor::readTDS(float temperature) {
+    float averageVoltage = readAverageRaw() * (3.3 / 4095.0);
 
     // Temperature compensation
     float compensation = 1.0 + temperatureCoefficient * (temperature - 25.0);
@@ -54,7 +66,7 @@ float TdsSensor::calculatePurity(float tdsValue) {
     else return 50 - ((tdsValue-350) * 0.1);  // Cap at 0% if needed
 }
 
-bool TDSSensor::isReadingValid(float reading) {
+bool TdsSensor::isReadingValid(float reading) {
     return reading >= 0 && reading <= TDS_MAX_THRESHOLD;
 }
 
@@ -8,6 +8,7 @@
 class TdsSensor {
 private:
     uint8_t pin;
+    int adcSlot;  // AdcSampler slot, -1 falls back to analogRead
     float lastValidReading;
     uint8_t errorCount;
     
@@ -22,5 +23,7 @@ public:
     float calculatePurity(float tdsValue);
     bool isReadingValid(float reading);
     float getLastValidReading();
+private:
+    float readAverageRaw();
 };
 #endif // TDS_SENSOR_H  // Add this at end
\ No newline at end of file
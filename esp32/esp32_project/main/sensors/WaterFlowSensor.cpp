@@ -1,61 +1,222 @@
 #include "WaterFlowSensor.h"
 #include "freertos/FreeRTOS.h"  // Needed for critical sections
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <string.h>
+
+static const char* TAG = "WaterFlow";
 
 // Constructor with proper mutex initialization
 WaterFlowSensor::WaterFlowSensor(uint8_t pin, float calibrationFactor) :
     pin(pin),
     calibrationFactor(calibrationFactor),
+    pcntUnit(nullptr),
+    pcntChannel(nullptr),
+    ringHead(0),
+    ringCount(0),
+    lastUpdateUs(0),
+    lastUpdatePulses(0),
+    totalPulses(0),
+    resetPulses(0),
     mux(portMUX_INITIALIZER_UNLOCKED)  // Initialize the mutex
 {
-    pulseCount = 0;
-    lastPulseTime = 0;
-    totalVolume = 0;
+    memset(ring, 0, sizeof(ring));
+}
+
+void WaterFlowSensor::begin() {
+    lastUpdateUs = esp_timer_get_time();
+    if (beginPcnt()) {
+        return;
+    }
+
+    ESP_LOGW(TAG, "PCNT unavailable, counting flow pulses in a GPIO ISR");
+    pinMode(pin, INPUT_PULLUP);
+    attachInterruptArg(digitalPinToInterrupt(pin), pulseISR, this, RISING);
+}
+
+bool WaterFlowSensor::beginPcnt() {
+    // Counts up only; low limit is required to be negative
+    pcnt_unit_config_t unitConfig = {};
+    unitConfig.low_limit = -1;
+    unitConfig.high_limit = FLOW_PCNT_HIGH_LIMIT;
+    unitConfig.flags.accum_count = 1;
+
+    pcnt_glitch_filter_config_t filterConfig = {};
+    filterConfig.max_glitch_ns = FLOW_PCNT_GLITCH_NS;
+
+    pcnt_chan_config_t chanConfig = {};
+    chanConfig.edge_gpio_num = pin;
+    chanConfig.level_gpio_num = -1;
+
+    if (pcnt_new_unit(&unitConfig, &pcntUnit) != ESP_OK) {
+        pcntUnit = nullptr;
+        return false;
+    }
+    if (pcnt_unit_set_glitch_filter(pcntUnit, &filterConfig) != ESP_OK ||
+        pcnt_new_channel(pcntUnit, &chanConfig, &pcntChannel) != ESP_OK ||
+        pcnt_channel_set_edge_action(pcntChannel, PCNT_CHANNEL_EDGE_ACTION_INCREASE,
+                                     PCNT_CHANNEL_EDGE_ACTION_HOLD) != ESP_OK ||
+        pcnt_channel_set_level_action(pcntChannel, PCNT_CHANNEL_LEVEL_ACTION_KEEP,
+                                      PCNT_CHANNEL_LEVEL_ACTION_KEEP) != ESP_OK ||
+        // Overflow at the high limit is folded into the driver's accumulator
+        pcnt_unit_add_watch_point(pcntUnit, FLOW_PCNT_HIGH_LIMIT) != ESP_OK ||
+        pcnt_unit_enable(pcntUnit) != ESP_OK ||
+        pcnt_unit_clear_count(pcntUnit) != ESP_OK ||
+        pcnt_unit_start(pcntUnit) != ESP_OK) {
+        if (pcntChannel) {
+            pcnt_del_channel(pcntChannel);
+            pcntChannel = nullptr;
+        }
+        pcnt_unit_disable(pcntUnit);
+        pcnt_del_unit(pcntUnit);
+        pcntUnit = nullptr;
+        return false;
+    }
+    return true;
 }
 
 void IRAM_ATTR WaterFlowSensor::pulseISR(void* arg) {
     WaterFlowSensor* sensor = static_cast<WaterFlowSensor*>(arg);
     uint32_t now = micros();
+    uint32_t last = sensor->lastPulseTime;
     
     // Debounce check using constant
-    if (now - sensor->lastPulseTime > FLOW_SENSOR_DEBOUNCE_US) { 
-        sensor->pulseCount++;
+    if (now - last > FLOW_SENSOR_DEBOUNCE_US) { 
+        sensor->isrPulses++;
+        sensor->pulsePeriodUs = last ? now - last : 0;
         sensor->lastPulseTime = now;
     }
 }
 
+// Pulses since begin(); wraps at 2^32 and is only used through differences
+uint32_t WaterFlowSensor::readPulseTotal() const {
+    if (pcntUnit) {
+        int count = 0;
+        pcnt_unit_get_count(pcntUnit, &count);
+        return (uint32_t)count;
+    }
+    return isrPulses.load();
+}
+
+float WaterFlowSensor::pulsesToLitersPerMinute(uint32_t pulses, uint32_t durationUs) const {
+    if (durationUs == 0) {
+        return 0;
+    }
+    return pulses / calibrationFactor * 60e6f / durationUs;
+}
+
 void WaterFlowSensor::update() {
-    static uint32_t lastUpdate = 0;
-    uint32_t now = millis();
-    
-    if (now - lastUpdate >= FLOW_UPDATE_INTERVAL_MS) {
-        // Critical section for normal code
-        portENTER_CRITICAL(&mux);
-        uint32_t pulses = pulseCount;
-        pulseCount = 0; // Reset after reading
-        portEXIT_CRITICAL(&mux);
-        
-        // Calculate flow rate (L/min)
-        float flowRate = (pulses / calibrationFactor) * 60.0f;
-        
-        // Update total volume (thread-safe atomic operation)
-        totalVolume += flowRate / 60.0f; // Add liters for this second
-        
-        lastUpdate = now;
+    int64_t now = esp_timer_get_time();
+    uint32_t total = readPulseTotal();
+    uint32_t elapsed = (uint32_t)(now - lastUpdateUs);
+    lastUpdateUs = now;
+
+    portENTER_CRITICAL(&mux);
+    uint32_t pulses = total - lastUpdatePulses;
+    lastUpdatePulses = total;
+    totalPulses += pulses;
+    portEXIT_CRITICAL(&mux);
+
+    // Only this task touches the ring, no lock needed
+    ring[ringHead] = {pulses, elapsed};
+    ringHead = (ringHead + 1) % FLOW_RATE_WINDOW;
+    if (ringCount < FLOW_RATE_WINDOW) {
+        ringCount++;
+    }
+
+    uint64_t windowPulses = 0;
+    uint64_t windowUs = 0;
+    for (size_t i = 0; i < ringCount; i++) {
+        windowPulses += ring[i].pulses;
+        windowUs += ring[i].durationUs;
     }
+    windowRate = windowUs ? windowPulses / calibrationFactor * 60e6f / windowUs : 0;
+
+    float intervalRate = pulsesToLitersPerMinute(pulses, elapsed);
+    smoothedRate = ringCount == 1 ? intervalRate
+        : smoothedRate + FLOW_RATE_EWMA_ALPHA * (intervalRate - smoothedRate);
+
+    instantRate = estimateInstantRate();
+}
+
+float WaterFlowSensor::estimateInstantRate() const {
+    if (!pcntUnit) {
+        // ISR path has real pulse timestamps. Once the gap since the last
+        // pulse exceeds the last spacing, the rate can be at most 1/gap.
+        uint32_t period = pulsePeriodUs;
+        if (period == 0 || isrPulses == 0) {
+            return 0;
+        }
+        uint32_t since = micros() - lastPulseTime;
+        if (since > (uint32_t)FLOW_RATE_WINDOW * FLOW_PERIOD_MS * 1000) {
+            return 0;
+        }
+        return pulsesToLitersPerMinute(1, since > period ? since : period);
+    }
+
+    // PCNT has no per-pulse timestamps: use the newest intervals, reaching
+    // back only until enough pulses are seen for a stable reciprocal.
+    uint32_t pulses = 0;
+    uint32_t durationUs = 0;
+    for (size_t n = 0; n < ringCount; n++) {
+        const Interval& interval = ring[(ringHead + FLOW_RATE_WINDOW - 1 - n) % FLOW_RATE_WINDOW];
+        pulses += interval.pulses;
+        durationUs += interval.durationUs;
+        if (pulses >= FLOW_INSTANT_MIN_PULSES) {
+            break;
+        }
+    }
+    return pulsesToLitersPerMinute(pulses, durationUs);
 }
 
 float WaterFlowSensor::getFlowRate() const {
-    uint32_t pulses;
-    
-    // Critical section to safely read pulseCount
+    return windowRate;
+}
+
+float WaterFlowSensor::getSmoothedFlowRate() const {
+    return smoothedRate;
+}
+
+float WaterFlowSensor::getInstantFlowRate() const {
+    return instantRate;
+}
+
+float WaterFlowSensor::getTotalVolume() const {
+    uint32_t total = readPulseTotal();
+
     portENTER_CRITICAL(&mux);
-    pulses = pulseCount;
+    uint64_t pulses = totalPulses + pendingPulses(total);
+    pulses = pulses > resetPulses ? pulses - resetPulses : 0;
     portEXIT_CRITICAL(&mux);
-    
-    return (pulses / calibrationFactor) * 60.0f; // L/min
+
+    return (double)pulses / calibrationFactor;
 }
 
-float WaterFlowSensor::getTotalVolume() const {
-    // No critical section needed for totalVolume as it's only written in update()
-    return totalVolume + (getFlowRate() / 60.0f); // Add partial second
-}
\ No newline at end of file
+uint32_t WaterFlowSensor::getPulseCount() const {
+    return readPulseTotal();
+}
+
+void WaterFlowSensor::resetTotalVolume() {
+    takeTotalVolume();
+}
+
+float WaterFlowSensor::takeTotalVolume() {
+    uint32_t total = readPulseTotal();
+
+    portENTER_CRITICAL(&mux);
+    // The next period starts exactly at this count; update() will still
+    // fold the pending pulses into the rate window as usual
+    uint64_t now = totalPulses + pendingPulses(total);
+    uint64_t pulses = now > resetPulses ? now - resetPulses : 0;
+    resetPulses = now;
+    portEXIT_CRITICAL(&mux);
+
+    return (double)pulses / calibrationFactor;
+}
+
+// Pulses counted since the last update(). Call with mux held; guards
+// against update() having run between the hardware read and the lock.
+uint32_t WaterFlowSensor::pendingPulses(uint32_t total) const {
+    int32_t pending = (int32_t)(total - lastUpdatePulses);
+    return pending > 0 ? pending : 0;
+}
@@ -3,6 +3,8 @@
 
 #include <Arduino.h>
 #include <atomic>
+#include "driver/pulse_cnt.h"
+#include "../config.h"
 
 class WaterFlowSensor {
 public:
@@ -13,28 +15,61 @@ public:
     WaterFlowSensor(uint8_t pin, float calibrationFactor = 7.5f);
     
     void begin();
-    void update(); // Call regularly in main loop
+    // Closes the current interval; call at a steady rate (the flow scheduler job)
+    void update();
     
-    // Getters
-    float getFlowRate() const;         // Liters per minute
-    float getTotalVolume() const;      // Lifetime liters
+    // Getters, all safe to call from any task
+    float getFlowRate() const;         // L/min over the last FLOW_RATE_WINDOW intervals
+    float getSmoothedFlowRate() const; // L/min, EWMA of interval rates
+    float getInstantFlowRate() const;  // L/min from the most recent pulse spacing
+    float getTotalVolume() const;      // Liters since the last reset
     uint32_t getPulseCount() const;    // Raw pulse count
     
     void resetTotalVolume();
+    // Returns the volume and resets it atomically, for billing
+    float takeTotalVolume();
 
 private:
     const uint8_t pin;
     const float calibrationFactor;
     
-    // Atomic for thread-safe ISR access
-    std::atomic<uint32_t> pulseCount{0};
+    // Hardware counter; pulses are counted and filtered by the PCNT
+    // peripheral, the CPU only sees an interrupt when it overflows.
+    pcnt_unit_handle_t pcntUnit;
+    pcnt_channel_handle_t pcntChannel;
+    
+    // GPIO interrupt fallback when no PCNT unit is available
+    std::atomic<uint32_t> isrPulses{0};
     std::atomic<uint32_t> lastPulseTime{0};
+    std::atomic<uint32_t> pulsePeriodUs{0};  // Spacing of the last two pulses
+    
+    // Per-interval pulse counts, newest at ringHead - 1
+    struct Interval {
+        uint32_t pulses;
+        uint32_t durationUs;
+    };
+    Interval ring[FLOW_RATE_WINDOW];
+    size_t ringHead;
+    size_t ringCount;
+    int64_t lastUpdateUs;
+    uint32_t lastUpdatePulses;  // Hardware count at the last update()
+    
+    // Lifetime pulses as an exact integer, converted to liters on read.
+    // Guarded by mux: 64-bit atomics are not lock-free on this target.
+    uint64_t totalPulses;
+    uint64_t resetPulses;
     
-    // Volume tracking
-    std::atomic<float> totalVolume{0};
+    std::atomic<float> windowRate{0};
+    std::atomic<float> smoothedRate{0};
+    std::atomic<float> instantRate{0};
     mutable portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
     
+    bool beginPcnt();
+    uint32_t readPulseTotal() const;
+    uint32_t pendingPulses(uint32_t total) const;
+    float pulsesToLitersPerMinute(uint32_t pulses, uint32_t durationUs) const;
+    float estimateInstantRate() const;
     static void IRAM_ATTR pulseISR(void* arg);
 };
 
-#endif // WATER_FLOW_SENSOR_H
\ No newline at end of file
+#endif // WATER_FLOW_SENSOR_H
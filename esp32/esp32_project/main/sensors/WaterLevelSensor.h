@@ -4,6 +4,11 @@
 #include <Arduino.h>
 #include "../config.h"
 #include <Preferences.h>
+#include <atomic>
+#include "SensorFilter.h"
+#include "driver/rmt_tx.h"
+#include "driver/rmt_rx.h"
+#include "esp_timer.h"
 
 class WaterLevelSensor {
 private:
@@ -13,16 +18,47 @@ private:
     uint8_t errorCount;
     float tankHeight;  // Now a member variable instead of #define
     Preferences preferences;
+    SensorFilter filter;
+    std::atomic<float> confidence;
+
+    // Hardware echo timing: an esp_timer fires the RMT trigger pulse and
+    // the RMT receiver measures the echo, so no CPU time is spent waiting.
+    bool hardwareTiming;
+    rmt_channel_handle_t txChannel;
+    rmt_channel_handle_t rxChannel;
+    rmt_encoder_handle_t copyEncoder;
+    esp_timer_handle_t pingTimer;
+    rmt_symbol_word_t rxSymbols[8];
+    volatile bool rxPending;
+    int64_t rxArmedAt;
+
+    // Last echo widths (us), 0 for a ping without one; the newest
+    // freshEchoes of them arrived since the last readWaterLevel()
+    uint32_t echoRing[WATER_LEVEL_PING_HISTORY];
+    size_t echoHead;
+    size_t freshEchoes;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    bool beginHardwareTiming();
+    void ping();
+    float readEchoMicros();
+    float pulseInEchoMicros();
+    static void pingTimerCallback(void* arg);
+    static bool IRAM_ATTR onEchoReceived(rmt_channel_handle_t channel,
+                                         const rmt_rx_done_event_data_t* edata,
+                                         void* userData);
 public:
     WaterLevelSensor(uint8_t trig, uint8_t echo);
     void begin();
     void setTankHeight(float height);  // New method
     float readWaterLevel();
     float getLastValidReading();
+    // 0..1 trust in the filtered level, safe to call from any task
+    float getConfidence() const { return confidence.load(std::memory_order_relaxed); }
     bool isReadingValid(float distance);
 private:
     float calculatePercentage(float distance);
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,57 @@
+#include "AcPowerMeter.h"
+#include "dsps_addc.h"
+#include "dsps_mulc.h"
+#include "dsps_dotprod.h"
+#include <math.h>
+
+AcPowerMeter::AcPowerMeter(float sensitivity, float lineVoltage) :
+    sensitivity(sensitivity),
+    lineVoltage(lineVoltage),
+    rmsCurrent(0),
+    offsetVoltage(0),
+    energyKWh(0) {}
+
+size_t AcPowerMeter::windowSamples(float sampleRateHz, float mainsHz) {
+    if (sampleRateHz <= 0 || mainsHz <= 0) {
+        return 0;
+    }
+
+    float perCycle = sampleRateHz / mainsHz;
+    size_t cycles = (size_t)(MAX_WINDOW / perCycle);
+    if (cycles > AC_POWER_WINDOW_CYCLES) {
+        cycles = AC_POWER_WINDOW_CYCLES;
+    }
+    return (size_t)lroundf(cycles * perCycle);
+}
+
+bool AcPowerMeter::processWindow(const uint16_t* raw, size_t count) {
+    if (count == 0 || count > MAX_WINDOW) {
+        return false;
+    }
+
+    // Counts to volts, tracking the mean as the sensor's zero-current offset
+    const float voltsPerCount = ADC_REFERENCE_VOLTAGE / ADC_MAX_COUNT;
+    float sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = raw[i] * voltsPerCount;
+        sum += samples[i];
+    }
+    offsetVoltage = sum / count;
+
+    // Remove the offset and scale to amps, then sum of squares in one pass
+    dsps_addc_f32(samples, samples, count, -offsetVoltage, 1, 1);
+    dsps_mulc_f32(samples, samples, count, 1.0f / sensitivity, 1, 1);
+
+    float sumSquares = 0;
+    dsps_dotprod_f32(samples, samples, &sumSquares, count);
+
+    float rms = sqrtf(sumSquares / count);
+    rmsCurrent = rms < AC_CURRENT_NOISE_FLOOR_A ? 0 : rms;
+    return true;
+}
+
+void AcPowerMeter::accumulate(float watts, float seconds) {
+    if (seconds > 0) {
+        energyKWh += (watts / 1000.0f) * (seconds / 3600.0f);
+    }
+}
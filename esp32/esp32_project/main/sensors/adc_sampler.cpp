@@ -0,0 +1,201 @@
+#include "AdcSampler.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char* TAG = "AdcSampler";
+
+AdcSampler::AdcSampler() :
+    channelCount(0),
+    handle(nullptr),
+    taskHandle(nullptr),
+    running(false),
+    overflows(0) {
+    memset(channels, 0, sizeof(channels));
+    memset(slotForChannel, -1, sizeof(slotForChannel));
+}
+
+int AdcSampler::addChannel(uint8_t pin) {
+    adc_unit_t unit;
+    adc_channel_t channel;
+    // Continuous mode on the ESP32 only drives ADC1 (ADC2 is shared with WiFi)
+    if (adc_continuous_io_to_channel(pin, &unit, &channel) != ESP_OK || unit != ADC_UNIT_1) {
+        ESP_LOGE(TAG, "GPIO %u is not an ADC1 pin", pin);
+        return -1;
+    }
+
+    // Already sampled, e.g. a second sensor object on the same pin
+    if (slotForChannel[channel] >= 0) {
+        return slotForChannel[channel];
+    }
+
+    if (running || channelCount >= MAX_CHANNELS) {
+        return -1;
+    }
+
+    int slot = channelCount++;
+    channels[slot].channel = channel;
+    slotForChannel[channel] = slot;
+    return slot;
+}
+
+bool AdcSampler::start() {
+    if (running || channelCount == 0) {
+        return running;
+    }
+
+    adc_continuous_handle_cfg_t handleConfig = {
+        .max_store_buf_size = ADC_SAMPLER_FRAME_BYTES * 4,
+        .conv_frame_size = ADC_SAMPLER_FRAME_BYTES,
+        .flags = { .flush_pool = 1 },
+    };
+    if (adc_continuous_new_handle(&handleConfig, &handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create ADC continuous handle");
+        return false;
+    }
+
+    adc_digi_pattern_config_t pattern[MAX_CHANNELS] = {};
+    for (int i = 0; i < channelCount; i++) {
+        pattern[i].atten = ADC_ATTEN_DB_12;
+        pattern[i].channel = channels[i].channel;
+        pattern[i].unit = ADC_UNIT_1;
+        pattern[i].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    }
+
+    adc_continuous_config_t config = {
+        .pattern_num = (uint32_t)channelCount,
+        .adc_pattern = pattern,
+        .sample_freq_hz = ADC_SAMPLER_FREQ_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    };
+    if (adc_continuous_config(handle, &config) != ESP_OK) {
+        ESP_LOGE(TAG, "Invalid ADC continuous configuration");
+        adc_continuous_deinit(handle);
+        handle = nullptr;
+        return false;
+    }
+
+    xTaskCreate(samplerTask, "AdcSampler", 4096, this, 4, &taskHandle);
+
+    adc_continuous_evt_cbs_t callbacks = {
+        .on_conv_done = onConvDone,
+        .on_pool_ovf = onPoolOverflow,
+    };
+    adc_continuous_register_event_callbacks(handle, &callbacks, this);
+
+    if (adc_continuous_start(handle) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start ADC continuous mode");
+        vTaskDelete(taskHandle);
+        taskHandle = nullptr;
+        adc_continuous_deinit(handle);
+        handle = nullptr;
+        return false;
+    }
+
+    running = true;
+    ESP_LOGI(TAG, "Sampling %d channel(s) at %lu Hz each",
+             channelCount, (unsigned long)getChannelRate());
+    return true;
+}
+
+void AdcSampler::stop() {
+    if (!running) {
+        return;
+    }
+
+    running = false;
+    adc_continuous_stop(handle);
+    vTaskDelete(taskHandle);
+    taskHandle = nullptr;
+    adc_continuous_deinit(handle);
+    handle = nullptr;
+}
+
+bool IRAM_ATTR AdcSampler::onConvDone(adc_continuous_handle_t handle,
+                                      const adc_continuous_evt_data_t* edata,
+                                      void* userData) {
+    AdcSampler* sampler = static_cast<AdcSampler*>(userData);
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(sampler->taskHandle, &woken);
+    return woken == pdTRUE;
+}
+
+bool IRAM_ATTR AdcSampler::onPoolOverflow(adc_continuous_handle_t handle,
+                                          const adc_continuous_evt_data_t* edata,
+                                          void* userData) {
+    static_cast<AdcSampler*>(userData)->overflows++;
+    return false;
+}
+
+void AdcSampler::samplerTask(void* arg) {
+    AdcSampler* sampler = static_cast<AdcSampler*>(arg);
+    uint8_t frame[ADC_SAMPLER_FRAME_BYTES];
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        uint32_t length = 0;
+        while (adc_continuous_read(sampler->handle, frame, sizeof(frame), &length, 0) == ESP_OK) {
+            sampler->processFrame(frame, length);
+        }
+    }
+}
+
+void AdcSampler::processFrame(const uint8_t* frame, uint32_t length) {
+    portENTER_CRITICAL(&mux);
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+        const adc_digi_output_data_t* result = reinterpret_cast<const adc_digi_output_data_t*>(&frame[i]);
+        uint32_t channel = result->type1.channel;
+        if (channel >= SOC_ADC_MAX_CHANNEL_NUM || slotForChannel[channel] < 0) {
+            continue;
+        }
+
+        Channel& ch = channels[slotForChannel[channel]];
+        uint16_t value = result->type1.data;
+        if (ch.count == RING_SIZE) {
+            ch.sum -= ch.ring[ch.head];
+        } else {
+            ch.count++;
+        }
+        ch.ring[ch.head] = value;
+        ch.sum += value;
+        ch.head = (ch.head + 1) % RING_SIZE;
+    }
+    portEXIT_CRITICAL(&mux);
+}
+
+float AdcSampler::getAverage(int slot) const {
+    if (slot < 0 || slot >= channelCount) {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&mux);
+    uint32_t sum = channels[slot].sum;
+    size_t count = channels[slot].count;
+    portEXIT_CRITICAL(&mux);
+
+    return count > 0 ? (float)sum / count : 0;
+}
+
+size_t AdcSampler::getSamples(int slot, uint16_t* out, size_t count) const {
+    if (slot < 0 || slot >= channelCount) {
+        return 0;
+    }
+
+    const Channel& ch = channels[slot];
+    portENTER_CRITICAL(&mux);
+    if (count > ch.count) {
+        count = ch.count;
+    }
+    size_t start = (ch.head + RING_SIZE - count) % RING_SIZE;
+    size_t first = min(count, RING_SIZE - start);
+    memcpy(out, &ch.ring[start], first * sizeof(uint16_t));
+    memcpy(out + first, &ch.ring[0], (count - first) * sizeof(uint16_t));
+    portEXIT_CRITICAL(&mux);
+
+    return count;
+}
+
+uint32_t AdcSampler::getChannelRate() const {
+    return channelCount > 0 ? ADC_SAMPLER_FREQ_HZ / channelCount : 0;
+}
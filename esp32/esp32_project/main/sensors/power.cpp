@@ -1,35 +1,64 @@
 #include "PowerSensor.h"
+#include "AdcSampler.h"
 
 PowerSensor::PowerSensor(uint8_t pin) :
     pin(pin),
+    adcSlot(-1),
     lastValidReading(0),
     errorCount(0) {}
 
 void PowerSensor::begin() {
     pinMode(pin, INPUT);
+    adcSlot = adcSampler.addChannel(pin);
 }
 
-float PowerSensor::readPowerConsumption() {
+float PowerSensor::readAverageRaw() {
+    if (adcSampler.isRunning() && adcSlot >= 0) {
+        return adcSampler.getAverage(adcSlot);
+    }
+
+    // Sampler not running: fall back to blocking oneshot reads
     float sum = 0;
     for(int i = 0; i < POWER_SAMPLE_COUNT; i++) {
         sum += analogRead(pin);
         delay(POWER_SAMPLE_DELAY_MS);
     }
-    float average = sum / 20;
-    
-    // Convert analog reading to voltage
-    float voltage = average * (3.3 / 4095.0);
-    float power = calculatePower(voltage);
+    return sum / POWER_SAMPLE_COUNT;
+}
+
+bool PowerSensor::readRmsPower(float& power) {
+    if (!adcSampler.isRunning() || adcSlot < 0) {
+        return false;
+    }
+
+    // Whole mains cycles from the sampler's ring, so no waiting on the ADC
+    size_t wanted = AcPowerMeter::windowSamples(adcSampler.getChannelRate());
+    if (wanted == 0 || adcSampler.getSamples(adcSlot, window, wanted) != wanted) {
+        return false;
+    }
+    if (!meter.processWindow(window, wanted)) {
+        return false;
+    }
+
+    power = meter.getApparentPower();
+    return true;
+}
+
+float PowerSensor::readPowerConsumption() {
+    float power;
+    if (!readRmsPower(power)) {
+        // Convert analog reading to voltage
+        float voltage = readAverageRaw() * (ADC_REFERENCE_VOLTAGE / ADC_MAX_COUNT);
+        power = calculatePower(voltage);
+    }
     
     if (isReadingValid(power)) {
         lastValidReading = power;
         errorCount = 0;
         
-        // ACTUALLY USE the energy tracking (option 2)
         uint32_t now = millis();
         if (lastUpdate != 0) {
-            float hours = (now - lastUpdate) / 3600000.0;
-            totalEnergy += (power / 1000) * hours; // kWh
+            meter.accumulate(power, (now - lastUpdate) / 1000.0f);
         }
         lastUpdate = now;
         
@@ -45,13 +74,12 @@ float PowerSensor::readPowerConsumption() {
 }
 
 float PowerSensor::calculatePower(float voltage) {
-    // Convert voltage to current using sensor's sensitivity
+    // DC approximation used only when the sampler is unavailable
     // ACS712 30A sensor sensitivity is 66mV/A
-    float current = (voltage - 2.5) / 0.066;
+    float current = (voltage - 2.5) / POWER_CALIBRATION_FACTOR;
     
     // Calculate power (P = V * I)
-    // Assuming 220V AC supply
-    float power = abs(220.0 * current);
+    float power = abs(MAINS_VOLTAGE_RMS * current);
     
     return power;
 }
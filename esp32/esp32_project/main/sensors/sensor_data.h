@@ -8,7 +8,7 @@ struct SensorData {
     float waterLevel;       // percentage
     float powerConsumption; // in watts
     float waterFlow;        // in L/min
-    float totalWaterUsed;   // in liters
+    float totalWaterUsed;   // in liters, since the monthly billing reset
     bool pumpStatus;
     uint32_t lastUpdate;    // timestamp
     
@@ -0,0 +1,121 @@
+#include "SensorFilter.h"
+#include <math.h>
+
+static_assert(SENSOR_FILTER_MAX_WINDOW <= 32, "accept history is a 32-bit mask");
+
+SensorFilter::SensorFilter(size_t window, float processNoise, float measureNoise, float gateSigma) :
+    window(window < 1 ? 1 : (window > MAX_WINDOW ? MAX_WINDOW : window)),
+    processNoise(processNoise),
+    measureNoise(measureNoise),
+    gateSigma(gateSigma) {
+    reset();
+}
+
+void SensorFilter::reset() {
+    ringHead = 0;
+    ringCount = 0;
+    acceptHistory = 0;
+    historyCount = 0;
+    consecutiveRejects = 0;
+    rejectedTotal = 0;
+    estimate = 0;
+    variance = measureNoise;
+    initialized = false;
+}
+
+// Replaces the oldest sample in the window and returns the new median
+float SensorFilter::pushMedian(float sample) {
+    size_t pos;
+    if (ringCount < window) {
+        pos = ringCount++;
+    } else {
+        // Drop the outgoing sample from the sorted copy
+        float oldest = ring[ringHead];
+        size_t i = 0;
+        while (i < ringCount - 1 && sorted[i] != oldest) {
+            i++;
+        }
+        for (; i < ringCount - 1; i++) {
+            sorted[i] = sorted[i + 1];
+        }
+        pos = ringCount - 1;
+    }
+    ring[ringHead] = sample;
+    ringHead = (ringHead + 1) % window;
+
+    // Insert the new one in order
+    while (pos > 0 && sorted[pos - 1] > sample) {
+        sorted[pos] = sorted[pos - 1];
+        pos--;
+    }
+    sorted[pos] = sample;
+
+    if (ringCount % 2) {
+        return sorted[ringCount / 2];
+    }
+    return (sorted[ringCount / 2 - 1] + sorted[ringCount / 2]) / 2.0f;
+}
+
+void SensorFilter::recordOutcome(bool accepted) {
+    acceptHistory = (acceptHistory << 1) | (accepted ? 1 : 0);
+    if (historyCount < window) {
+        historyCount++;
+    }
+    if (!accepted) {
+        rejectedTotal++;
+    }
+}
+
+float SensorFilter::update(float measurement) {
+    if (isnan(measurement)) {
+        miss();
+        return estimate;
+    }
+    float median = pushMedian(measurement);
+
+    if (!initialized) {
+        estimate = median;
+        variance = measureNoise;
+        initialized = true;
+        recordOutcome(true);
+        return estimate;
+    }
+
+    // Predict: level is modelled as constant plus random walk
+    variance += processNoise;
+
+    float innovation = median - estimate;
+    float innovationVariance = variance + measureNoise;
+    if (gateSigma > 0 &&
+        innovation * innovation > gateSigma * gateSigma * innovationVariance) {
+        recordOutcome(false);
+        if (++consecutiveRejects >= window) {
+            // Sustained disagreement is a real change, not an outlier
+            estimate = median;
+            variance = measureNoise;
+            consecutiveRejects = 0;
+        }
+        return estimate;
+    }
+
+    float gain = variance / innovationVariance;
+    estimate += gain * innovation;
+    variance *= (1 - gain);
+    consecutiveRejects = 0;
+    recordOutcome(true);
+    return estimate;
+}
+
+void SensorFilter::miss() {
+    variance += processNoise;
+    recordOutcome(false);
+}
+
+float SensorFilter::getConfidence() const {
+    if (!initialized || historyCount == 0) {
+        return 0;
+    }
+    uint32_t mask = historyCount >= 32 ? 0xFFFFFFFFu : ((1u << historyCount) - 1);
+    float acceptedShare = (float)__builtin_popcount(acceptHistory & mask) / historyCount;
+    return acceptedShare * measureNoise / (measureNoise + variance);
+}
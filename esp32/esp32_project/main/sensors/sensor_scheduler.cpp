@@ -0,0 +1,152 @@
+#include "SensorScheduler.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char* TAG = "SensorScheduler";
+
+SensorScheduler::SensorScheduler() :
+    timer(nullptr),
+    taskHandle(nullptr) {
+    memset(jobs, 0, sizeof(jobs));
+}
+
+bool SensorScheduler::addSensor(SensorId id, const char* name, ReadFn read, void* ctx,
+                                uint32_t periodMs, uint32_t deadlineMs, uint32_t budgetUs) {
+    size_t index = static_cast<size_t>(id);
+    if (taskHandle != nullptr || index >= static_cast<size_t>(SensorId::COUNT) ||
+        read == nullptr || periodMs == 0) {
+        return false;
+    }
+
+    Job& job = jobs[index];
+    job.name = name;
+    job.read = read;
+    job.ctx = ctx;
+    job.periodUs = (int64_t)periodMs * 1000;
+    job.deadlineUs = (int64_t)(deadlineMs > 0 && deadlineMs <= periodMs ? deadlineMs : periodMs) * 1000;
+    job.budgetUs = budgetUs;
+    job.active = true;
+    return true;
+}
+
+bool SensorScheduler::start() {
+    if (taskHandle != nullptr) {
+        return true;
+    }
+
+    esp_timer_create_args_t timerArgs = {
+        .callback = timerCallback,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "sensor_sched",
+        .skip_unhandled_events = true,
+    };
+    if (esp_timer_create(&timerArgs, &timer) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create scheduler timer");
+        return false;
+    }
+
+    // Everything is due immediately so the table is populated at boot
+    int64_t now = esp_timer_get_time();
+    for (Job& job : jobs) {
+        job.nextDueUs = now;
+    }
+
+    if (xTaskCreate(schedulerTask, "SensorTask", 8192, this, 2, &taskHandle) != pdPASS) {
+        esp_timer_delete(timer);
+        timer = nullptr;
+        return false;
+    }
+    xTaskNotifyGive(taskHandle);
+    return true;
+}
+
+SensorScheduler::JobStats SensorScheduler::getStats(SensorId id) const {
+    portENTER_CRITICAL(&mux);
+    JobStats stats = jobs[static_cast<size_t>(id)].stats;
+    portEXIT_CRITICAL(&mux);
+    return stats;
+}
+
+void SensorScheduler::timerCallback(void* arg) {
+    SensorScheduler* scheduler = static_cast<SensorScheduler*>(arg);
+    xTaskNotifyGive(scheduler->taskHandle);
+}
+
+void SensorScheduler::schedulerTask(void* arg) {
+    SensorScheduler* scheduler = static_cast<SensorScheduler*>(arg);
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        scheduler->runDueJobs();
+    }
+}
+
+void SensorScheduler::runDueJobs() {
+    while (1) {
+        // Earliest absolute deadline among the jobs that are due
+        int64_t now = esp_timer_get_time();
+        int best = -1;
+        for (size_t i = 0; i < static_cast<size_t>(SensorId::COUNT); i++) {
+            const Job& job = jobs[i];
+            if (!job.active || job.nextDueUs > now) {
+                continue;
+            }
+            if (best < 0 || job.nextDueUs + job.deadlineUs <
+                            jobs[best].nextDueUs + jobs[best].deadlineUs) {
+                best = i;
+            }
+        }
+
+        if (best < 0) {
+            break;
+        }
+        runJob(jobs[best], static_cast<SensorId>(best), now);
+    }
+
+    armTimer();
+}
+
+void SensorScheduler::runJob(Job& job, SensorId id, int64_t now) {
+    float value = job.read(job.ctx);
+    int64_t end = esp_timer_get_time();
+    table.publish(id, value, millis());
+
+    uint32_t duration = (uint32_t)(end - now);
+    bool overBudget = job.budgetUs > 0 && duration > job.budgetUs;
+    bool missed = end - job.nextDueUs > job.deadlineUs;
+
+    portENTER_CRITICAL(&mux);
+    job.stats.runs++;
+    if (overBudget) job.stats.budgetOverruns++;
+    if (missed) job.stats.deadlineMisses++;
+    if (duration > job.stats.maxDurationUs) job.stats.maxDurationUs = duration;
+    portEXIT_CRITICAL(&mux);
+
+    if (overBudget && (job.stats.budgetOverruns % 100) == 1) {
+        ESP_LOGW(TAG, "%s read took %lu us (budget %lu us)",
+                 job.name, (unsigned long)duration, (unsigned long)job.budgetUs);
+    }
+
+    // Stay on the period grid; slots that have already passed are skipped
+    // rather than run back-to-back.
+    job.nextDueUs += job.periodUs;
+    if (job.nextDueUs <= end) {
+        job.nextDueUs += ((end - job.nextDueUs) / job.periodUs + 1) * job.periodUs;
+    }
+}
+
+void SensorScheduler::armTimer() {
+    int64_t earliest = INT64_MAX;
+    for (const Job& job : jobs) {
+        if (job.active && job.nextDueUs < earliest) {
+            earliest = job.nextDueUs;
+        }
+    }
+    if (earliest == INT64_MAX) {
+        return;
+    }
+
+    int64_t delay = earliest - esp_timer_get_time();
+    esp_timer_stop(timer);
+    esp_timer_start_once(timer, delay > 0 ? delay : 1);
+}
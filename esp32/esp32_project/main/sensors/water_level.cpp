@@ -1,11 +1,39 @@
 #include "WaterLevelSensor.h"
+#include "esp_log.h"
+#include <string.h>
+
+static const char* TAG = "WaterLevel";
+
+// Speed of sound, cm per microsecond (round trip is halved on conversion)
+static const float SOUND_CM_PER_US = 0.034f;
+
+// Trigger pulse: HIGH for WATER_LEVEL_PULSE_US ticks, then LOW for 1 tick.
+// Static because the RMT encoder reads it after rmt_transmit() returns.
+static const rmt_symbol_word_t triggerSymbol = {
+    .val = WATER_LEVEL_PULSE_US | (1u << 15) | (1u << 16)
+};
 
 WaterLevelSensor::WaterLevelSensor(uint8_t trig, uint8_t echo) :
     trigPin(trig),
     echoPin(echo),
     lastValidReading(0),
     errorCount(0),
-    tankHeight(100.0) {}  // Default 100cm
+    tankHeight(100.0),  // Default 100cm
+    filter(WATER_LEVEL_FILTER_WINDOW, WATER_LEVEL_PROCESS_NOISE,
+           WATER_LEVEL_MEASURE_NOISE, WATER_LEVEL_GATE_SIGMA),
+    confidence(0),
+    hardwareTiming(false),
+    txChannel(nullptr),
+    rxChannel(nullptr),
+    copyEncoder(nullptr),
+    pingTimer(nullptr),
+    rxPending(false),
+    rxArmedAt(0),
+    echoHead(0),
+    freshEchoes(0) {
+    memset(rxSymbols, 0, sizeof(rxSymbols));
+    memset(echoRing, 0, sizeof(echoRing));
+}
 
 void WaterLevelSensor::begin() {
     pinMode(trigPin, OUTPUT);
@@ -15,12 +43,180 @@ void WaterLevelSensor::begin() {
     preferences.begin("tank_config", true);  // Read-only mode
     tankHeight = preferences.getFloat("height", 100.0);  // Default 100cm
     preferences.end();
+
+    hardwareTiming = beginHardwareTiming();
+    if (!hardwareTiming) {
+        ESP_LOGW(TAG, "RMT echo timing unavailable, falling back to pulseIn");
+    }
+}
+
+bool WaterLevelSensor::beginHardwareTiming() {
+    rmt_rx_channel_config_t rxConfig = {};
+    rxConfig.gpio_num = (gpio_num_t)echoPin;
+    rxConfig.clk_src = RMT_CLK_SRC_DEFAULT;
+    rxConfig.resolution_hz = 1000000;  // 1 tick = 1 us
+    rxConfig.mem_block_symbols = 64;
+
+    rmt_tx_channel_config_t txConfig = {};
+    txConfig.gpio_num = (gpio_num_t)trigPin;
+    txConfig.clk_src = RMT_CLK_SRC_DEFAULT;
+    txConfig.resolution_hz = 1000000;
+    txConfig.mem_block_symbols = 64;
+    txConfig.trans_queue_depth = 1;
+
+    rmt_copy_encoder_config_t encoderConfig = {};
+    rmt_rx_event_callbacks_t callbacks = {};
+    callbacks.on_recv_done = onEchoReceived;
+
+    esp_timer_create_args_t timerArgs = {
+        .callback = pingTimerCallback,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "level_ping",
+        .skip_unhandled_events = true,
+    };
+
+    if (rmt_new_rx_channel(&rxConfig, &rxChannel) != ESP_OK ||
+        rmt_rx_register_event_callbacks(rxChannel, &callbacks, this) != ESP_OK ||
+        rmt_enable(rxChannel) != ESP_OK ||
+        rmt_new_tx_channel(&txConfig, &txChannel) != ESP_OK ||
+        rmt_new_copy_encoder(&encoderConfig, &copyEncoder) != ESP_OK ||
+        rmt_enable(txChannel) != ESP_OK ||
+        esp_timer_create(&timerArgs, &pingTimer) != ESP_OK ||
+        esp_timer_start_periodic(pingTimer, WATER_LEVEL_PING_INTERVAL_MS * 1000) != ESP_OK) {
+        // Release whatever was created; pulseIn owns the pins from here on
+        if (pingTimer) { esp_timer_delete(pingTimer); pingTimer = nullptr; }
+        if (copyEncoder) { rmt_del_encoder(copyEncoder); copyEncoder = nullptr; }
+        if (txChannel) { rmt_disable(txChannel); rmt_del_channel(txChannel); txChannel = nullptr; }
+        if (rxChannel) { rmt_disable(rxChannel); rmt_del_channel(rxChannel); rxChannel = nullptr; }
+        pinMode(trigPin, OUTPUT);
+        pinMode(echoPin, INPUT);
+        return false;
+    }
+    return true;
+}
+
+void WaterLevelSensor::pingTimerCallback(void* arg) {
+    static_cast<WaterLevelSensor*>(arg)->ping();
+}
+
+// Arms the echo receiver, then has the RMT emit the trigger pulse
+void WaterLevelSensor::ping() {
+    int64_t now = esp_timer_get_time();
+    if (rxPending) {
+        // No echo edge at all (sensor unplugged or out of range): abort
+        // the stale receive once it has been pending for two intervals.
+        if (now - rxArmedAt < 2 * WATER_LEVEL_PING_INTERVAL_MS * 1000) {
+            return;
+        }
+        rmt_disable(rxChannel);
+        rmt_enable(rxChannel);
+        rxPending = false;
+    }
+
+    // The receive finishes once the echo line has been idle longer than
+    // the longest echo the tank can produce, so size that from the height.
+    uint32_t maxEchoUs = (uint32_t)(tankHeight * 1.2f * 2 / SOUND_CM_PER_US) + 1000;
+    if (maxEchoUs > WATER_LEVEL_TIMEOUT_US) {
+        maxEchoUs = WATER_LEVEL_TIMEOUT_US;
+    }
+
+    rmt_receive_config_t receiveConfig = {};
+    receiveConfig.signal_range_min_ns = 1000;               // Glitch filter
+    receiveConfig.signal_range_max_ns = maxEchoUs * 1000;   // Idle timeout
+
+    rxPending = true;
+    rxArmedAt = now;
+    if (rmt_receive(rxChannel, rxSymbols, sizeof(rxSymbols), &receiveConfig) != ESP_OK) {
+        rxPending = false;
+        return;
+    }
+
+    rmt_transmit_config_t transmitConfig = {};
+    transmitConfig.flags.queue_nonblocking = 1;  // Skip the ping if the last trigger is still queued
+    rmt_transmit(txChannel, copyEncoder, &triggerSymbol, sizeof(triggerSymbol), &transmitConfig);
+}
+
+bool IRAM_ATTR WaterLevelSensor::onEchoReceived(rmt_channel_handle_t channel,
+                                                const rmt_rx_done_event_data_t* edata,
+                                                void* userData) {
+    WaterLevelSensor* sensor = static_cast<WaterLevelSensor*>(userData);
+
+    // Echo line idles low, so the first high level is the echo pulse.
+    // 0 marks a ping that saw no usable echo.
+    uint32_t echoUs = 0;
+    for (size_t i = 0; i < edata->num_symbols; i++) {
+        if (edata->received_symbols[i].level0 == 1) {
+            echoUs = edata->received_symbols[i].duration0;
+            break;
+        }
+    }
+
+    portENTER_CRITICAL_ISR(&sensor->mux);
+    sensor->echoRing[sensor->echoHead] = echoUs;
+    sensor->echoHead = (sensor->echoHead + 1) % WATER_LEVEL_PING_HISTORY;
+    if (sensor->freshEchoes < WATER_LEVEL_PING_HISTORY) {
+        sensor->freshEchoes++;
+    }
+    portEXIT_CRITICAL_ISR(&sensor->mux);
+
+    sensor->rxPending = false;
+    return false;
+}
+
+// Median echo width of the pings since the last read, 0 if none of them
+// got a usable echo. Older pings are left out so an out-of-range sensor
+// reads as a miss instead of repeating its last level.
+float WaterLevelSensor::readEchoMicros() {
+    uint32_t echoes[WATER_LEVEL_PING_HISTORY];
+    size_t count = 0;
+
+    portENTER_CRITICAL(&mux);
+    for (size_t i = 1; i <= freshEchoes; i++) {
+        uint32_t echo = echoRing[(echoHead + WATER_LEVEL_PING_HISTORY - i) % WATER_LEVEL_PING_HISTORY];
+        if (echo > 0) {
+            echoes[count++] = echo;
+        }
+    }
+    freshEchoes = 0;
+    portEXIT_CRITICAL(&mux);
+
+    if (count == 0) {
+        return 0;
+    }
+
+    // Insertion sort, the window is only a handful of pings
+    for (size_t i = 1; i < count; i++) {
+        uint32_t v = echoes[i];
+        size_t j = i;
+        while (j > 0 && echoes[j - 1] > v) {
+            echoes[j] = echoes[j - 1];
+            j--;
+        }
+        echoes[j] = v;
+    }
+    if (count % 2) {
+        return echoes[count / 2];
+    }
+    return (echoes[count / 2 - 1] + echoes[count / 2]) / 2.0f;
+}
+
+float WaterLevelSensor::pulseInEchoMicros() {
+    digitalWrite(trigPin, LOW);
+    delayMicroseconds(2);
+    
+    digitalWrite(trigPin, HIGH);
+    delayMicroseconds(WATER_LEVEL_PULSE_US);
+    digitalWrite(trigPin, LOW);
+    
+    return pulseIn(echoPin, HIGH, WATER_LEVEL_TIMEOUT_US);
 }
 
 // New method to dynamically set height
 void WaterLevelSensor::setTankHeight(float height) {
     if (height > 0) {
         tankHeight = height;
+        filter.reset();  // Old percentages are relative to the previous height
         preferences.begin("tank_config", false);
         preferences.putFloat("height", height);
         preferences.end();
@@ -36,26 +232,20 @@ bool WaterLevelSensor::isReadingValid(float distance) {
     return distance > 0 && distance <= tankHeight;  // Uses member variable
 }
 
-// Keep all other methods identical...
 float WaterLevelSensor::readWaterLevel() {
-    digitalWrite(trigPin, LOW);
-    delayMicroseconds(2);
-    
-    digitalWrite(trigPin, HIGH);
-    delayMicroseconds(WATER_LEVEL_PULSE_US);
-    digitalWrite(trigPin, LOW);
-    
-    long duration = pulseIn(echoPin, HIGH, WATER_LEVEL_TIMEOUT_US);
+    float duration = hardwareTiming ? readEchoMicros() : pulseInEchoMicros();
     // Calculate distance in cm
-    float distance = duration * 0.034 / 2;
+    float distance = duration * SOUND_CM_PER_US / 2;
     
     if (isReadingValid(distance)) {
-        float percentage = calculatePercentage(distance);
-        lastValidReading = percentage;
+        lastValidReading = filter.update(calculatePercentage(distance));
+        confidence.store(filter.getConfidence(), std::memory_order_relaxed);
         errorCount = 0;
-        return percentage;
+        return lastValidReading;
     }
     
+    filter.miss();
+    confidence.store(filter.getConfidence(), std::memory_order_relaxed);
     errorCount++;
     if (errorCount >= SENSOR_ERROR_RETRIES) {
         Serial.println("Water level sensor error");
@@ -66,4 +256,4 @@ float WaterLevelSensor::readWaterLevel() {
 
 float WaterLevelSensor::getLastValidReading() {
     return lastValidReading;
-}
\ No newline at end of file
+}
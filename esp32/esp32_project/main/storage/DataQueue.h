@@ -1,31 +1,100 @@
 #ifndef DATA_QUEUE_H
 #define DATA_QUEUE_H
 
-#include <ArduinoJson.h>
 #include <SPIFFS.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "../config.h"
 
+/**
+ * Offline buffer of SensorData readings kept on SPIFFS.
+ *
+ * Records are fixed-size and appended to a ring of segment files
+ * (/<name>_<n>.bin, "dq" for the offline queue). Every record carries its sequence number and a CRC, so
+ * the tail is recovered by scanning the newest segment at boot and only
+ * the read position (head) needs its own index. Enqueue is a single
+ * record append, dequeue a single record read plus a 16-byte index write.
+ *
+ * The index alternates between two files, each with a generation counter
+ * and a CRC. A write torn by a reset only damages the older copy, and
+ * begin() loads the newest copy that is still valid.
+ *
+ * Bulk readers use peek() and commit(): peek() reads a run of records
+ * without moving head, and commit() checkpoints head only once the caller
+ * has delivered them, so a power loss in between replays the run rather
+ * than losing it. Pipelined readers keep their own cursor and peek ahead
+ * of head while earlier runs await acknowledgement. All operations are
+ * serialised by an internal mutex.
+ */
 class DataQueue {
 private:
-    static const char* QUEUE_FILE;
-    static const size_t MAX_QUEUE_SIZE = 100;
-    
+    struct Record {
+        uint32_t seq;
+        SensorData data;
+        uint32_t crc;
+    };
+
+    struct Index {
+        uint32_t magic;
+        uint32_t generation;
+        uint32_t head;
+        uint32_t crc;
+    };
+
+    static const uint32_t INDEX_MAGIC = 0x44515832; // "DQX2"
+    static const size_t SEGMENT_RECORDS = QUEUE_SEGMENT_RECORDS;
+    static const size_t SEGMENT_COUNT = QUEUE_SEGMENT_COUNT;
+    // One segment is always kept free so the segment being (re)started
+    // by enqueue never holds unread records.
+    static const size_t MAX_QUEUE_SIZE = (SEGMENT_COUNT - 1) * SEGMENT_RECORDS;
+    static const size_t PATH_LEN = 32;  // SPIFFS object name limit
+
+    const char* name;  // File name prefix
+
     bool initialized;
-    size_t queueSize;
-    
-    bool writeToFile(const String& data);
-    String readFromFile();
-    void updateQueueSize();
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lockBuffer;
+    uint32_t head;  // Sequence number of the oldest unread record
+    uint32_t tail;  // Sequence number the next record will get
+    uint32_t indexGeneration;  // Of the newest index copy on flash
+
+    static uint32_t recordCrc(const Record& record);
+    static uint32_t indexCrc(const Index& index);
+    static bool readIndex(const char* path, Index& index);
+    void segmentPath(uint32_t seq, char* path, size_t len) const;
+    void slotPath(size_t slot, char* path, size_t len) const;
+    void indexPath(size_t copy, char* path, size_t len) const;
+    static size_t segmentOffset(uint32_t seq);
+
+    bool appendRecord(const SensorData& data);
+    bool writeIndex();
+    bool loadIndex();
+    void recoverTail();
 
 public:
-    DataQueue();
+    // `name` prefixes the queue's SPIFFS files, so several queues (e.g. one
+    // under test) can share the partition without touching each other
+    explicit DataQueue(const char* name = "dq");
     bool begin();
     bool enqueue(const SensorData& data);
     bool dequeue(SensorData& data);
+    /**
+     * Reads up to `max` valid records starting at `from`, skipping corrupt
+     * ones. A `from` outside [head, tail] (e.g. after clear()) reads from head.
+     * @param firstSeq Sequence number of out[0], stable across replays
+     * @param nextHead Value to pass to commit() once out[] is delivered,
+     *                 and the `from` of the following run
+     * @return Number of records in out[]
+     */
+    size_t peek(uint32_t from, SensorData* out, size_t max, uint32_t& firstSeq, uint32_t& nextHead);
+    // Advances head to a value returned by peek() and persists it
+    bool commit(uint32_t nextHead);
     void clear();
+    uint32_t headSequence();
+    uint32_t tailSequence();
     size_t size();
     bool isEmpty();
     bool isFull();
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -2,6 +2,7 @@
 #define DATA_STORAGE_H
 
 #include <EEPROM.h>
+#include <stddef.h>
 #include "../config.h"
 #include "../utils/error_handler.h"
 
@@ -29,7 +30,11 @@ public:
 private:
     static const int CONFIG_ADDRESS = 0;
     static const int CONFIG_SIZE = sizeof(DeviceConfig);
-    static const uint8_t CONFIG_MAGIC_BYTE = 0xAA;
+    // The magic byte doubles as the layout version. 0xAA blobs predate the
+    // report policy and hold only the fields in front of it.
+    static const uint8_t CONFIG_MAGIC_BYTE = 0xAB;
+    static const uint8_t LEGACY_CONFIG_MAGIC_BYTE = 0xAA;
+    static const int LEGACY_CONFIG_SIZE = offsetof(DeviceConfig, report);
     
     bool initialized;
     StorageError lastError;
@@ -1,5 +1,6 @@
 #include "DataStorage.h"
 #include "../utils/debug.h"
+#include "../communication/ReportFilter.h"
 
 DataStorage::DataStorage() : initialized(false), lastError(StorageError::NONE) {}
 
@@ -59,14 +60,17 @@ DataStorage::StorageError DataStorage::loadConfig(DeviceConfig& config) {
     // Check magic byte
     uint8_t magic;
     StorageError err = readFromEEPROM(CONFIG_ADDRESS, &magic, 1);
-    if (err != StorageError::NONE || magic != CONFIG_MAGIC_BYTE) {
+    bool legacy = err == StorageError::NONE && magic == LEGACY_CONFIG_MAGIC_BYTE;
+    if (err != StorageError::NONE || (magic != CONFIG_MAGIC_BYTE && !legacy)) {
         lastError = (err != StorageError::NONE) ? err : StorageError::CORRUPT_DATA;
         return lastError;
     }
     
+    // A legacy blob stops before the report policy, which keeps its defaults
+    config = DeviceConfig();
     err = readFromEEPROM(CONFIG_ADDRESS + 1,
                         reinterpret_cast<uint8_t*>(&config),
-                        CONFIG_SIZE);
+                        legacy ? LEGACY_CONFIG_SIZE : CONFIG_SIZE);
     
     if (err != StorageError::NONE || !verifyConfig(config)) {
         lastError = (err != StorageError::NONE) ? err : StorageError::CORRUPT_DATA;
@@ -76,14 +80,36 @@ DataStorage::StorageError DataStorage::loadConfig(DeviceConfig& config) {
         return lastError;
     }
     
+    if (legacy) {
+        DEBUG_I("Migrating configuration to the current layout");
+        if (saveConfig(config) != StorageError::NONE) {
+            // Still usable; the migration is retried on the next boot
+            DEBUG_W("Failed to save migrated config");
+        }
+    }
+    
     return StorageError::NONE;
 }
 
+DataStorage::StorageError DataStorage::resetConfig() {
+    if (!initialized) {
+        lastError = StorageError::INIT_FAILED;
+        return lastError;
+    }
+    
+    // Without a valid magic byte the next load falls back to defaults
+    uint8_t blank = 0xFF;
+    return writeToEEPROM(CONFIG_ADDRESS, &blank, 1);
+}
+
 bool DataStorage::verifyConfig(const DeviceConfig& config) {
     // Validate all config fields
     if (config.targetWaterLevel < 0 || config.targetWaterLevel > 100) {
         return false;
     }
+    if (!ReportFilter::isValid(config.report)) {
+        return false;
+    }
     
     // Add more validation as needed
     return true;
@@ -1,180 +1,350 @@
-#include "storage/DataQueue.h"
-#include "ArduinoJson.h" // Include ArduinoJson for JSON handling
 #include "DataQueue.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include <stddef.h>
+#include <string.h>
 
-const char* DataQueue::QUEUE_FILE = "/data_queue.json";
+static const char* TAG = "DataQueue";
 
-DataQueue::DataQueue() : 
+DataQueue::DataQueue(const char* name) :
+    name(name),
     initialized(false),
-    queueSize(0) {}
-
-
+    head(0),
+    tail(0),
+    indexGeneration(0) {
+    lock = xSemaphoreCreateMutexStatic(&lockBuffer);
+}
 
 bool DataQueue::begin() {
-    if(!SPIFFS.begin(true)){
+    if (!SPIFFS.begin(true)) {
         ESP_LOGE(TAG, "SPIFFS Mount Failed");
         return false;
     }
-    if (!SPIFFS.begin(true)) {
-        Serial.println("Failed to mount SPIFFS");
-        return false;
+
+    if (!loadIndex()) {
+        ESP_LOGW(TAG, "No valid queue index, starting from sequence 0");
+        head = 0;
     }
-    
+    recoverTail();
+
     initialized = true;
-    updateQueueSize();
+    ESP_LOGI(TAG, "Queue recovered: head=%u tail=%u size=%u",
+             (unsigned)head, (unsigned)tail, (unsigned)size());
     return true;
 }
 
+uint32_t DataQueue::recordCrc(const Record& record) {
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&record),
+                            offsetof(Record, crc));
+}
+
+void DataQueue::segmentPath(uint32_t seq, char* path, size_t len) const {
+    slotPath((seq / SEGMENT_RECORDS) % SEGMENT_COUNT, path, len);
+}
+
+void DataQueue::slotPath(size_t slot, char* path, size_t len) const {
+    snprintf(path, len, "/%s_%u.bin", name, (unsigned)slot);
+}
+
+void DataQueue::indexPath(size_t copy, char* path, size_t len) const {
+    snprintf(path, len, "/%s_index_%c.bin", name, copy ? 'b' : 'a');
+}
+
+size_t DataQueue::segmentOffset(uint32_t seq) {
+    return (seq % SEGMENT_RECORDS) * sizeof(Record);
+}
+
 bool DataQueue::enqueue(const SensorData& data) {
-    if (!initialized || isFull()) {
+    if (!initialized) {
         return false;
     }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    bool ok = !isFull() && appendRecord(data);
+    xSemaphoreGive(lock);
+    return ok;
+}
+
+bool DataQueue::appendRecord(const SensorData& data) {
+    Record record;
+    record.seq = tail;
+    record.data = data;
+    record.crc = recordCrc(record);
 
-    // Use DynamicJsonDocument instead of JsonDocument
-    DynamicJsonDocument doc(200);
+    char path[PATH_LEN];
+    segmentPath(tail, path, sizeof(path));
+    size_t offset = segmentOffset(tail);
 
-    String currentQueue = readFromFile();
-    if (currentQueue.length() > 0) {
-        DeserializationError error = deserializeJson(doc, currentQueue);
-        if (error) {
-            // Log or handle the deserialization error
-            return false;
+    // The first record of a segment truncates whatever the previous lap
+    // left there; isFull() guarantees none of it is still unread.
+    File file = SPIFFS.open(path, offset == 0 ? "w" : "r+");
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return false;
+    }
+    if (offset != 0 && !file.seek(offset)) {
+        file.close();
+        return false;
+    }
+
+    size_t written = file.write(reinterpret_cast<const uint8_t*>(&record), sizeof(record));
+    file.close();
+
+    if (written != sizeof(record)) {
+        ESP_LOGE(TAG, "Short write for record %u", (unsigned)tail);
+        return false;
+    }
+
+    tail++;
+    return true;
+}
+
+bool DataQueue::dequeue(SensorData& data) {
+    uint32_t firstSeq, nextHead;
+    if (peek(head, &data, 1, firstSeq, nextHead) == 0) {
+        if (initialized && nextHead != head) {
+            commit(nextHead);  // Only corrupt records were left
         }
+        return false;
     }
+    return commit(nextHead);
+}
 
-    JsonArray array = doc.is<JsonArray>() ? doc.as<JsonArray>() : doc.to<JsonArray>();
+size_t DataQueue::peek(uint32_t from, SensorData* out, size_t max,
+                       uint32_t& firstSeq, uint32_t& nextHead) {
+    nextHead = from;
+    firstSeq = from;
+    if (!initialized || max == 0) {
+        return 0;
+    }
 
-    JsonObject entry = array.createNestedObject();
-    entry["temp"] = data.temperature;
-    entry["water"] = data.waterLevel;
-    entry["purity"] = data.waterPurity;
-    entry["power"] = data.powerConsumption;
-    entry["pump"] = data.pumpStatus;
-    entry["time"] = data.lastUpdate;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if ((uint32_t)(from - head) > (uint32_t)(tail - head)) {
+        from = head;
+        firstSeq = head;
+    }
+    uint32_t seq = from;
+    uint32_t end = tail;
+    size_t count = 0;
+    File file;
+    char openPath[PATH_LEN] = "";
 
-    String output;
-    serializeJson(doc, output);
+    // Records are read sequentially, reopening only at segment boundaries
+    while (seq != end && count < max) {
+        char path[PATH_LEN];
+        segmentPath(seq, path, sizeof(path));
+        if (!file || strcmp(path, openPath) != 0) {
+            if (file) {
+                file.close();
+            }
+            file = SPIFFS.open(path, "r");
+            strcpy(openPath, path);
+            if (file && !file.seek(segmentOffset(seq))) {
+                file.close();
+            }
+        }
 
-    if (writeToFile(output)) {
-        queueSize++;
-        return true;
+        Record record;
+        bool ok = file &&
+                  file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record) &&
+                  record.seq == seq && record.crc == recordCrc(record);
+        if (ok) {
+            if (count == 0) {
+                firstSeq = seq;
+            }
+            out[count++] = record.data;
+        } else {
+            // Skip records that fail their CRC (e.g. torn by a power loss)
+            // instead of wedging the queue on them.
+            ESP_LOGW(TAG, "Dropping corrupt record %u", (unsigned)seq);
+            if (file) {
+                file.close();  // Resync the read position on the next record
+            }
+        }
+        seq++;
     }
+    if (file) {
+        file.close();
+    }
+    xSemaphoreGive(lock);
 
-    return false;
+    nextHead = seq;
+    return count;
 }
 
-bool DataQueue::dequeue(SensorData& data) {
-    if (!initialized || isEmpty()) {
+bool DataQueue::commit(uint32_t nextHead) {
+    if (!initialized) {
         return false;
     }
-    
-    StaticJsonDocument<2048> doc;
-    String currentQueue = readFromFile();
-    
-    DeserializationError error = deserializeJson(doc, currentQueue);
-    if (error) {
-        Serial.println("Failed to parse queue");
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    // Ignore stale checkpoints, e.g. after clear()
+    bool ok = (uint32_t)(nextHead - head) <= (uint32_t)(tail - head);
+    if (ok) {
+        head = nextHead;
+        ok = writeIndex();
+    }
+    xSemaphoreGive(lock);
+    return ok;
+}
+
+uint32_t DataQueue::indexCrc(const Index& index) {
+    return esp_rom_crc32_le(0, reinterpret_cast<const uint8_t*>(&index),
+                            offsetof(Index, crc));
+}
+
+bool DataQueue::writeIndex() {
+    // Always overwrite the older copy, so the newest one survives a reset
+    // in the middle of the write
+    Index index;
+    index.magic = INDEX_MAGIC;
+    index.generation = indexGeneration + 1;
+    index.head = head;
+    index.crc = indexCrc(index);
+
+    char path[PATH_LEN];
+    indexPath(index.generation & 1, path, sizeof(path));
+    File file = SPIFFS.open(path, "w");
+    if (!file) {
         return false;
     }
-    
-    JsonArray array = doc.as<JsonArray>();
-    if (array.size() == 0) {
+
+    size_t written = file.write(reinterpret_cast<const uint8_t*>(&index), sizeof(index));
+    file.close();
+    if (written != sizeof(index)) {
         return false;
     }
-    
-    // Get the first entry
-    JsonObject entry = array[0];
-    data.temperature = entry["temp"];
-    data.waterLevel = entry["water"];
-    data.waterPurity = entry["purity"];
-    data.powerConsumption = entry["power"];
-    data.pumpStatus = entry["pump"];
-    data.lastUpdate = entry["time"];
-    
-    // Remove the first entry
-    array.remove(0);
-    
-    String output;
-    serializeJson(doc, output);
-    
-    if (writeToFile(output)) {
-        queueSize--;
-        return true;
-    }
-    
-    return false;
-}
-
-bool DataQueue::writeToFile(const String& data) {
-    File file = SPIFFS.open(QUEUE_FILE, "w");
+    indexGeneration = index.generation;
+    return true;
+}
+
+bool DataQueue::readIndex(const char* path, Index& index) {
+    if (!SPIFFS.exists(path)) {
+        return false;
+    }
+
+    File file = SPIFFS.open(path, "r");
     if (!file) {
         return false;
     }
-    
-    size_t written = file.print(data);
+
+    bool ok = file.read(reinterpret_cast<uint8_t*>(&index), sizeof(index)) == sizeof(index);
     file.close();
-    
-    return written == data.length();
+    return ok && index.magic == INDEX_MAGIC && index.crc == indexCrc(index);
 }
 
-String DataQueue::readFromFile() {
-    if (!SPIFFS.exists(QUEUE_FILE)) {
-        return "[]";
+bool DataQueue::loadIndex() {
+    Index copies[2];
+    bool valid[2];
+    for (size_t i = 0; i < 2; i++) {
+        char path[PATH_LEN];
+        indexPath(i, path, sizeof(path));
+        valid[i] = readIndex(path, copies[i]);
     }
-    
-    File file = SPIFFS.open(QUEUE_FILE, "r");
-    if (!file) {
-        return "[]";
+    if (!valid[0] && !valid[1]) {
+        return false;
     }
-    
-    String data = file.readString();
-    file.close();
-    
-    return data.length() > 0 ? data : "[]";
+
+    // Newest valid copy; generations compare modulo 2^32
+    size_t newest = valid[0] ? 0 : 1;
+    if (valid[0] && valid[1] && (int32_t)(copies[1].generation - copies[0].generation) > 0) {
+        newest = 1;
+    }
+    head = copies[newest].head;
+    indexGeneration = copies[newest].generation;
+    return true;
 }
 
-void DataQueue::updateQueueSize() {
-    // Allocate memory for the JSON document
-    DynamicJsonDocument doc(2048);
+void DataQueue::recoverTail() {
+    // The newest segment is the one whose first record has the highest
+    // sequence number; the tail is the first invalid slot inside it.
+    bool found = false;
+    uint32_t newestStart = 0;
 
-    // Read JSON data from the file
-    String jsonData = readFromFile();
-    if (jsonData.isEmpty()) {
-        Serial.println("Error: JSON data is empty.");
-        return;
+    for (size_t s = 0; s < SEGMENT_COUNT; s++) {
+        char path[PATH_LEN];
+        slotPath(s, path, sizeof(path));
+        if (!SPIFFS.exists(path)) {
+            continue;
+        }
+
+        File file = SPIFFS.open(path, "r");
+        if (!file) {
+            continue;
+        }
+
+        Record record;
+        bool ok = file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record);
+        file.close();
+
+        if (ok && record.crc == recordCrc(record) &&
+            record.seq % SEGMENT_RECORDS == 0 &&
+            (record.seq / SEGMENT_RECORDS) % SEGMENT_COUNT == s &&
+            (!found || record.seq > newestStart)) {
+            newestStart = record.seq;
+            found = true;
+        }
     }
 
-    // Deserialize the JSON data
-    DeserializationError error = deserializeJson(doc, jsonData);
-    if (error) {
-        Serial.printf("Error: Failed to parse JSON - %s\n", error.c_str());
+    if (!found) {
+        head = tail = 0;
+        writeIndex();
         return;
     }
 
-    // Ensure the root is a JSON array
-    if (!doc.is<JsonArray>()) {
-        Serial.println("Error: JSON root is not an array.");
-        return;
+    char path[PATH_LEN];
+    segmentPath(newestStart, path, sizeof(path));
+    tail = newestStart;
+
+    File file = SPIFFS.open(path, "r");
+    if (file) {
+        Record record;
+        while (tail - newestStart < SEGMENT_RECORDS &&
+               file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record) &&
+               record.seq == tail && record.crc == recordCrc(record)) {
+            tail++;
+        }
+        file.close();
     }
 
-    // Update the queue size
-    queueSize = doc.as<JsonArray>().size();
-    Serial.printf("Queue size updated successfully: %d\n", queueSize);
+    // A stale or missing index can point outside the live window
+    if (head > tail) {
+        head = tail;
+    } else if (tail - head > MAX_QUEUE_SIZE) {
+        head = tail - MAX_QUEUE_SIZE;
+    }
 }
 
 void DataQueue::clear() {
-    writeToFile("[]");
-    queueSize = 0;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (size_t s = 0; s < SEGMENT_COUNT; s++) {
+        char path[PATH_LEN];
+        slotPath(s, path, sizeof(path));
+        if (SPIFFS.exists(path)) {
+            SPIFFS.remove(path);
+        }
+    }
+
+    head = tail = 0;
+    writeIndex();
+    xSemaphoreGive(lock);
+}
+
+uint32_t DataQueue::headSequence() {
+    return head;
+}
+
+uint32_t DataQueue::tailSequence() {
+    return tail;
 }
 
 size_t DataQueue::size() {
-    return queueSize;
+    return tail - head;
 }
 
 bool DataQueue::isEmpty() {
-    return queueSize == 0;
+    return head == tail;
 }
 
 bool DataQueue::isFull() {
-    return queueSize >= MAX_QUEUE_SIZE;
-}
\ No newline at end of file
+    return size() >= MAX_QUEUE_SIZE;
+}
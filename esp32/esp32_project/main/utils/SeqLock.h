@@ -0,0 +1,72 @@
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+#pragma once
+#include <atomic>
+#include <type_traits>
+#include "freertos/FreeRTOS.h"
+
+/**
+ * Sequence lock holding one trivially-copyable value shared across tasks.
+ *
+ * Readers never block or take a lock: they copy the value and retry if
+ * the sequence counter shows a write overlapped the copy. Writers bump
+ * the counter to odd, copy, then bump it back to even.
+ *
+ * The write runs inside a critical section, so a writer cannot be
+ * preempted while the counter is odd. Otherwise a higher priority reader
+ * on the same core would spin forever. Concurrent writers are serialised
+ * by the same spinlock.
+ */
+template <typename T>
+class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SeqLock values are copied byte-wise");
+
+public:
+    SeqLock() : sequence(0), value() {}
+    explicit SeqLock(const T& initial) : sequence(0), value(initial) {}
+
+    void write(const T& next) {
+        portENTER_CRITICAL(&mux);
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        copyBytes(&value, &next);
+        sequence.store(seq + 2, std::memory_order_release);
+        portEXIT_CRITICAL(&mux);
+    }
+
+    T read() const {
+        T snapshot;
+        uint32_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            copyBytes(&snapshot, &value);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return snapshot;
+    }
+
+    // Number of completed writes
+    uint32_t version() const {
+        return sequence.load(std::memory_order_acquire) / 2;
+    }
+
+private:
+    std::atomic<uint32_t> sequence;
+    T value;
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    // Volatile byte copy so the compiler cannot hoist the racy read out
+    // of the retry loop or tear it across the sequence checks.
+    static void copyBytes(volatile void* dst, const volatile void* src) {
+        volatile uint8_t* d = static_cast<volatile uint8_t*>(dst);
+        const volatile uint8_t* s = static_cast<const volatile uint8_t*>(src);
+        for (size_t i = 0; i < sizeof(T); i++) {
+            d[i] = s[i];
+        }
+    }
+};
+
+#endif // SEQ_LOCK_H
@@ -29,14 +29,28 @@ public:
     static void testTemperatureSensor();
     static void testWaterLevelSensor();
     static void testPowerSensor();
+    static void testAcPowerMeter();
+    static void testSensorFilter();
     
     // Control tests
     static void testPumpControl();
+    static void testPumpFailSafe();
+    static void testCommandDispatcher();
+    static void testReportFilter();
+    static void testBlePackedSample();
+    static void testConnectivityManager();
     
     // Storage tests
     static void testDataStorage();
     static void testDataQueue();
     
+    // Concurrency tests
+    static void testSeqLock();
+    
+    // Benchmarks (need the broker at MQTT_SERVER)
+    static void benchmarkMqtt();
+    static void benchmarkTls();
+    
     // Run all tests
     static void runAllTests();
 };
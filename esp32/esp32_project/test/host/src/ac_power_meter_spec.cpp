@@ -0,0 +1,118 @@
+#include "sensors/AcPowerMeter.h"
+#include "BDDTest.h"
+#include "trace.h"
+#include <math.h>
+
+static const float RATE_HZ = 10000.0f;
+static const float OFFSET_V = 2.5f;
+static uint16_t raw[AcPowerMeter::MAX_WINDOW];
+
+static uint16_t toCounts(float amps) {
+    float volts = OFFSET_V + amps * POWER_CALIBRATION_FACTOR;
+    return (uint16_t)lroundf(volts * ADC_MAX_COUNT / ADC_REFERENCE_VOLTAGE);
+}
+
+static void fillSine(float rmsAmps, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float phase = 2 * M_PI * MAINS_FREQUENCY_HZ * i / RATE_HZ;
+        raw[i] = toCounts(rmsAmps * sqrtf(2.0f) * sinf(phase));
+    }
+}
+
+static bool near(float expected, float actual, float tolerance) {
+    return fabsf(expected - actual) <= tolerance;
+}
+
+int test_window_whole_cycles() {
+    IT("sizes the window to whole mains cycles");
+
+    IS_EQUAL(AcPowerMeter::windowSamples(RATE_HZ, 50.0f), 1000u);
+    // 166.7 samples per cycle; five cycles fit in MAX_WINDOW
+    IS_EQUAL(AcPowerMeter::windowSamples(RATE_HZ, 60.0f), 833u);
+    IS_EQUAL(AcPowerMeter::windowSamples(0, 50.0f), 0u);
+
+    END_IT
+}
+
+int test_rms_of_sine() {
+    IT("measures the true RMS of a sine load");
+
+    size_t count = AcPowerMeter::windowSamples(RATE_HZ);
+    fillSine(5.0f, count);
+
+    AcPowerMeter meter;
+    IS_TRUE(meter.processWindow(raw, count));
+    IS_TRUE(near(5.0f, meter.getRmsCurrent(), 0.2f));
+    IS_TRUE(near(OFFSET_V, meter.getOffsetVoltage(), 0.01f));
+    IS_TRUE(near(5.0f * MAINS_VOLTAGE_RMS, meter.getApparentPower(), 50.0f));
+
+    END_IT
+}
+
+int test_rms_of_square() {
+    IT("measures the true RMS of a non-sinusoidal load");
+
+    // A square wave's RMS is its amplitude, an averaging meter reads 11% high
+    size_t count = AcPowerMeter::windowSamples(RATE_HZ);
+    size_t halfCycle = (size_t)(RATE_HZ / MAINS_FREQUENCY_HZ / 2);
+    for (size_t i = 0; i < count; i++) {
+        raw[i] = toCounts((i / halfCycle) % 2 ? -3.0f : 3.0f);
+    }
+
+    AcPowerMeter meter;
+    IS_TRUE(meter.processWindow(raw, count));
+    IS_TRUE(near(3.0f, meter.getRmsCurrent(), 0.1f));
+
+    END_IT
+}
+
+int test_no_load() {
+    IT("reads a flat line at the offset as no load");
+
+    size_t count = AcPowerMeter::windowSamples(RATE_HZ);
+    for (size_t i = 0; i < count; i++) {
+        raw[i] = toCounts(0);
+    }
+
+    AcPowerMeter meter;
+    IS_TRUE(meter.processWindow(raw, count));
+    IS_TRUE(meter.getRmsCurrent() == 0.0f);
+
+    END_IT
+}
+
+int test_window_bounds() {
+    IT("rejects empty and oversized windows");
+
+    AcPowerMeter meter;
+    IS_FALSE(meter.processWindow(raw, 0));
+    IS_FALSE(meter.processWindow(raw, AcPowerMeter::MAX_WINDOW + 1));
+
+    END_IT
+}
+
+int test_energy() {
+    IT("accumulates energy and ignores non-positive intervals");
+
+    AcPowerMeter meter;
+    meter.accumulate(1000.0f, 3600.0f);
+    meter.accumulate(1000.0f, -1.0f);
+    IS_TRUE(near(1.0f, meter.getEnergyKWh(), 0.001f));
+    meter.resetEnergy();
+    IS_TRUE(meter.getEnergyKWh() == 0.0f);
+
+    END_IT
+}
+
+int main()
+{
+    SUITE("AcPowerMeter");
+    test_window_whole_cycles();
+    test_rms_of_sine();
+    test_rms_of_square();
+    test_no_load();
+    test_window_bounds();
+    test_energy();
+
+    FINISH
+}
@@ -0,0 +1,129 @@
+#include "communication/CommandDispatcher.h"
+#include "BDDTest.h"
+#include "trace.h"
+#include <string.h>
+
+// The dispatcher's rate limit reads millis(); the specs move it by hand
+static uint32_t nowMs = 1000;
+extern "C" uint32_t millis(void) {
+    return nowMs;
+}
+
+static int echoRuns = 0;
+
+static CommandStatus echoCommand(JsonObjectConst command) {
+    echoRuns++;
+    return command["value"].is<int>() ? CommandStatus::OK : CommandStatus::BAD_REQUEST;
+}
+
+// Like the pump: only "on" waits out the interval
+static bool echoLimit(JsonObjectConst command) {
+    return command["on"] != false;
+}
+
+static size_t send(CommandDispatcher& dispatcher, const char* command, char* ack) {
+    char payload[128];
+    strcpy(payload, command);
+    return dispatcher.dispatch(payload, strlen(payload), ack, COMMAND_ACK_SIZE);
+}
+
+int test_ack_correlation_id() {
+    IT("acknowledges with the correlation id, not the command");
+
+    CommandDispatcher dispatcher;
+    dispatcher.addHandler("echo", echoCommand, 0);
+    char ack[COMMAND_ACK_SIZE];
+
+    size_t length = send(dispatcher, "{\"id\":\"c1\",\"action\":\"echo\",\"value\":1}", ack);
+    IS_TRUE(length > 0);
+    IS_TRUE(strcmp(ack, "{\"id\":\"c1\",\"status\":\"ok\"}") == 0);
+
+    send(dispatcher, "{\"id\":7,\"action\":\"echo\"}", ack);
+    IS_TRUE(strcmp(ack, "{\"id\":7,\"status\":\"bad_request\"}") == 0);
+
+    END_IT
+}
+
+int test_rate_limit() {
+    IT("refuses repeats inside the interval without running them");
+
+    CommandDispatcher dispatcher;
+    dispatcher.addHandler("echo", echoCommand, 60000);
+    char ack[COMMAND_ACK_SIZE];
+    echoRuns = 0;
+
+    send(dispatcher, "{\"action\":\"echo\",\"value\":1}", ack);
+    IS_TRUE(dispatcher.getLastStatus() == CommandStatus::OK);
+    nowMs += 59999;
+    send(dispatcher, "{\"action\":\"echo\",\"value\":2}", ack);
+    IS_TRUE(dispatcher.getLastStatus() == CommandStatus::RATE_LIMITED);
+    IS_EQUAL(echoRuns, 1);
+
+    nowMs += 1;
+    send(dispatcher, "{\"action\":\"echo\",\"value\":3}", ack);
+    IS_TRUE(dispatcher.getLastStatus() == CommandStatus::OK);
+    IS_EQUAL(echoRuns, 2);
+
+    END_IT
+}
+
+int test_limit_exemption() {
+    IT("never limits exempt commands, which still restart the interval");
+
+    CommandDispatcher dispatcher;
+    dispatcher.addHandler("echo", echoCommand, 60000, echoLimit);
+    char ack[COMMAND_ACK_SIZE];
+
+    send(dispatcher, "{\"action\":\"echo\",\"value\":1,\"on\":true}", ack);
+    send(dispatcher, "{\"action\":\"echo\",\"value\":1,\"on\":false}", ack);
+    IS_TRUE(dispatcher.getLastStatus() == CommandStatus::OK);
+
+    nowMs += 30000;
+    send(dispatcher, "{\"action\":\"echo\",\"value\":1,\"on\":true}", ack);
+    IS_TRUE(dispatcher.getLastStatus() == CommandStatus::RATE_LIMITED);
+
+    END_IT
+}
+
+int test_rejects() {
+    IT("rejects unknown actions and malformed commands");
+
+    CommandDispatcher dispatcher;
+    dispatcher.addHandler("echo", echoCommand, 0);
+    char ack[COMMAND_ACK_SIZE];
+
+    send(dispatcher, "{\"action\":\"reboot\"}", ack);
+    IS_TRUE(dispatcher.getLastStatus() == CommandStatus::UNKNOWN_ACTION);
+    send(dispatcher, "{\"value\":1}", ack);
+    IS_TRUE(dispatcher.getLastStatus() == CommandStatus::BAD_REQUEST);
+    send(dispatcher, "PUMP=ON", ack);
+    IS_TRUE(dispatcher.getLastStatus() == CommandStatus::BAD_REQUEST);
+    IS_TRUE(strcmp(ack, "{\"status\":\"bad_request\"}") == 0);
+
+    END_IT
+}
+
+int test_handler_table() {
+    IT("holds at most COMMAND_MAX_HANDLERS actions");
+
+    CommandDispatcher dispatcher;
+    for (int i = 0; i < COMMAND_MAX_HANDLERS; i++) {
+        IS_TRUE(dispatcher.addHandler("echo", echoCommand, 0));
+    }
+    IS_FALSE(dispatcher.addHandler("echo", echoCommand, 0));
+    IS_FALSE(CommandDispatcher().addHandler("echo", nullptr, 0));
+
+    END_IT
+}
+
+int main()
+{
+    SUITE("CommandDispatcher");
+    test_ack_correlation_id();
+    test_rate_limit();
+    test_limit_exemption();
+    test_rejects();
+    test_handler_table();
+
+    FINISH
+}
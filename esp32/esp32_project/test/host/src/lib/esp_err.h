@@ -0,0 +1,12 @@
+#ifndef esp_err_h
+#define esp_err_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#endif
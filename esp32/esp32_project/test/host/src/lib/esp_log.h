@@ -0,0 +1,17 @@
+#ifndef esp_log_h
+#define esp_log_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Log lines only show with TRACE set, like the PubSubClient specs
+#define ESP_LOG_HOST(level, tag, format, ...) \
+    { if (getenv("TRACE")) { printf("%s (%s): " format "\n", level, tag, ##__VA_ARGS__); } }
+#define ESP_LOGE(tag, format, ...) ESP_LOG_HOST("E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_HOST("W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_HOST("I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_HOST("D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_HOST("V", tag, format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef freertos_h
+#define freertos_h
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Critical sections become a mutex, which is what they guarantee across
+// cores: one holder at a time
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(mux)
+
+typedef uint32_t TickType_t;
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+
+#endif
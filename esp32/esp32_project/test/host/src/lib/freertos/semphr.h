@@ -0,0 +1,23 @@
+#ifndef semphr_h
+#define semphr_h
+
+#include "freertos/FreeRTOS.h"
+
+// Mutexes only, held in the caller's static buffer. Waits are unbounded:
+// the firmware only takes them with portMAX_DELAY.
+typedef pthread_mutex_t StaticSemaphore_t;
+typedef pthread_mutex_t* SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer) {
+    pthread_mutex_init(buffer, NULL);
+    return buffer;
+}
+static inline bool xSemaphoreTake(SemaphoreHandle_t mutex, TickType_t ticks) {
+    (void)ticks;
+    return pthread_mutex_lock(mutex) == 0;
+}
+static inline bool xSemaphoreGive(SemaphoreHandle_t mutex) {
+    return pthread_mutex_unlock(mutex) == 0;
+}
+
+#endif
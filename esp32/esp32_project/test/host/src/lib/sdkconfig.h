@@ -0,0 +1,6 @@
+#ifndef sdkconfig_h
+#define sdkconfig_h
+
+// Host builds take every Kconfig option at its default
+
+#endif
@@ -0,0 +1,149 @@
+#include "communication/ReportFilter.h"
+#include "BDDTest.h"
+#include "trace.h"
+#include <math.h>
+
+static SensorData steadyTank() {
+    SensorData data = {};
+    data.temperature = 25.0f;
+    data.tdsValue = 150.0f;
+    data.waterLevel = 80.0f;
+    data.totalWaterUsed = 10.0f;
+    return data;
+}
+
+int test_first_reading() {
+    IT("reports the first reading and the one after a reset");
+
+    ReportFilter filter;
+    ReportPolicy policy;
+    SensorData data = steadyTank();
+    IS_TRUE(filter.shouldReport(data, policy, 0));
+    IS_FALSE(filter.shouldReport(data, policy, 2000));
+    filter.reset();
+    IS_TRUE(filter.shouldReport(data, policy, 4000));
+
+    END_IT
+}
+
+int test_deadband() {
+    IT("holds back noise inside the deadbands");
+
+    ReportFilter filter;
+    ReportPolicy policy;
+    SensorData steady = steadyTank();
+    filter.shouldReport(steady, policy, 0);
+
+    SensorData noisy = steady;
+    noisy.temperature += policy.temperature / 2;
+    noisy.waterLevel -= policy.waterLevel / 2;
+    IS_FALSE(filter.shouldReport(noisy, policy, 2000));
+
+    END_IT
+}
+
+int test_drift() {
+    IT("measures drift from the last report, not the last sample");
+
+    ReportFilter filter;
+    ReportPolicy policy;
+    SensorData drift = steadyTank();
+    filter.shouldReport(drift, policy, 0);
+
+    drift.temperature += policy.temperature * 0.9f;
+    IS_FALSE(filter.shouldReport(drift, policy, 2000));
+    drift.temperature += policy.temperature * 0.2f;
+    IS_TRUE(filter.shouldReport(drift, policy, 4000));
+
+    END_IT
+}
+
+int test_pump_and_failed_reads() {
+    IT("reports pump switches and sensors failing or recovering");
+
+    ReportFilter filter;
+    ReportPolicy policy;
+    SensorData data = steadyTank();
+    filter.shouldReport(data, policy, 0);
+
+    data.pumpStatus = true;
+    IS_TRUE(filter.shouldReport(data, policy, 100));
+    data.tdsValue = NAN;
+    IS_TRUE(filter.shouldReport(data, policy, 200));
+    IS_FALSE(filter.shouldReport(data, policy, 300));
+    data.tdsValue = 150.0f;
+    IS_TRUE(filter.shouldReport(data, policy, 400));
+
+    END_IT
+}
+
+int test_billing_reset() {
+    IT("reports the total dropping back at the monthly billing reset");
+
+    ReportFilter filter;
+    ReportPolicy policy;
+    SensorData data = steadyTank();
+    filter.shouldReport(data, policy, 0);
+
+    data.totalWaterUsed += policy.totalWater / 2;
+    IS_FALSE(filter.shouldReport(data, policy, 2000));
+    data.totalWaterUsed = 0.0f;
+    IS_TRUE(filter.shouldReport(data, policy, 4000));
+    IS_FALSE(filter.shouldReport(data, policy, 6000));
+
+    END_IT
+}
+
+int test_heartbeat() {
+    IT("sends one heartbeat per interval on a steady tank");
+
+    ReportFilter filter;
+    ReportPolicy policy;
+    policy.heartbeatMs = 60000;
+    SensorData data = steadyTank();
+    filter.shouldReport(data, policy, 0);
+    IS_FALSE(filter.shouldReport(data, policy, 59999));
+    IS_TRUE(filter.shouldReport(data, policy, 60000));
+
+    ReportFilter::Stats before = filter.getStats();
+    for (uint32_t t = 62000; t < 62000 + 60000; t += SENSOR_READ_INTERVAL) {
+        filter.shouldReport(data, policy, t);
+    }
+    ReportFilter::Stats after = filter.getStats();
+    IS_EQUAL(after.readings - before.readings, 60000u / SENSOR_READ_INTERVAL);
+    IS_EQUAL(after.reported - before.reported, 1u);
+
+    END_IT
+}
+
+int test_policy_validation() {
+    IT("accepts the defaults and rejects out-of-range policies");
+
+    IS_TRUE(ReportFilter::isValid(ReportPolicy()));
+
+    ReportPolicy policy;
+    policy.flow = -1.0f;
+    IS_FALSE(ReportFilter::isValid(policy));
+    policy = ReportPolicy();
+    policy.temperature = NAN;
+    IS_FALSE(ReportFilter::isValid(policy));
+    policy = ReportPolicy();
+    policy.heartbeatMs = REPORT_HEARTBEAT_MAX_MS + 1;
+    IS_FALSE(ReportFilter::isValid(policy));
+
+    END_IT
+}
+
+int main()
+{
+    SUITE("ReportFilter");
+    test_first_reading();
+    test_deadband();
+    test_drift();
+    test_pump_and_failed_reads();
+    test_billing_reset();
+    test_heartbeat();
+    test_policy_validation();
+
+    FINISH
+}
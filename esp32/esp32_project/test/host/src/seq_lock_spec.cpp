@@ -0,0 +1,125 @@
+#include "utils/SeqLock.h"
+#include "config.h"
+#include "BDDTest.h"
+#include "trace.h"
+#include <atomic>
+#include <pthread.h>
+#include <unistd.h>
+
+// Wide enough that a copy racing a write would see mixed fields
+struct StressSample {
+    uint32_t fields[64];
+};
+
+struct Stress {
+    SeqLock<StressSample> lock;
+    std::atomic<bool> stop{false};
+    std::atomic<uint32_t> tornReads{0};
+    std::atomic<uint32_t> staleReads{0};
+    std::atomic<uint32_t> reads{0};
+    std::atomic<uint32_t> nextValue{1};
+};
+
+static void* writer(void* arg) {
+    Stress* stress = static_cast<Stress*>(arg);
+    StressSample sample;
+    while (!stress->stop.load()) {
+        uint32_t n = stress->nextValue++;
+        for (uint32_t& field : sample.fields) field = n;
+        stress->lock.write(sample);
+    }
+    return NULL;
+}
+
+static void* reader(void* arg) {
+    Stress* stress = static_cast<Stress*>(arg);
+    uint32_t version = 0;
+    while (!stress->stop.load()) {
+        StressSample sample = stress->lock.read();
+        for (uint32_t field : sample.fields) {
+            if (field != sample.fields[0]) {
+                stress->tornReads++;
+                break;
+            }
+        }
+        // The version a reader sees never goes backwards
+        uint32_t now = stress->lock.version();
+        if (now < version) {
+            stress->staleReads++;
+        }
+        version = now;
+        stress->reads++;
+    }
+    return NULL;
+}
+
+static void runStress(Stress& stress, int writers, int readers) {
+    pthread_t threads[8];
+    int count = 0;
+    for (int i = 0; i < writers; i++) {
+        pthread_create(&threads[count++], NULL, writer, &stress);
+    }
+    for (int i = 0; i < readers; i++) {
+        pthread_create(&threads[count++], NULL, reader, &stress);
+    }
+    sleep(1);
+    stress.stop = true;
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    TRACE(stress.reads.load() << " reads, " << stress.lock.version() << " writes\n");
+}
+
+int test_single_thread() {
+    IT("returns the last value written");
+
+    SeqLock<SensorData> lock;
+    IS_EQUAL(lock.version(), 0u);
+
+    SensorData data = {};
+    data.temperature = 21.5f;
+    data.pumpStatus = true;
+    lock.write(data);
+    SensorData copy = lock.read();
+    IS_TRUE(copy.temperature == 21.5f);
+    IS_TRUE(copy.pumpStatus);
+    IS_EQUAL(lock.version(), 1u);
+
+    END_IT
+}
+
+int test_one_writer() {
+    IT("never returns a torn value to concurrent readers");
+
+    static Stress stress;
+    runStress(stress, 1, 3);
+    IS_TRUE(stress.reads.load() > 0);
+    IS_TRUE(stress.lock.version() > 0);
+    IS_EQUAL(stress.tornReads.load(), 0u);
+    IS_EQUAL(stress.staleReads.load(), 0u);
+
+    END_IT
+}
+
+int test_two_writers() {
+    IT("serialises concurrent writers");
+
+    static Stress stress;
+    runStress(stress, 2, 2);
+    IS_TRUE(stress.reads.load() > 0);
+    IS_EQUAL(stress.tornReads.load(), 0u);
+    // Every write completed exactly once
+    IS_EQUAL(stress.lock.version(), stress.nextValue.load() - 1);
+
+    END_IT
+}
+
+int main()
+{
+    SUITE("SeqLock");
+    test_single_thread();
+    test_one_writer();
+    test_two_writers();
+
+    FINISH
+}
@@ -0,0 +1,63 @@
+import { decodeBatch, decodeReading } from '../telemetry';
+
+// Payloads encoded by the firmware's createSensorCbor/createBatchCbor
+const SINGLE = 'a90001011a0001d4c002fa41c4000003fa4316000004fa4291000005fa0000000006fa0000000007fa4144000008f4';
+const SAMPLES = '098388001909921905dc1902d50000192fdaf4881907d038180c38181912c51904e218faf5881907d0062c3005211901a0f5';
+const BATCH = 'a30001011a0001d4c0' + SAMPLES;
+const BACKLOG = 'a400010a191000011a0001d4c0' + SAMPLES;
+
+const hex = (payload: string) => Buffer.from(payload, 'hex');
+
+describe('CBOR telemetry', () => {
+  it('should decode a single reading', () => {
+    expect(decodeReading(hex(SINGLE))).toEqual({
+      temperature: 24.5,
+      tdsValue: 150,
+      waterLevel: 72.5,
+      powerConsumption: 0,
+      waterFlow: 0,
+      totalWaterUsed: 12.25,
+      pumpStatus: false,
+      timestamp: 120000
+    });
+  });
+
+  it('should expand delta-encoded batch samples', () => {
+    const readings = decodeBatch(hex(BATCH));
+
+    expect(readings).toHaveLength(3);
+    expect(readings[0]).toEqual({
+      temperature: 24.5,
+      tdsValue: 150,
+      waterLevel: 72.5,
+      powerConsumption: 0,
+      waterFlow: 0,
+      totalWaterUsed: 12.25,
+      pumpStatus: false,
+      timestamp: 120000
+    });
+    expect(readings[2]).toEqual({
+      temperature: 24.31,
+      tdsValue: 149.9,
+      waterLevel: 68.3,
+      powerConsumption: 481,
+      waterFlow: 12.48,
+      totalWaterUsed: 12.916,
+      pumpStatus: true,
+      timestamp: 124000
+    });
+    expect(readings[1].sequence).toBeUndefined();
+  });
+
+  it('should number backlog samples from the first sequence', () => {
+    const readings = decodeBatch(hex(BACKLOG));
+
+    expect(readings.map(r => r.sequence)).toEqual([4096, 4097, 4098]);
+    expect(readings[1].powerConsumption).toBe(480.5);
+  });
+
+  it('should reject truncated payloads', () => {
+    expect(() => decodeBatch(hex(BATCH).subarray(0, 20))).toThrow();
+    expect(() => decodeReading(hex(SINGLE + '00'))).toThrow();
+  });
+});
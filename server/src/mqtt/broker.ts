@@ -1,6 +1,7 @@
 import * as mqtt from 'mqtt';
 import { DeviceService } from '../services/DeviceService';
 import { MQTTHandler } from './handlers';
+import { decodeBatch, decodeReading } from './telemetry';
 
 export class MQTTBroker {
   private client!: mqtt.Client; // This tells TypeScript that it will be initialized later.
@@ -31,14 +32,23 @@ export class MQTTBroker {
 
   private subscribeToTopics() {
     this.client.subscribe('smarttank/+/data');
+    // CBOR telemetry: single readings, live batches and the offline backlog
+    this.client.subscribe('smarttank/+/data/cbor');
+    this.client.subscribe('smarttank/+/batch/cbor');
+    this.client.subscribe('smarttank/+/backlog/cbor');
     this.client.subscribe('smarttank/+/status');
     this.client.subscribe('smarttank/+/command');
   }
 
   private handleMessage(topic: string, message: Buffer) {
-    const [prefix, deviceId, type] = topic.split('/');
+    const [prefix, deviceId, type, encoding] = topic.split('/');
     
     try {
+      if (encoding === 'cbor') {
+        this.handleTelemetry(deviceId, type, message);
+        return;
+      }
+
       const payload = JSON.parse(message.toString());
       
       switch (type) {
@@ -56,4 +66,11 @@ export class MQTTBroker {
       console.error('Error handling MQTT message:', error);
     }
   }
+
+  private handleTelemetry(deviceId: string, type: string, message: Buffer) {
+    const readings = type === 'data' ? [decodeReading(message)] : decodeBatch(message);
+    for (const reading of readings) {
+      this.handler.handleData(deviceId, reading);
+    }
+  }
 }
\ No newline at end of file
@@ -0,0 +1,222 @@
+// src/mqtt/telemetry.ts
+
+// Decodes the device's CBOR telemetry (smarttank/<id>/{data,batch,backlog}/cbor)
+// into the same reading shape the JSON data topic carries. The schema lives in
+// the firmware's MqttClient.h: integer map keys, new fields take new keys, and
+// existing keys never change type or unit, so unknown keys are ignored.
+
+export interface TelemetryReading {
+  temperature: number;
+  tdsValue: number;
+  waterLevel: number;
+  powerConsumption: number;
+  waterFlow: number;
+  totalWaterUsed: number;
+  pumpStatus: boolean;
+  timestamp: number;
+  sequence?: number;
+}
+
+const Key = {
+  TIMESTAMP: 1,
+  TEMPERATURE: 2,
+  TDS: 3,
+  WATER_LEVEL: 4,
+  POWER: 5,
+  FLOW: 6,
+  TOTAL_WATER: 7,
+  PUMP: 8,
+  SAMPLES: 9,
+  SEQUENCE: 10
+};
+
+// Fixed-point scale of the six batch channels (TELEMETRY_BATCH_SCALE)
+const BATCH_SCALE = [100, 10, 10, 10, 100, 1000];
+
+class CborReader {
+  private offset = 0;
+
+  constructor(private buffer: Buffer) {}
+
+  get done(): boolean {
+    return this.offset === this.buffer.length;
+  }
+
+  read(): any {
+    const initial = this.byte();
+    const major = initial >> 5;
+    const info = initial & 0x1f;
+
+    if (major === 7) {
+      return this.simple(info);
+    }
+
+    const arg = this.argument(info);
+    switch (major) {
+      case 0:
+        return arg;
+      case 1:
+        return -1 - arg;
+      case 2:
+        return this.take(arg);
+      case 3:
+        return this.take(arg).toString('utf8');
+      case 4: {
+        const items: any[] = [];
+        for (let i = 0; i < arg; i++) {
+          items.push(this.read());
+        }
+        return items;
+      }
+      case 5: {
+        const map = new Map<any, any>();
+        for (let i = 0; i < arg; i++) {
+          const key = this.read();
+          map.set(key, this.read());
+        }
+        return map;
+      }
+      default:
+        // Tags carry no meaning in this schema; decode the tagged item
+        return this.read();
+    }
+  }
+
+  private argument(info: number): number {
+    if (info < 24) {
+      return info;
+    }
+    switch (info) {
+      case 24:
+        return this.byte();
+      case 25:
+        return this.buffer.readUInt16BE(this.advance(2));
+      case 26:
+        return this.buffer.readUInt32BE(this.advance(4));
+      case 27: {
+        const at = this.advance(8);
+        return this.buffer.readUInt32BE(at) * 0x100000000 + this.buffer.readUInt32BE(at + 4);
+      }
+    }
+    throw new Error(`Unsupported CBOR length encoding ${info}`);
+  }
+
+  private simple(info: number): any {
+    switch (info) {
+      case 20:
+        return false;
+      case 21:
+        return true;
+      case 22:
+        return null;
+      case 23:
+        return undefined;
+      case 25:
+        return halfToFloat(this.buffer.readUInt16BE(this.advance(2)));
+      case 26:
+        return this.buffer.readFloatBE(this.advance(4));
+      case 27:
+        return this.buffer.readDoubleBE(this.advance(8));
+    }
+    throw new Error(`Unsupported CBOR simple value ${info}`);
+  }
+
+  private byte(): number {
+    return this.buffer[this.advance(1)];
+  }
+
+  private take(length: number): Buffer {
+    const at = this.advance(length);
+    return this.buffer.subarray(at, at + length);
+  }
+
+  private advance(length: number): number {
+    const at = this.offset;
+    if (at + length > this.buffer.length) {
+      throw new Error('Truncated CBOR payload');
+    }
+    this.offset += length;
+    return at;
+  }
+}
+
+function halfToFloat(half: number): number {
+  const sign = half & 0x8000 ? -1 : 1;
+  const exponent = (half >> 10) & 0x1f;
+  const mantissa = half & 0x3ff;
+  if (exponent === 0) {
+    return sign * mantissa * Math.pow(2, -24);
+  }
+  if (exponent === 31) {
+    return mantissa ? NaN : sign * Infinity;
+  }
+  return sign * (1 + mantissa / 1024) * Math.pow(2, exponent - 15);
+}
+
+function decodeMap(payload: Buffer): Map<number, any> {
+  const reader = new CborReader(payload);
+  const value = reader.read();
+  if (!(value instanceof Map) || !reader.done) {
+    throw new Error('Telemetry payload is not a single CBOR map');
+  }
+  return value;
+}
+
+// Floats go over the wire as float32; round off the widening noise
+function round(value: number): number {
+  return Math.round(value * 1e4) / 1e4;
+}
+
+export function decodeReading(payload: Buffer): TelemetryReading {
+  const map = decodeMap(payload);
+  return {
+    temperature: round(map.get(Key.TEMPERATURE)),
+    tdsValue: round(map.get(Key.TDS)),
+    waterLevel: round(map.get(Key.WATER_LEVEL)),
+    powerConsumption: round(map.get(Key.POWER)),
+    waterFlow: round(map.get(Key.FLOW)),
+    totalWaterUsed: round(map.get(Key.TOTAL_WATER)),
+    pumpStatus: map.get(Key.PUMP) === true,
+    timestamp: map.get(Key.TIMESTAMP)
+  };
+}
+
+// Batches and backlog segments carry delta-encoded samples
+// [dt ms, temperature, tds, level, power, flow, total, pump]: the first
+// sample is absolute, every later one is relative to its predecessor.
+export function decodeBatch(payload: Buffer): TelemetryReading[] {
+  const map = decodeMap(payload);
+  const samples = map.get(Key.SAMPLES);
+  if (!Array.isArray(samples)) {
+    throw new Error('Telemetry batch has no samples');
+  }
+
+  const firstSequence: number | undefined = map.get(Key.SEQUENCE);
+  const values = [0, 0, 0, 0, 0, 0];
+  let timestamp: number = map.get(Key.TIMESTAMP);
+
+  return samples.map((sample: any[], i: number) => {
+    if (!Array.isArray(sample) || sample.length < 8) {
+      throw new Error(`Malformed telemetry sample ${i}`);
+    }
+    timestamp += sample[0];
+    for (let f = 0; f < values.length; f++) {
+      values[f] += sample[f + 1];
+    }
+
+    const reading: TelemetryReading = {
+      temperature: values[0] / BATCH_SCALE[0],
+      tdsValue: values[1] / BATCH_SCALE[1],
+      waterLevel: values[2] / BATCH_SCALE[2],
+      powerConsumption: values[3] / BATCH_SCALE[3],
+      waterFlow: values[4] / BATCH_SCALE[4],
+      totalWaterUsed: values[5] / BATCH_SCALE[5],
+      pumpStatus: sample[7] === true,
+      timestamp
+    };
+    if (firstSequence !== undefined) {
+      reading.sequence = firstSequence + i;
+    }
+    return reading;
+  });
+}